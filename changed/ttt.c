@@ -12,8 +12,6 @@
 #define SERVER_PORT 5000
 #define MAX_MESSAGE_LENGTH 1024
 
-int connect_to_server(const char *ip, int port);
-
 void handle_user_input(int server_fd)
 {
     char input[256];
@@ -35,7 +33,7 @@ void handle_user_input(int server_fd)
         {	
 			char name[250];
 			if (sscanf(msg, "%[^|]|", name) == 1){
-				if(strlen(name)+1==length) write_msg(server_fd, name);
+				if(strlen(name)+1==length) write_msg(server_fd, input);
 				else printf("INVL|22|Length does not match|\n");
 			}
 			else printf("INVL|16|Improper format|\n");
@@ -65,6 +63,11 @@ void handle_user_input(int server_fd)
 
 void handle_server_messages(int server_fd)
 {
+	msgbuf_t in;
+	char response[MAX_MSG_LEN];
+	int len;
+
+	msgbuf_init(&in, FRAME_PIPE);
 	while (1)
 	{
 		// Initialize file descriptor set
@@ -85,14 +88,17 @@ void handle_server_messages(int server_fd)
 		// If data is available on the server
 		if (FD_ISSET(server_fd, &read_fds))
 		{
-			char *response = receive_msg(server_fd);
-			if (response == NULL)
+			if (msgbuf_fill(&in, server_fd) <= 0)
 			{
 				perror("Error receiving message from server");
 				exit(EXIT_FAILURE);
 			}
-			else printf("%s\n", response);
-			free(response);
+
+			// one read can carry several frames, or only part of one
+			while ((len = msgbuf_next(&in, response, sizeof(response))) != 0)
+			{
+				if (len > 0) printf("%s\n", response);
+			}
 		}
 
 		// If data is available on stdin
@@ -114,6 +120,10 @@ int main(int argc, char *argv[])
 
 	char *ip = (argc == 2) ? argv[1] : SERVER_IP;
 	int client_socket = connect_to_server(ip, SERVER_PORT);
+	if (client_socket == -1)
+	{
+		exit(EXIT_FAILURE);
+	}
 
 	handle_server_messages(client_socket);
 
@@ -122,41 +132,6 @@ int main(int argc, char *argv[])
 	return 0;
 }
 
-int connect_to_server(const char *ip, int port)
-{
-	// Create a socket
-	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (sockfd == -1)
-	{
-		perror("Error creating socket");
-		exit(EXIT_FAILURE);
-	}
-
-	// Set server address
-	struct sockaddr_in server_address;
-	memset(&server_address, 0, sizeof(server_address));
-	server_address.sin_family = AF_INET;
-	server_address.sin_port = htons(port);
-	if (inet_pton(AF_INET, ip, &server_address.sin_addr) != 1)
-	{
-		perror("Error parsing server IP address");
-		exit(EXIT_FAILURE);
-	}
-
-	printf("Attempting to connect to server at %s:%d\n", ip, port);
-
-	// Connect to server
-	if (connect(sockfd, (struct sockaddr *) &server_address, sizeof(server_address)) == -1)
-	{
-		perror("Error connecting to server");
-		exit(EXIT_FAILURE);
-	}
-
-	printf("Connected to server at %s:%d\n", ip, port);
-
-	return sockfd;
-}
-
 int read_user_input(char *input)
 {
 	// Read a line of input from the user
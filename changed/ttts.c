@@ -1,4 +1,5 @@
 #include "protocol.h"
+#include "codec.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,10 +10,15 @@
 #include <unistd.h>
 #include <signal.h>
 #define PORT 5000
-#define MAX_CLIENTS 10
+#define MAX_GAMES 1024
 #define MAX_NAME_LEN 20
 #define BOARD_SIZE 9
 
+// a slot in games[] is free for a new game while GAME_FREE
+#define GAME_FREE -1
+#define GAME_WAITING 0
+#define GAME_PLAYING 1
+
 typedef struct
 {
 	char name[MAX_NAME_LEN];
@@ -26,18 +32,28 @@ typedef struct
 {
 	player_t players[2];
 	int status;
+	int seated;                 // players still holding the slot, freed when both left
+	int finished;               // OVER went out, the players only have to leave
+	int next_free;              // the next slot on the free list while GAME_FREE
 	pthread_mutex_t lock;
 	char board[BOARD_SIZE];
 	int current_turn;
 }
 game_t;
 
-game_t games[MAX_CLIENTS];
-int num_games = 0;
-pthread_mutex_t game_lock;
-char player_names[MAX_CLIENTS *2][MAX_NAME_LEN];
+// games never move, so a game_id stays valid for the whole session; game_lock
+// guards the status of every slot, a game's own lock everything else in it,
+// and is always taken after game_lock
+game_t games[MAX_GAMES];
+pthread_mutex_t game_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// free slots, linked through next_free, and the game with a player waiting;
+// a game only opens while none waits, so there is never more than one
+int free_head = -1;
+int waiting_game = -1;
+char player_names[MAX_GAMES * 2][MAX_NAME_LEN];
 int num_player_names = 0;
-pthread_mutex_t player_name_lock;
+pthread_mutex_t player_name_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void init_board(char board[BOARD_SIZE])
 {
@@ -50,7 +66,9 @@ void init_board(char board[BOARD_SIZE])
 	}
 }
 
-int check_name(char *name)
+// check and take the name in one step, so two clients racing for it cannot
+// both get it; 0 when it is in use, -1 when every name is taken
+int reserve_name(char *name)
 {
 	pthread_mutex_lock(&player_name_lock);
 	for (int i = 0; i < num_player_names; i++)
@@ -61,377 +79,301 @@ int check_name(char *name)
 			return 0;
 		}
 	}
+	if (num_player_names == MAX_GAMES * 2)
+	{
+		pthread_mutex_unlock(&player_name_lock);
+		return -1;
+	}
 
+	strcpy(player_names[num_player_names++], name);
 	pthread_mutex_unlock(&player_name_lock);
 	return 1;
 }
 
+void release_name(char *name)
+{
+	pthread_mutex_lock(&player_name_lock);
+	for (int i = 0; i < num_player_names; i++)
+	{
+		if (strcmp(name, player_names[i]) == 0)
+		{
+			// the last name fills the hole
+			if (i != --num_player_names)
+			{
+				strcpy(player_names[i], player_names[num_player_names]);
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&player_name_lock);
+}
+
+// encode msg in the pipe framing, the codec counts the length prefix
+static void send_msg(int fd, const message_t *msg)
+{
+	char buf[MAX_MSG_LEN];
+	int len = codec_encode(FRAME_PIPE, msg, buf, sizeof(buf));
+
+	if (len > 0 && write(fd, buf, len) < 0)
+	{
+		fprintf(stderr, "Error sending message\n");
+	}
+}
+
+static void send_invl(int fd, const char *reason)
+{
+	message_t msg;
+	message_init(&msg, OP_INVL);
+	message_string(&msg, reason);
+	send_msg(fd, &msg);
+}
+
+static void send_begn(int fd, char role, const char *opponent)
+{
+	message_t msg;
+	message_init(&msg, OP_BEGN);
+	message_field(&msg, &role, 1);
+	message_string(&msg, opponent);
+	send_msg(fd, &msg);
+}
+
+// board is NULL for an OVER that does not show the final board
+static void send_over(int fd, const char *outcome, const char *reason, const char *board)
+{
+	message_t msg;
+	message_init(&msg, OP_OVER);
+	message_string(&msg, outcome);
+	message_string(&msg, reason);
+	if (board != NULL)
+	{
+		message_field(&msg, board, BOARD_SIZE);
+	}
+	send_msg(fd, &msg);
+}
+
+static void send_draw(int fd, const char *response)
+{
+	message_t msg;
+	message_init(&msg, OP_DRAW_OFFER);
+	message_string(&msg, response);
+	send_msg(fd, &msg);
+}
+
 void *handle_client(void *arg)
 {
 	int client_fd = *((int*) arg);
 	free(arg);
-	char *buf;
-	char cmd[50];
-	unsigned long length;
-	char msg[50];
+	char buf[2500];
+	char name[MAX_NAME_LEN];
+	char reason[2 * MAX_NAME_LEN + 16];
+	msgbuf_t in;
+	message_t msg;
+	request_t req;
+	int len;
 	int game_id = -1;
 	player_t player;
 
 	// read player name
-	buf = receive_msg(client_fd);
-	if (buf == NULL)
+	msgbuf_init(&in, FRAME_PIPE);
+	if ((len = read_msg(&in, client_fd, buf, sizeof(buf))) < 0)
 	{
 		close(client_fd);
 		return NULL;
 	}
 
-	if (check_name(buf) == 0)
+	if (codec_decode(FRAME_PIPE, buf, len, &msg) != 1 || memcmp(msg.type, MSG_PLAY, 4) != 0 || msg.lens[0] == 0 || msg.lens[0] >= MAX_NAME_LEN)
 	{
-		write_msg(client_fd, "INVL|20|name already in use|");
+		send_invl(client_fd, "Improperly formatted");
 		close(client_fd);
-		free(buf);
 		return NULL;
 	}
-	else
+	memcpy(name, msg.fields[0], msg.lens[0]);
+	name[msg.lens[0]] = '\0';
+
+	int reserved = reserve_name(name);
+	if (reserved <= 0)
 	{
-		pthread_mutex_lock(&player_name_lock);
-		strcpy(player_names[num_player_names++], buf);
-		pthread_mutex_unlock(&player_name_lock);
+		send_invl(client_fd, (reserved == 0) ? "name already in use" : "Server full");
+		close(client_fd);
+		return NULL;
 	}
+	strcpy(player.name, name);
+	player.sock_fd = client_fd;
 
 	pthread_mutex_lock(&game_lock);
-	for (int i = 0; i < num_games; i++)
+	if (waiting_game != -1)
 	{
-		if (games[i].status == 0 && strcmp(games[i].players[0].name, buf) != 0)
-		{
-			// join existing game
-			game_id = i;
-			sscanf(buf, "%[^\n]", player.name);
-			player.sock_fd = client_fd;
-			player.role = 'O';
-			games[i].players[1] = player;
-			games[i].status = 1;
-			pthread_mutex_unlock(&game_lock);
-			sprintf(buf, "BEGN|%ld|%c|%s|", 3+strlen(games[i].players[0].name), games[i].players[1].role, games[i].players[0].name);
-			write_msg(games[i].players[1].sock_fd, buf);
-			sprintf(buf, "BEGN|%ld|%c|%s|", 3+strlen(games[i].players[1].name), games[i].players[0].role, games[i].players[1].name);
-			write_msg(games[i].players[0].sock_fd, buf);
-			break;
-		}
+		// join existing game
+		game_id = waiting_game;
+		waiting_game = -1;
+		player.role = 'O';
+		pthread_mutex_lock(&games[game_id].lock);
+		games[game_id].players[1] = player;
+		games[game_id].status = GAME_PLAYING;
+		games[game_id].seated = 2;
+		pthread_mutex_unlock(&game_lock);
+		send_begn(games[game_id].players[1].sock_fd, games[game_id].players[1].role, games[game_id].players[0].name);
+		send_begn(games[game_id].players[0].sock_fd, games[game_id].players[0].role, games[game_id].players[1].name);
+		pthread_mutex_unlock(&games[game_id].lock);
 	}
-
-	if (game_id == -1)
+	else if (free_head != -1)
 	{
 		// create new game
-		game_id = num_games++;
-		sscanf(buf, "%[^\n]", player.name);
-		player.sock_fd = client_fd;
+		game_id = free_head;
+		free_head = games[game_id].next_free;
+		waiting_game = game_id;
 		player.role = 'X';
+		pthread_mutex_lock(&games[game_id].lock);
 		games[game_id].players[0] = player;
-		games[game_id].status = 0;
-		pthread_mutex_init(&games[game_id].lock, NULL);
+		games[game_id].players[1].sock_fd = -1;
+		games[game_id].status = GAME_WAITING;
+		games[game_id].seated = 1;
+		games[game_id].finished = 0;
+		games[game_id].current_turn = 0;
 		init_board(games[game_id].board);
 		pthread_mutex_unlock(&game_lock);
-		write_msg(client_fd, "WAIT|0|");
-		games[game_id].current_turn = 0;
+		message_init(&msg, OP_WAIT);
+		send_msg(client_fd, &msg);
+		pthread_mutex_unlock(&games[game_id].lock);
 	}
-
-	// read player moves
-	while (1)
+	else
 	{
-		buf = receive_msg(client_fd);
-		printf("Received message: %s", buf);
+		pthread_mutex_unlock(&game_lock);
+		send_invl(client_fd, "Server full");
+		release_name(player.name);
+		close(client_fd);
+		return NULL;
+	}
 
-		if (buf == NULL)
+	// read player moves until the game is over or the player leaves
+	int over = 0;
+	while (!over)
+	{
+		if ((len = read_msg(&in, client_fd, buf, sizeof(buf))) < 0)
 		{
-			printf("Connection dropped by client %d\n", client_fd);
-			close(client_fd);
 			break;
 		}
 
-		// process player move
+		// the same decoder and request parser as the ttt/ server
 		pthread_mutex_lock(&games[game_id].lock);
-		if (sscanf(buf, "%4s|%ld|%[^\n]", cmd, &length, msg) == 3)
-		{
-			if (strcmp(cmd, "MOVE") == 0)
-			{
-				char pos[50];
-				char role;
-				if (sscanf(msg, "%c|%[^|]|", &role, pos) == 2)
-				{
-					printf("Received move: %ld %c %s\n", length, role, pos);
-					if (validate_move(pos) == 0)
-					{
-						write_msg(client_fd, "INVL|19|Cell out of bounds|");
-					}
-					else if(role!=player.role){
-						write_msg(client_fd, "INVL|14|Not your role|");
-					}
-					else if(length!=6){
-						write_msg(client_fd, "INVL|22|Length does not match|");
-					}
-					else
-					{
-					 	// Check if it's the current player's turn
-						int player_index = (player.role == games[game_id].players[0].role) ? 0 : 1;
-						if (games[game_id].current_turn != player_index)
-						{
-							write_msg(client_fd, "INVL|14|Not your turn|");
-						}
-						else
-						{
-						 	// TODO: process and update the game state based on the move
-							// send updated game state back to both clients
-							int row = pos[0] - '1';
-							int col = pos[2] - '1';
-							int index = row *3 + col;
-							if (games[game_id].board[index] == '.')
-							{
-								games[game_id].board[index] = player.role;
-
-								// Check for win condition
-								if (check_win(games[game_id].board))
-								{
-								 	// Announce winner
-                                    if(strcmp(player.name, games[game_id].players[0].name) == 0)
-                                    {
-                                        sprintf(buf, "OVER|%ld|L|%s won|\n%s", 7+strlen(games[game_id].players[0].name), games[game_id].players[0].name, games[game_id].board);
-                                        write_msg(games[game_id].players[1].sock_fd, buf);
-                                        sprintf(buf, "OVER|%ld|W|%s won|\n%s", 7+strlen(games[game_id].players[0].name), games[game_id].players[0].name, games[game_id].board);
-                                        write_msg(games[game_id].players[0].sock_fd, buf);
-                                        break;
-                                    }
-                                    else if(strcmp(player.name, games[game_id].players[1].name) == 0)
-                                    {
-										//send final board
-                                        sprintf(buf, "OVER|%ld|W|%s won|\n%s", 7+strlen(games[game_id].players[1].name), games[game_id].players[1].name,  games[game_id].board);
-                                        write_msg(games[game_id].players[1].sock_fd, buf);
-                                        sprintf(buf, "OVER|%ld|L|%s won|\n%s", 7+strlen(games[game_id].players[1].name), games[game_id].players[1].name,  games[game_id].board);
-                                        write_msg(games[game_id].players[0].sock_fd, buf);
-                                        break;
-                                    }
-								}
-								else if (check_draw(games[game_id].board))
-								{
-								 	// Announce draw
-									sprintf(buf, "OVER|27|D|Game has ended in a draw|");
-									write_msg(games[game_id].players[0].sock_fd, buf);
-									write_msg(games[game_id].players[1].sock_fd, buf);
-									break;
-								}
-
-								if (games[game_id].current_turn == player_index)
-								{
-									sprintf(buf, "MOVD|%ld|%c|%s|%s|", 4+strlen(pos)+strlen(games[game_id].board), role, pos, games[game_id].board);
-									write_msg(games[game_id].players[0].sock_fd, buf);
-									write_msg(games[game_id].players[1].sock_fd, buf);
-								}
-
-								// Update current turn
-								games[game_id].current_turn = 1 - games[game_id].current_turn;
-							}
-							else
-							{
-							 	// Invalid move (cell already occupied) - inform player
-								write_msg(client_fd, "INVL|22|Cell already occupied|");
-							}
-
-							// Send updated game state to both players
-
-						}
-					}
-				}
-				else{
-					write_msg(client_fd, "INVL|21|Improperly formatted|");
-				}
-			}
-            else if (strcmp(cmd, "DRAW") == 0)
-            {
-				char response;
-				if(sscanf(msg, "%c", &response)==1)
-				{
-					// Send other client draw request or process the draw response
-					int player_index = (player.role == games[game_id].players[0].role) ? 0 : 1;
-					int other_player_index = 1 - player_index;
-					if(length!=2){
-						write_msg(client_fd, "INVL|22|Length does not match|");
-					}
-					else if (response=='S')
-					{
-						// Send draw request to the other player
-						write_msg(games[game_id].players[other_player_index].sock_fd, "DRAW|2|S|");
-					}
-					else if (response=='A')
-					{
-						// The current player accepted the draw request, inform both players
-						sprintf(buf, "OVER|27|D|Game has ended in a draw|");
-						write_msg(games[game_id].players[0].sock_fd, buf);
-						write_msg(games[game_id].players[1].sock_fd, buf);
-					}
-					else if (response=='R')
-					{
-						// The current player declined the draw request, inform the other player
-						write_msg(games[game_id].players[other_player_index].sock_fd, "DRAW|2|R|");
-					}
-					else{
-						write_msg(client_fd, "INVL|18|Improper response|");
-					}
-				}
-				else{
-					write_msg(client_fd, "INVL|21|Improperly formatted|");
-				}
-            }
-        }
-		else if (sscanf(buf, "%4s|%ld", cmd, &length) == 2){
-			if (strcmp(cmd, "RSGN") == 0)
-            {
-				if(length!=0) write_msg(client_fd, "INVL|22|Length does not match|");
-				else if(strcmp(player.name, games[game_id].players[1].name) == 0)
-				{
-					sprintf(buf, "OVER|%ld|W|%s won %s resigned|", 17+strlen(games[game_id].players[0].name)+strlen(games[game_id].players[1].name), games[game_id].players[0].name, games[game_id].players[1].name);
-					write_msg(games[game_id].players[0].sock_fd, buf);
-					sprintf(buf, "OVER|%ld|L|%s won %s resigned|", 17+strlen(games[game_id].players[0].name)+strlen(games[game_id].players[1].name), games[game_id].players[0].name, games[game_id].players[1].name);
-					write_msg(games[game_id].players[1].sock_fd, buf);
-					break;
-				}
-				else if(strcmp(player.name, games[game_id].players[0].name) == 0)
-				{
-					sprintf(buf, "OVER|%ld|L|%s won %s resigned|", 17+strlen(games[game_id].players[1].name)+strlen(games[game_id].players[0].name), games[game_id].players[1].name, games[game_id].players[0].name);
-					write_msg(games[game_id].players[0].sock_fd, buf);
-					sprintf(buf, "OVER|%ld|W|%s won %s resigned|", 17+strlen(games[game_id].players[1].name)+strlen(games[game_id].players[0].name), games[game_id].players[1].name, games[game_id].players[0].name);
-					write_msg(games[game_id].players[1].sock_fd, buf);
-					break;
-				}
-				close(client_fd);
-				return NULL;
-			}
-		}
-		else
+		if (codec_decode(FRAME_PIPE, buf, len, &msg) < 0 || parse_request(&msg, 3, 3, player.role, &req) == 0 || req.op == OP_HOUS)
 		{
-			printf("INVL|16|Invalid command|\n");
+			send_invl(client_fd, "Invalid command");
 		}
-		pthread_mutex_unlock(&games[game_id].lock);
-	}
-
-	// player disconnected
-	if (game_id != -1)
-	{
-		// inform the other player that the game has ended
-		char buf[2500];	// increase buffer size
-		if (client_fd == games[game_id].players[0].sock_fd && games[game_id].players[1].sock_fd != -1)
+		else if (req.error != NULL)
 		{
-			snprintf(buf, sizeof(buf), "\nPlayer %s disconnected.", games[game_id].players[0].name);
-			write_msg(games[game_id].players[1].sock_fd, buf);
+			send_invl(client_fd, req.error);
 		}
-		else if (client_fd == games[game_id].players[1].sock_fd && games[game_id].players[0].sock_fd != -1)
+		else if (req.op == OP_MOVE)
 		{
-			snprintf(buf, sizeof(buf), "\nPlayer %s disconnected.", games[game_id].players[1].name);
-			write_msg(games[game_id].players[0].sock_fd, buf);
-		}
-
-		if (client_fd == games[game_id].players[0].sock_fd)
-		{
-			if (games[game_id].status == 0)
+			// Check if it's the current player's turn
+			int player_index = (player.role == games[game_id].players[0].role) ? 0 : 1;
+			if (games[game_id].current_turn != player_index)
+			{
+				send_invl(client_fd, "Not your turn");
+			}
+			else if (games[game_id].board[req.cell] == '.')
 			{
-			 	// player 0 disconnected before game started
-				pthread_mutex_lock(&game_lock);
-				for (int i = 0; i < num_games; i++)
+				games[game_id].board[req.cell] = player.role;
+
+				// Check for win condition
+				if (check_win(games[game_id].board))
 				{
-					if (i == game_id)
-					{
-						continue;
-					}
-
-					if (games[i].status == 0 && games[i].players[0].sock_fd == -1)
-					{
-					 			// take over empty slot in other game
-						games[i].players[0] = games[game_id].players[1];
-						games[i].status = 1;
-						pthread_mutex_unlock(&game_lock);
-						sprintf(buf, "START %s", games[i].players[0].name);
-						write_msg(games[i].players[1].sock_fd, buf);
-						sprintf(buf, "START %s", games[i].players[1].name);
-						write_msg(games[i].players[0].sock_fd, buf);
-						break;
-					}
+					// Announce winner, the final board goes with it
+					snprintf(reason, sizeof(reason), "%s won", player.name);
+					send_over(games[game_id].players[player_index].sock_fd, OUTCOME_WIN, reason, games[game_id].board);
+					send_over(games[game_id].players[1 - player_index].sock_fd, OUTCOME_LOSS, reason, games[game_id].board);
+					over = 1;
 				}
-
-				if (game_id == num_games - 1)
+				else if (check_draw(games[game_id].board))
 				{
-				 		// remove empty game from list
-					num_games--;
+					// Announce draw
+					send_over(games[game_id].players[0].sock_fd, OUTCOME_DRAW, "Game has ended in a draw", NULL);
+					send_over(games[game_id].players[1].sock_fd, OUTCOME_DRAW, "Game has ended in a draw", NULL);
+					over = 1;
 				}
 				else
 				{
-				 		// move last game in list to empty spot
-					games[game_id] = games[num_games - 1];
-					num_games--;
+					// the position goes back out as the player wrote it
+					message_t movd;
+					message_init(&movd, OP_MOVD);
+					message_field(&movd, &req.arg, 1);
+					message_field(&movd, msg.fields[1], msg.lens[1]);
+					message_field(&movd, games[game_id].board, BOARD_SIZE);
+					send_msg(games[game_id].players[0].sock_fd, &movd);
+					send_msg(games[game_id].players[1].sock_fd, &movd);
+
+					// Update current turn
+					games[game_id].current_turn = 1 - games[game_id].current_turn;
 				}
-
-				pthread_mutex_unlock(&game_lock);
 			}
 			else
 			{
-			 	// player 0 disconnected during game
-				games[game_id].players[0].sock_fd = -1;
-				pthread_mutex_unlock(&games[game_id].lock);
+				// Invalid move (cell already occupied) - inform player
+				send_invl(client_fd, "Cell already occupied");
 			}
 		}
-		else if (client_fd == games[game_id].players[1].sock_fd)
+		else if (req.op == OP_DRAW)
 		{
-			// player 1 disconnected
-			if (games[game_id].status == 0)
+			// Send other client draw request or process the draw response
+			int player_index = (player.role == games[game_id].players[0].role) ? 0 : 1;
+			int other_player_index = 1 - player_index;
+			if (req.arg == 'A')
 			{
-			 	// player 1 disconnected before game started
-				pthread_mutex_lock(&game_lock);
-				for (int i = 0; i < num_games; i++)
-				{
-					if (i == game_id)
-					{
-						continue;
-					}
-
-					if (games[i].status == 0 && games[i].players[0].sock_fd == -1)
-					{
-					 	// take over empty slot in other game
-						games[i].players[0] = games[game_id].players[0];
-						games[i].status = 1;
-						pthread_mutex_unlock(&game_lock);
-						sprintf(buf, "START %s", games[i].players[0].name);
-						write_msg(games[i].players[1].sock_fd, buf);
-						sprintf(buf, "START %s", games[i].players[1].name);
-						write_msg(games[i].players[0].sock_fd, buf);
-						break;
-					}
-				}
-
-				if (game_id == num_games - 1)
-				{
-				 	// remove empty game from list
-					num_games--;
-				}
-				else{
-				 	//move last game in list to empty spot
-					games[game_id] = games[num_games - 1];
-					num_games--;
-				}
-
-				pthread_mutex_unlock(&game_lock);
+				// The current player accepted the draw request, inform both players
+				send_over(games[game_id].players[0].sock_fd, OUTCOME_DRAW, "Game has ended in a draw", NULL);
+				send_over(games[game_id].players[1].sock_fd, OUTCOME_DRAW, "Game has ended in a draw", NULL);
+				over = 1;
 			}
-			else{
-			 	// player 1 disconnected during game
-				games[game_id].players[1].sock_fd = -1;
-				pthread_mutex_unlock(&games[game_id].lock);
+			else
+			{
+				// pass the request, or its rejection, on to the other player
+				send_draw(games[game_id].players[other_player_index].sock_fd, (req.arg == 'S') ? "S" : "R");
 			}
 		}
-
-		close(client_fd);
+		else if (req.op == OP_RSGN)
+		{
+			int player_index = (player.role == games[game_id].players[0].role) ? 0 : 1;
+			snprintf(reason, sizeof(reason), "%s won %s resigned", games[game_id].players[1 - player_index].name, player.name);
+			send_over(games[game_id].players[1 - player_index].sock_fd, OUTCOME_WIN, reason, NULL);
+			send_over(client_fd, OUTCOME_LOSS, reason, NULL);
+			over = 1;
+		}
+		if (over)
+		{
+			games[game_id].finished = 1;
+		}
+		pthread_mutex_unlock(&games[game_id].lock);
 	}
 
-	// cleanup thread resources
-	free(buf);
-	pthread_join(pthread_self(), NULL);
+	// player disconnected or game finished: the slot is only freed once
+	// both players left it, so the opponent's game_id stays valid
+	pthread_mutex_lock(&game_lock);
+	pthread_mutex_lock(&games[game_id].lock);
+	int player_index = (player.role == games[game_id].players[0].role) ? 0 : 1;
+	if (games[game_id].status == GAME_PLAYING && !games[game_id].finished && games[game_id].players[1 - player_index].sock_fd != -1)
+	{
+		// the game was still on, inform the other player that it has ended
+		message_init(&msg, OP_GONE);
+		message_string(&msg, player.name);
+		send_msg(games[game_id].players[1 - player_index].sock_fd, &msg);
+	}
+	games[game_id].players[player_index].sock_fd = -1;
+	if (--games[game_id].seated == 0)
+	{
+		if (waiting_game == game_id)
+		{
+			waiting_game = -1;
+		}
+		games[game_id].status = GAME_FREE;
+		games[game_id].next_free = free_head;
+		free_head = game_id;
+	}
+	pthread_mutex_unlock(&games[game_id].lock);
+	pthread_mutex_unlock(&game_lock);
 
+	release_name(player.name);
+	close(client_fd);
 	return NULL;
 }
 
@@ -441,6 +383,16 @@ int main(){
 	int addrlen = sizeof(address);
 	pthread_t client_thread;
 
+	// a peer closing mid-write must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+	for (int i = MAX_GAMES - 1; i >= 0; i--)
+	{
+		games[i].status = GAME_FREE;
+		games[i].next_free = free_head;
+		free_head = i;
+		pthread_mutex_init(&games[i].lock, NULL);
+	}
+
 	// create server socket
 	server_fd = socket(AF_INET, SOCK_STREAM, 0);
 	if (server_fd < 0){
@@ -467,7 +419,7 @@ int main(){
 	}
 
 	// start listening for connections
-	if (listen(server_fd, MAX_CLIENTS) < 0){
+	if (listen(server_fd, SOMAXCONN) < 0){
 		perror("listen");
 		exit(1);
 	}
@@ -489,11 +441,7 @@ int main(){
 			exit(1);
 		}
 
-		if (pthread_mutex_init(&player_name_lock, NULL) != 0) {
-			perror("pthread_mutex_init");
-			exit(1);
-		}
-
+		// detached, so its resources go back when handle_client returns
 		pthread_detach(client_thread);
 	}
 
@@ -0,0 +1,476 @@
+#include "protocol.h"
+#include "codec.h"
+#include "board.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_RESULTS 64
+#define REPEATS 15          // a micro benchmark keeps its best run
+
+typedef struct
+{
+	char name[40];
+	double value;
+	char unit[12];          // "games/s" is better higher, everything else lower
+}
+result_t;
+
+static result_t results[MAX_RESULTS];
+static int num_results;
+
+// positions the win and draw checks see: open, won and full boards
+static const char *boards[] = {
+	".........",
+	"X...O....",
+	"XX.OO...X",
+	"XXXOO....",
+	"XOXOXOOXO",
+	"O.X.O.X.O",
+	"XOXXOOOXX",
+	"OX.OX.O..",
+};
+
+static char positions[][4] = { "1,1", "2,2", "3,3", "1,3", "3,1", "2,1", "4,1", "0,2" };
+
+static const char *lines[] = {
+	"MOVE X 2,2",
+	"MOVE O 1,3",
+	"MOVE X 3,1",
+	"MOVE O 2,1",
+	"MOVE X 1,1",
+	"MOVE O 4,1",
+	"DRAW S",
+	"RSGN",
+};
+
+static const char *pipe_lines[] = {
+	"MOVE|6|X|2,2|",
+	"MOVE|6|O|1,3|",
+	"MOVE|6|X|3,1|",
+	"MOVE|6|O|2,1|",
+	"MOVE|6|X|1,1|",
+	"MOVE|6|O|4,1|",
+	"DRAW|2|S|",
+	"RSGN|0|",
+};
+
+static void add_result(const char *name, double value, const char *unit)
+{
+	if (num_results < MAX_RESULTS)
+	{
+		snprintf(results[num_results].name, sizeof(results[0].name), "%s", name);
+		snprintf(results[num_results].unit, sizeof(results[0].unit), "%s", unit);
+		results[num_results++].value = value;
+	}
+}
+
+static long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static long bench_check_win(long n)
+{
+	long sum = 0;
+	for (long i = 0; i < n; i++)
+	{
+		sum += check_win(boards[i & 7]);
+	}
+	return sum;
+}
+
+static long bench_check_draw(long n)
+{
+	long sum = 0;
+	for (long i = 0; i < n; i++)
+	{
+		sum += check_draw(boards[i & 7]);
+	}
+	return sum;
+}
+
+static long bench_validate_move(long n)
+{
+	long sum = 0;
+	for (long i = 0; i < n; i++)
+	{
+		sum += validate_move(positions[i & 7]);
+	}
+	return sum;
+}
+
+static long bench_parse_index(long n)
+{
+	long sum = 0;
+	for (long i = 0; i < n; i++)
+	{
+		sum += parse_index(positions[i & 7]);
+	}
+	return sum;
+}
+
+// the check the server runs, one drawn 3x3 game after another
+static long bench_board_play(long n)
+{
+	static const int moves[] = { 4, 0, 2, 6, 3, 5, 1, 7, 8 };
+	board_t board;
+	long sum = 0;
+
+	for (long i = 0; i < n; i++)
+	{
+		if (i % 9 == 0)
+		{
+			board_init(&board);
+		}
+		sum += board_play(&board, i & 1, moves[i % 9]);
+	}
+	return sum;
+}
+
+static long parse(int framing, const char **msgs, long n)
+{
+	message_t msg;
+	request_t req;
+	long sum = 0;
+
+	for (long i = 0; i < n; i++)
+	{
+		const char *line = msgs[i & 7];
+		if (codec_decode(framing, line, strlen(line), &msg) >= 0)
+		{
+			sum += parse_request(&msg, 3, 3, 'X', &req) + req.cell;
+		}
+	}
+	return sum;
+}
+
+static long bench_parse_line(long n)
+{
+	return parse(FRAME_LINE, lines, n);
+}
+
+static long bench_parse_pipe(long n)
+{
+	return parse(FRAME_PIPE, pipe_lines, n);
+}
+
+// a MOVD, the message the server sends most
+static long format(int framing, long n)
+{
+	char payload[3 + 9] = { 'X', 4, 0 };
+	char buf[MAX_MSG_LEN];
+	message_t msg;
+	long sum = 0;
+
+	for (long i = 0; i < n; i++)
+	{
+		const char *board = boards[i & 7];
+		memcpy(payload + 3, board, 9);
+		message_init(&msg, OP_MOVD);
+		message_field(&msg, "X", 1);
+		message_field(&msg, positions[i & 7], 3);
+		message_field(&msg, board, 9);
+		message_payload(&msg, payload, sizeof(payload));
+		sum += codec_encode(framing, &msg, buf, sizeof(buf));
+	}
+	return sum;
+}
+
+static long bench_format_line(long n)
+{
+	return format(FRAME_LINE, n);
+}
+
+static long bench_format_pipe(long n)
+{
+	return format(FRAME_PIPE, n);
+}
+
+static long bench_format_binary(long n)
+{
+	return format(FRAME_BINARY, n);
+}
+
+static const struct
+{
+	const char *name;
+	long (*run)(long n);
+}
+micros[] = {
+	{ "check_win", bench_check_win },
+	{ "check_draw", bench_check_draw },
+	{ "validate_move", bench_validate_move },
+	{ "parse_index", bench_parse_index },
+	{ "board_play", bench_board_play },
+	{ "parse_line", bench_parse_line },
+	{ "parse_pipe", bench_parse_pipe },
+	{ "format_line", bench_format_line },
+	{ "format_pipe", bench_format_pipe },
+	{ "format_binary", bench_format_binary },
+};
+
+// ns per call, the best of a few runs so a busy machine disturbs it less;
+// the checksum keeps the compiler from dropping the work
+static void run_micros(long n)
+{
+	long sum = 0;
+
+	for (unsigned int m = 0; m < sizeof(micros) / sizeof(micros[0]); m++)
+	{
+		double best = 0;
+		for (int r = 0; r < REPEATS; r++)
+		{
+			long start = now_ns();
+			sum += micros[m].run(n);
+			double ns = (double) (now_ns() - start) / n;
+			if (r == 0 || ns < best)
+			{
+				best = ns;
+			}
+		}
+		add_result(micros[m].name, best, "ns");
+	}
+	fprintf(stderr, "micro benchmarks done (checksum %ld)\n", sum);
+}
+
+// a port nothing listens on right now
+static int free_port()
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || getsockname(fd, (struct sockaddr *) &addr, &len) < 0)
+	{
+		perror("free_port");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	return ntohs(addr.sin_port);
+}
+
+// ./server in the background, returns once it takes connections
+static pid_t start_server(const char *mode, int port)
+{
+	char arg[16];
+	struct timespec pause = { 0, 10000000 };
+	pid_t pid;
+
+	snprintf(arg, sizeof(arg), "%d", port);
+	if ((pid = fork()) == 0)
+	{
+		execl("./server", "server", "-m", mode, "-p", arg, "-l", "off", (char *) NULL);
+		perror("./server");
+		_exit(127);
+	}
+	for (int tries = 0; pid > 0 && tries < 500; tries++)
+	{
+		struct sockaddr_in addr;
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		int ok = connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+		close(fd);
+		if (ok)
+		{
+			return pid;
+		}
+		nanosleep(&pause, NULL);
+	}
+	fprintf(stderr, "server did not come up on port %d\n", port);
+	exit(EXIT_FAILURE);
+}
+
+// games/s and move round trips of loadgen against a real server over
+// loopback, one server mode and protocol at a time
+static void run_loopback(const char *mode, const char *protocol, int bots, int games)
+{
+	int port = free_port();
+	pid_t server = start_server(mode, port);
+	char cmd[128];
+	char line[256];
+	char name[40];
+	double games_per_s = -1;
+	long moves = 0, p50 = 0, p99 = 0;
+
+	snprintf(cmd, sizeof(cmd), "./loadgen -p %d -n %d -g %d -P %s", port, bots, games, protocol);
+	FILE *out = popen(cmd, "r");
+	if (out == NULL)
+	{
+		perror("loadgen");
+		exit(EXIT_FAILURE);
+	}
+	while (fgets(line, sizeof(line), out) != NULL)
+	{
+		if (sscanf(line, "protocol %*s %*d bots, %*d games in %*f s: %lf games/s", &games_per_s) != 1)
+		{
+			sscanf(line, "move n=%ld p50=%ld us p99=%ld us", &moves, &p50, &p99);
+		}
+	}
+	int status = pclose(out);
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+	if (status != 0 || games_per_s < 0 || moves == 0)
+	{
+		fprintf(stderr, "%s %s: loadgen failed\n", mode, protocol);
+		exit(EXIT_FAILURE);
+	}
+
+	snprintf(name, sizeof(name), "%s_%s_games", mode, protocol);
+	add_result(name, games_per_s, "games/s");
+	snprintf(name, sizeof(name), "%s_%s_move_p50", mode, protocol);
+	add_result(name, p50, "us");
+	snprintf(name, sizeof(name), "%s_%s_move_p99", mode, protocol);
+	add_result(name, p99, "us");
+	fprintf(stderr, "loopback %s %s done (%ld moves)\n", mode, protocol, moves);
+}
+
+// games/s of the deterministic simulation, the server's session path on one
+// thread with no kernel in between; every seed must pass
+static void run_sim(int seeds)
+{
+	char cmd[64];
+	char line[256];
+	int failed = -1;
+	double games_per_s = -1;
+
+	snprintf(cmd, sizeof(cmd), "./sim -n %d", seeds);
+	FILE *out = popen(cmd, "r");
+	if (out == NULL)
+	{
+		perror("sim");
+		exit(EXIT_FAILURE);
+	}
+	while (fgets(line, sizeof(line), out) != NULL)
+	{
+		sscanf(line, "%*d seeds, %d failed, %*d games, %*d events in %*fs: %lf games/s", &failed, &games_per_s);
+	}
+	int status = pclose(out);
+	if (status != 0 || failed != 0 || games_per_s < 0)
+	{
+		fprintf(stderr, "sim: %d seeds failed\n", failed);
+		exit(EXIT_FAILURE);
+	}
+
+	add_result("sim_games", games_per_s, "games/s");
+	fprintf(stderr, "sim done (%d seeds)\n", seeds);
+}
+
+// one "name value unit" line per result
+static void write_results(const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (f == NULL)
+	{
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < num_results; i++)
+	{
+		fprintf(f, "%s %.2f %s\n", results[i].name, results[i].value, results[i].unit);
+	}
+	fclose(f);
+}
+
+// print every result next to its baseline, returns how many got worse by
+// more than threshold percent; a p99 is printed but never judged, on a
+// shared machine it swings further than any useful threshold
+static int compare(const char *path, double threshold)
+{
+	result_t base[MAX_RESULTS];
+	int num_base = 0;
+	int regressions = 0;
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL)
+	{
+		fprintf(stderr, "no baseline in %s, make bench-baseline records one\n", path);
+		return 0;
+	}
+	while (num_base < MAX_RESULTS && fscanf(f, "%39s %lf %11s", base[num_base].name, &base[num_base].value, base[num_base].unit) == 3)
+	{
+		num_base++;
+	}
+	fclose(f);
+
+	printf("%-28s %12s %12s %9s\n", "benchmark", "result", "baseline", "change");
+	for (int i = 0; i < num_results; i++)
+	{
+		const result_t *r = &results[i];
+		const result_t *b = NULL;
+		for (int j = 0; j < num_base && b == NULL; j++)
+		{
+			b = (strcmp(base[j].name, r->name) == 0) ? &base[j] : NULL;
+		}
+		if (b == NULL || b->value <= 0)
+		{
+			printf("%-28s %12.2f %12s %9s  %s\n", r->name, r->value, "-", "-", r->unit);
+			continue;
+		}
+
+		double change = (r->value - b->value) * 100 / b->value;
+		int higher_better = strcmp(r->unit, "games/s") == 0;
+		int tail = strstr(r->name, "_p99") != NULL;
+		int worse = !tail && (higher_better ? change < -threshold : change > threshold);
+		regressions += worse;
+		printf("%-28s %12.2f %12.2f %+8.1f%%  %s%s\n", r->name, r->value, b->value, change, r->unit, worse ? "  REGRESSION" : "");
+	}
+	return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output = "bench.txt";
+	const char *baseline = NULL;
+	double threshold = 20;
+	long n = 1000000;
+	int games = 4000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:b:t:n:g:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'o': output = optarg; break;
+		case 'b': baseline = optarg; break;
+		case 't': threshold = atof(optarg); break;
+		case 'n': n = atol(optarg); break;
+		case 'g': games = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-o results] [-b baseline] [-t percent] [-n calls] [-g games]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	run_micros(n);
+	run_loopback("epoll", "text", 100, games);
+	run_loopback("epoll", "pipe", 100, games);
+	run_loopback("epoll", "binary", 100, games);
+	run_loopback("thread", "text", 100, games / 4);
+	run_sim(50);
+	write_results(output);
+
+	int regressions = (baseline != NULL) ? compare(baseline, threshold) : 0;
+	if (regressions > 0)
+	{
+		printf("%d regression%s beyond %.0f%%\n", regressions, regressions == 1 ? "" : "s", threshold);
+		return 1;
+	}
+	return 0;
+}
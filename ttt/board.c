@@ -0,0 +1,201 @@
+#include "board.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef struct {
+    int width;
+    int height;
+    int k;
+    int cells;
+    int (*wins)(const board_t *board, int side, int cell);
+} shape_t;
+
+// rows, columns and diagonals passing through each cell of a 3x3 board, 0 terminated
+static const unsigned short lines_through[9][5] = {
+    {0x007, 0x049, 0x111, 0},           // 0: row 0, col 0, diagonal
+    {0x007, 0x092, 0},                  // 1: row 0, col 1
+    {0x007, 0x124, 0x054, 0},           // 2: row 0, col 2, anti-diagonal
+    {0x038, 0x049, 0},                  // 3: row 1, col 0
+    {0x038, 0x092, 0x111, 0x054, 0},    // 4: row 1, col 1, both diagonals
+    {0x038, 0x124, 0},                  // 5: row 1, col 2
+    {0x1C0, 0x049, 0x054, 0},           // 6: row 2, col 0, anti-diagonal
+    {0x1C0, 0x092, 0},                  // 7: row 2, col 1
+    {0x1C0, 0x124, 0x111, 0},           // 8: row 2, col 2, diagonal
+};
+
+// per row multipliers that move the bit a line crosses in that row up to
+// bit 15, or drop the row when the line misses it: one set per column, per
+// column - row (diagonals) and per column + row (anti-diagonals)
+static unsigned short column_mul[16][16];
+static unsigned short diagonal_mul[31][16];
+static unsigned short anti_mul[31][16];
+
+// the bits of one line, a bit per row, bit i set when row i holds its cell
+static inline unsigned int gather(const unsigned short *rows, const unsigned short *mul, int height) {
+#ifdef __SSE2__
+    if (height > 4) {
+        // all 16 rows at once: multiply, smear bit 15 over the lane, pack
+        // the lanes to bytes and take one bit per byte
+        __m128i lo = _mm_loadu_si128((const __m128i *)rows);
+        __m128i hi = _mm_loadu_si128((const __m128i *)(rows + 8));
+        lo = _mm_srai_epi16(_mm_mullo_epi16(lo, _mm_loadu_si128((const __m128i *)mul)), 15);
+        hi = _mm_srai_epi16(_mm_mullo_epi16(hi, _mm_loadu_si128((const __m128i *)(mul + 8))), 15);
+        return _mm_movemask_epi8(_mm_packs_epi16(lo, hi));
+    }
+#endif
+    unsigned int line = 0;
+    for (int i = 0; i < height; i++) {
+        line |= (unsigned int)((unsigned short)(rows[i] * mul[i]) >> 15) << i;
+    }
+    return line;
+}
+
+// whether the line holds k set bits in a row
+static inline int runs(unsigned int line, int k) {
+    for (int n = 1; n < k; n++) {
+        line &= line >> 1;
+    }
+    return line != 0;
+}
+
+// the row, column and both diagonals through the cell just played; nobody
+// had won before, so any run of k on them includes that cell
+static inline __attribute__((always_inline)) int line_wins(const unsigned short *rows, int row, int col, int height, int k) {
+    return runs(rows[row], k)
+        || runs(gather(rows, column_mul[col], height), k)
+        || runs(gather(rows, diagonal_mul[col - row + 15], height), k)
+        || runs(gather(rows, anti_mul[col + row], height), k);
+}
+
+// a copy of the win check per common shape, with the width, height and k
+// known at compile time so every loop above unrolls
+#define BOARD_SHAPE(W, H, K) \
+    static int wins_##W##x##H##x##K(const board_t *board, int side, int cell) { \
+        return line_wins(board->rows[side], cell / (W), cell % (W), (H), (K)); \
+    }
+
+BOARD_SHAPE(4, 4, 4)
+BOARD_SHAPE(15, 15, 5)
+
+// 3x3 packs into one 9 bit mask and checks the few precomputed lines
+static int wins_3x3x3(const board_t *board, int side, int cell) {
+    const unsigned short *rows = board->rows[side];
+    unsigned short mask = rows[0] | rows[1] << 3 | rows[2] << 6;
+    for (const unsigned short *line = lines_through[cell]; *line; line++) {
+        if ((mask & *line) == *line) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static shape_t shape = { 3, 3, 3, 9, wins_3x3x3 };
+
+static int wins_generic(const board_t *board, int side, int cell) {
+    return line_wins(board->rows[side], cell / shape.width, cell % shape.width, shape.height, shape.k);
+}
+
+static const shape_t specialized[] = {
+    { 3, 3, 3, 9, wins_3x3x3 },
+    { 4, 4, 4, 16, wins_4x4x4 },
+    { 15, 15, 5, 225, wins_15x15x5 },
+};
+
+static unsigned short lane_mul(int col) {
+    return (col >= 0 && col < 16) ? (unsigned short)(1 << (15 - col)) : 0;
+}
+
+// pick the shape before any game starts, -1 when it is not supported
+int board_configure(int width, int height, int k) {
+    if (width < 3 || height < 3 || width > BOARD_MAX_SIDE || height > BOARD_MAX_SIDE || k < 3 || (k > width && k > height)) {
+        return -1;
+    }
+
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 16; c++) {
+            column_mul[c][i] = lane_mul(c);
+        }
+        for (int d = 0; d < 31; d++) {
+            diagonal_mul[d][i] = lane_mul(d - 15 + i);
+            anti_mul[d][i] = lane_mul(d - i);
+        }
+    }
+
+    shape.width = width;
+    shape.height = height;
+    shape.k = k;
+    shape.cells = width * height;
+    shape.wins = wins_generic;
+    for (unsigned int i = 0; i < sizeof(specialized) / sizeof(specialized[0]); i++) {
+        if (specialized[i].width == width && specialized[i].height == height && specialized[i].k == k) {
+            shape.wins = specialized[i].wins;
+        }
+    }
+    return 0;
+}
+
+int board_width() {
+    return shape.width;
+}
+
+int board_height() {
+    return shape.height;
+}
+
+int board_k() {
+    return shape.k;
+}
+
+int board_cells() {
+    return shape.cells;
+}
+
+void board_init(board_t *board) {
+    memset(board, 0, sizeof(*board));
+}
+
+int board_empty(const board_t *board, int cell) {
+    int row = cell / shape.width;
+    int col = cell % shape.width;
+    return !((board->rows[0][row] | board->rows[1][row]) & (1 << col));
+}
+
+int board_wins(const board_t *board, int side, int cell) {
+    return shape.wins(board, side, cell);
+}
+
+int board_full(const board_t *board) {
+    return board->filled == shape.cells;
+}
+
+// place the side's mark on an empty cell and report how the game stands
+int board_play(board_t *board, int side, int cell) {
+    board->rows[side][cell / shape.width] |= 1 << (cell % shape.width);
+    board->filled++;
+    if (shape.wins(board, side, cell)) {
+        return BOARD_WIN;
+    }
+    return board_full(board) ? BOARD_DRAW : BOARD_CONTINUE;
+}
+
+// the side's cells as one mask, bit i for cell i, on boards of up to 32 cells
+unsigned int board_mask(const board_t *board, int side) {
+    unsigned int mask = 0;
+    for (int row = 0; row < shape.height; row++) {
+        mask |= (unsigned int)board->rows[side][row] << (row * shape.width);
+    }
+    return mask;
+}
+
+// render the board as the grid used on the wire, one character per cell,
+// out needs board_cells() + 1 bytes
+void board_string(const board_t *board, char *out) {
+    for (int i = 0; i < shape.cells; i++) {
+        unsigned short bit = 1 << (i % shape.width);
+        int row = i / shape.width;
+        out[i] = (board->rows[0][row] & bit) ? 'X' : (board->rows[1][row] & bit) ? 'O' : '.';
+    }
+    out[shape.cells] = '\0';
+}
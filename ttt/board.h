@@ -0,0 +1,37 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+// largest board, its grid still fits one binary MOVD frame
+#define BOARD_MAX_SIDE 15
+#define BOARD_MAX_CELLS (BOARD_MAX_SIDE * BOARD_MAX_SIDE)
+
+// result of a move
+#define BOARD_CONTINUE 0
+#define BOARD_WIN 1
+#define BOARD_DRAW 2
+
+// bit c of rows[side][r] is set when that side holds row r, column c;
+// cells are numbered row * width + column, rows are padded to 16 so a
+// side loads as two vectors of eight
+typedef struct {
+    unsigned short rows[2][16];
+    short filled;
+} board_t;
+
+// the shape every game is played on, width x height with k in a row
+// winning; set once at startup, 3x3 with 3 in a row by default
+int board_configure(int width, int height, int k);
+int board_width();
+int board_height();
+int board_k();
+int board_cells();
+
+void board_init(board_t *board);
+int board_empty(const board_t *board, int cell);
+int board_play(board_t *board, int side, int cell);
+int board_wins(const board_t *board, int side, int cell);
+int board_full(const board_t *board);
+unsigned int board_mask(const board_t *board, int side);
+void board_string(const board_t *board, char *out);
+
+#endif // BOARD_H
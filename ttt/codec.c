@@ -0,0 +1,351 @@
+#include "codec.h"
+#include <string.h>
+
+// the four letters each opcode goes by in the line and pipe framings
+static const char *const types[] = {
+	[OP_MOVE] = "MOVE",
+	[OP_DRAW] = "DRAW",
+	[OP_RSGN] = "RSGN",
+	[OP_HOUS] = "HOUS",
+	[OP_WAIT] = "WAIT",
+	[OP_BEGN] = "BEGN",
+	[OP_MOVD] = "MOVD",
+	[OP_INVL] = "INVL",
+	[OP_DRAW_OFFER] = "DRAW",
+	[OP_OVER] = "OVER",
+	[OP_GONE] = "GONE",
+	[OP_GAME] = "GAME",
+	[OP_TOKN] = "TOKN",
+	[OP_SNAP] = "SNAP",
+};
+
+void message_init(message_t *msg, int op)
+{
+	msg->op = op;
+	msg->type = types[op];
+	msg->num_fields = 0;
+	msg->payload = NULL;
+	msg->payload_len = 0;
+}
+
+void message_field(message_t *msg, const char *field, int len)
+{
+	msg->fields[msg->num_fields] = field;
+	msg->lens[msg->num_fields++] = len;
+}
+
+void message_string(message_t *msg, const char *field)
+{
+	message_field(msg, field, strlen(field));
+}
+
+void message_payload(message_t *msg, const char *payload, int len)
+{
+	msg->payload = payload;
+	msg->payload_len = len;
+}
+
+// append len bytes at pos, the new end or -1 once the buffer is full
+static int put(char *buf, int pos, int size, const char *data, int len)
+{
+	if (pos < 0 || pos + len > size)
+	{
+		return -1;
+	}
+	memcpy(buf + pos, data, len);
+	return pos + len;
+}
+
+static int put_number(char *buf, int pos, int size, int value)
+{
+	char digits[12];
+	int n = sizeof(digits);
+
+	do
+	{
+		digits[--n] = '0' + value % 10;
+		value /= 10;
+	}
+	while (value != 0);
+	return put(buf, pos, size, digits + n, sizeof(digits) - n);
+}
+
+// "TYPE field field\n"; a GONE keeps the sentence text clients always got
+static int encode_line(const message_t *msg, char *buf, int size)
+{
+	int pos = 0;
+
+	if (msg->op == OP_GONE)
+	{
+		pos = put(buf, pos, size, "Player ", 7);
+		pos = put(buf, pos, size, msg->fields[0], msg->lens[0]);
+		return put(buf, pos, size, " disconnected.\n", 15);
+	}
+	pos = put(buf, pos, size, msg->type, 4);
+	for (int i = 0; i < msg->num_fields; i++)
+	{
+		pos = put(buf, pos, size, " ", 1);
+		pos = put(buf, pos, size, msg->fields[i], msg->lens[i]);
+	}
+	return put(buf, pos, size, "\n", 1);
+}
+
+// "TYPE|len|field|field|", where len counts every byte after its own '|'
+static int encode_pipe(const message_t *msg, char *buf, int size)
+{
+	int len = msg->num_fields;
+	int pos = 0;
+
+	for (int i = 0; i < msg->num_fields; i++)
+	{
+		len += msg->lens[i];
+	}
+	pos = put(buf, pos, size, msg->type, 4);
+	pos = put(buf, pos, size, "|", 1);
+	pos = put_number(buf, pos, size, len);
+	pos = put(buf, pos, size, "|", 1);
+	for (int i = 0; i < msg->num_fields; i++)
+	{
+		pos = put(buf, pos, size, msg->fields[i], msg->lens[i]);
+		pos = put(buf, pos, size, "|", 1);
+	}
+	return pos;
+}
+
+// write the message into buf the way the framing wants it, returns its
+// length or -1 when it does not fit
+int codec_encode(int framing, const message_t *msg, char *buf, int size)
+{
+	if (framing == FRAME_BINARY)
+	{
+		int len = (msg->payload_len < BIN_MAX_PAYLOAD) ? msg->payload_len : BIN_MAX_PAYLOAD;
+		return (BIN_HEADER + len <= size) ? bin_frame(buf, msg->op, msg->payload, len) : -1;
+	}
+	return (framing == FRAME_PIPE) ? encode_pipe(msg, buf, size) : encode_line(msg, buf, size);
+}
+
+static int is_blank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+// the first word is the type, every further run of non-blanks a field
+static int decode_line(const char *p, const char *end, message_t *msg)
+{
+	while (p < end && is_blank(*p))
+	{
+		p++;
+	}
+	msg->type = p;
+	while (p < end && !is_blank(*p))
+	{
+		p++;
+	}
+	if (p - msg->type != 4)
+	{
+		return -1;
+	}
+	while (1)
+	{
+		while (p < end && is_blank(*p))
+		{
+			p++;
+		}
+		if (p == end)
+		{
+			return msg->num_fields;
+		}
+		if (msg->num_fields == CODEC_MAX_FIELDS)
+		{
+			return -1;
+		}
+		const char *field = p;
+		while (p < end && !is_blank(*p))
+		{
+			p++;
+		}
+		message_field(msg, field, p - field);
+	}
+}
+
+// the length must account for exactly the fields that follow it, each of
+// which ends in '|'
+static int decode_pipe(const char *p, const char *end, message_t *msg)
+{
+	int len = 0;
+
+	if (end - p < 7 || p[4] != '|')
+	{
+		return -1;
+	}
+	msg->type = p;
+	for (p += 5; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+		len = len * 10 + (*p - '0');
+		if (len > CODEC_MAX_FRAME)
+		{
+			return -1;
+		}
+	}
+	if (p == end || *p != '|' || p == msg->type + 5 || end - (p + 1) != len)
+	{
+		return -1;
+	}
+	for (p++; p < end; p++)
+	{
+		const char *bar = memchr(p, '|', end - p);
+		if (bar == NULL || msg->num_fields == CODEC_MAX_FIELDS)
+		{
+			return -1;
+		}
+		message_field(msg, p, bar - p);
+		p = bar;
+	}
+	return msg->num_fields;
+}
+
+// split one framed message, as msgbuf_next() cut it out of the stream, into
+// its parts without copying it; returns the number of fields, -1 when the
+// message is malformed
+int codec_decode(int framing, const char *frame, int len, message_t *msg)
+{
+	msg->op = 0;
+	msg->type = NULL;
+	msg->num_fields = 0;
+	msg->payload = NULL;
+	msg->payload_len = 0;
+	if (framing == FRAME_BINARY)
+	{
+		if (len < BIN_HEADER || (unsigned char) frame[1] != len - BIN_HEADER)
+		{
+			return -1;
+		}
+		msg->op = (unsigned char) frame[0];
+		message_payload(msg, frame + BIN_HEADER, len - BIN_HEADER);
+		return 0;
+	}
+	if (framing == FRAME_PIPE)
+	{
+		return decode_pipe(frame, frame + len, msg);
+	}
+	return decode_line(frame, frame + len, msg);
+}
+
+// the four letters of a request as one word, so a request is told apart by
+// a single compare whatever the byte order
+#define REQUEST_WORD(a, b, c, d) \
+	((unsigned int) (unsigned char) (a) | (unsigned int) (unsigned char) (b) << 8 | \
+	 (unsigned int) (unsigned char) (c) << 16 | (unsigned int) (unsigned char) (d) << 24)
+
+// "MOVE <role> <row>,<col>"
+static void move_args(const message_t *msg, int width, int height, char role, request_t *req)
+{
+	if (msg->num_fields != 2 || msg->lens[0] != 1)
+	{
+		req->error = "Invalid command";
+		return;
+	}
+	req->arg = msg->fields[0][0];
+	req->cell = parse_cell(msg->fields[1], msg->lens[1], width, height);
+	if (req->cell < 0)
+	{
+		req->error = "Cell out of bounds";
+	}
+	else if (req->arg != role)
+	{
+		req->error = "Not your role";
+	}
+}
+
+// "DRAW S", "DRAW A" or "DRAW R"
+static void draw_args(const message_t *msg, int width, int height, char role, request_t *req)
+{
+	(void) width;
+	(void) height;
+	(void) role;
+	req->arg = msg->fields[0][0];
+	if (msg->num_fields != 1 || msg->lens[0] != 1 || (req->arg != 'S' && req->arg != 'A' && req->arg != 'R'))
+	{
+		req->error = "Invalid parameter";
+	}
+}
+
+static const struct
+{
+	unsigned int word;
+	int op;
+	// NULL for requests that take no fields
+	void (*args)(const message_t *msg, int width, int height, char role, request_t *req);
+}
+requests[] = {
+	{ REQUEST_WORD('M', 'O', 'V', 'E'), OP_MOVE, move_args },
+	{ REQUEST_WORD('D', 'R', 'A', 'W'), OP_DRAW, draw_args },
+	{ REQUEST_WORD('R', 'S', 'G', 'N'), OP_RSGN, NULL },
+	{ REQUEST_WORD('H', 'O', 'U', 'S'), OP_HOUS, NULL },
+};
+
+// fixed layout, every field sits at a known offset and the length is the only check
+static int binary_request(const message_t *msg, int width, int height, request_t *req)
+{
+	static const int payload_len[] = { [OP_MOVE] = 2, [OP_DRAW] = 1, [OP_RSGN] = 0, [OP_HOUS] = 0 };
+	const unsigned char *payload = (const unsigned char *) msg->payload;
+
+	req->op = msg->op;
+	if (msg->op < OP_MOVE || msg->op > OP_HOUS || msg->payload_len != payload_len[msg->op])
+	{
+		req->error = "Invalid command";
+	}
+	else if (msg->op == OP_MOVE)
+	{
+		req->cell = payload[0];
+		req->seq = payload[1];
+		if (req->cell >= width * height)
+		{
+			req->error = "Cell out of bounds";
+		}
+	}
+	else if (msg->op == OP_DRAW)
+	{
+		req->arg = payload[0];
+		if (req->arg != 'S' && req->arg != 'A' && req->arg != 'R')
+		{
+			req->error = "Invalid parameter";
+		}
+	}
+	return req->op;
+}
+
+// turn a decoded message from a player into a request for the game, the
+// same for every framing: the type is looked up as one word in a table of
+// requests, and a move's position goes straight to a cell index; a message
+// that is no request at all leaves op at 0, a malformed one sets error,
+// returns the op
+int parse_request(const message_t *msg, int width, int height, char role, request_t *req)
+{
+	memset(req, 0, sizeof(*req));
+	if (msg->type == NULL)
+	{
+		return binary_request(msg, width, height, req);
+	}
+
+	unsigned int word = REQUEST_WORD(msg->type[0], msg->type[1], msg->type[2], msg->type[3]);
+	for (unsigned int i = 0; i < sizeof(requests) / sizeof(requests[0]); i++)
+	{
+		if (requests[i].word != word)
+		{
+			continue;
+		}
+		if ((msg->num_fields == 0) != (requests[i].args == NULL))
+		{
+			// fields missing, or given to a request that takes none
+			return 0;
+		}
+		req->op = requests[i].op;
+		if (requests[i].args != NULL)
+		{
+			requests[i].args(msg, width, height, role, req);
+		}
+		return req->op;
+	}
+	return 0;
+}
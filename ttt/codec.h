@@ -0,0 +1,35 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "protocol.h"
+
+#define CODEC_MAX_FIELDS 8
+#define CODEC_MAX_FRAME MAX_MSG_LEN
+
+// one protocol message in any of the three framings: its four letter type
+// and fields for FRAME_LINE and FRAME_PIPE, its opcode and payload for
+// FRAME_BINARY; nothing is copied, everything points into the caller's
+// memory, so a sender fills in all of it and the encoder picks what the
+// connection speaks
+typedef struct
+{
+	int op;
+	const char *type;           // NULL for a decoded binary frame
+	int num_fields;
+	const char *fields[CODEC_MAX_FIELDS];
+	int lens[CODEC_MAX_FIELDS];
+	const char *payload;
+	int payload_len;
+}
+message_t;
+
+void message_init(message_t *msg, int op);
+void message_field(message_t *msg, const char *field, int len);
+void message_string(message_t *msg, const char *field);
+void message_payload(message_t *msg, const char *payload, int len);
+
+int codec_encode(int framing, const message_t *msg, char *buf, int size);
+int codec_decode(int framing, const char *frame, int len, message_t *msg);
+int parse_request(const message_t *msg, int width, int height, char role, request_t *req);
+
+#endif // CODEC_H
@@ -0,0 +1,95 @@
+#include "house.h"
+
+#define CELLS 9             // the house only plays 3x3
+#define POSITIONS 19683     // 3^9, every cell empty, X or O
+#define UNSOLVED 0xFF
+
+// best cell for the side to move in the low nibble and the position's
+// value for that side, plus one, in the high nibble
+static unsigned char table[POSITIONS];
+static signed char scores[POSITIONS];
+
+// a side's mask read as base 3 digits, so X and O masks add up to the
+// position's index without a loop
+static unsigned short ternary[1 << CELLS];
+
+static int position(const board_t *board)
+{
+	return ternary[board_mask(board, 0)] + 2 * ternary[board_mask(board, 1)];
+}
+
+static int empty_cells(const board_t *board)
+{
+	return CELLS - board->filled;
+}
+
+// score for the side to move: positive wins, faster wins score higher,
+// negative loses, zero draws
+static int solve(const board_t *board, int side)
+{
+	int code = position(board);
+	int best = -CELLS - 1;
+	int best_cell = 0;
+
+	if (table[code] != UNSOLVED)
+	{
+		return scores[code];
+	}
+
+	for (int cell = 0; cell < CELLS; cell++)
+	{
+		if (!board_empty(board, cell))
+		{
+			continue;
+		}
+
+		board_t next = *board;
+		int result = board_play(&next, side, cell);
+		int value = (result == BOARD_WIN) ? 1 + empty_cells(&next) : (result == BOARD_DRAW) ? 0 : -solve(&next, 1 - side);
+		if (value > best)
+		{
+			best = value;
+			best_cell = cell;
+		}
+	}
+
+	scores[code] = best;
+	table[code] = best_cell | (((best > 0) - (best < 0) + 1) << 4);
+	return best;
+}
+
+void house_init()
+{
+	board_t board;
+
+	for (int mask = 0; mask < (1 << CELLS); mask++)
+	{
+		int value = 0;
+		for (int cell = CELLS - 1; cell >= 0; cell--)
+		{
+			value = value * 3 + ((mask >> cell) & 1);
+		}
+		ternary[mask] = value;
+	}
+	for (int i = 0; i < POSITIONS; i++)
+	{
+		table[i] = UNSOLVED;
+	}
+
+	board_init(&board);
+	solve(&board, 0);
+}
+
+// reply for the side to move, the game must not be over yet
+int house_move(const board_t *board)
+{
+	return table[position(board)] & 0x0F;
+}
+
+// how the position stands for side under perfect play: 1, 0 or -1
+int house_value(const board_t *board, int side)
+{
+	int to_move = board->filled % 2;
+	int value = (table[position(board)] >> 4) - 1;
+	return (side == to_move) ? value : -value;
+}
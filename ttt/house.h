@@ -0,0 +1,15 @@
+#ifndef HOUSE_H
+#define HOUSE_H
+
+#include "board.h"
+
+#define HOUSE_NAME "house"
+
+// the house bot plays O on 3x3 boards from a table holding the minimax
+// reply to every position, built once at startup, so each of its moves is
+// one lookup
+void house_init();
+int house_move(const board_t *board);
+int house_value(const board_t *board, int side);
+
+#endif // HOUSE_H
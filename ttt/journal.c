@@ -0,0 +1,207 @@
+#include "journal.h"
+#include "mailbox.h"
+#include "pool.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JOURNAL_SYNC_NS 100000000L  // longest a record stays unsynced
+#define JOURNAL_IDLE_NS 10000000L
+
+typedef struct
+{
+	mail_t mail;
+	_Alignas(8) char data[RECORD_MAX_SIZE];
+}
+entry_t;
+
+// the segment being filled, only ever touched by the writer thread
+typedef struct
+{
+	char dir[4096];
+	int seq;
+	int fd;
+	char *data;
+	long used;                  // bytes
+	long synced;
+	long last_sync;
+	mailbox_t box;
+}
+journal_t;
+
+static journal_t journal;
+static int enabled = 0;
+static pool_t entry_pool = POOL_INITIALIZER(entry_t);
+
+long journal_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static long journal_clock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// flush what was appended since the last sync, from the page holding the
+// first unsynced byte on
+static void journal_sync()
+{
+	if (journal.synced == journal.used)
+	{
+		return;
+	}
+
+	long page = sysconf(_SC_PAGESIZE);
+	long start = journal.synced / page * page;
+	if (msync(journal.data + start, journal.used - start, MS_SYNC) < 0)
+	{
+		log_error("journal msync: %m");
+	}
+	journal.synced = journal.used;
+}
+
+// create the next segment at its full size, the file stays sparse until
+// records land in it
+static int segment_open()
+{
+	char path[4200];
+	snprintf(path, sizeof(path), "%s/" RECORD_FORMAT, journal.dir, journal.seq);
+	journal.fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (journal.fd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	if (ftruncate(journal.fd, RECORD_SEGMENT) < 0)
+	{
+		perror(path);
+		close(journal.fd);
+		return -1;
+	}
+	journal.data = mmap(NULL, RECORD_SEGMENT, PROT_READ | PROT_WRITE, MAP_SHARED, journal.fd, 0);
+	if (journal.data == MAP_FAILED)
+	{
+		perror(path);
+		close(journal.fd);
+		return -1;
+	}
+	journal.used = 0;
+	journal.synced = 0;
+	return 0;
+}
+
+static void segment_close()
+{
+	journal_sync();
+	munmap(journal.data, RECORD_SEGMENT);
+	close(journal.fd);
+	journal.seq++;
+}
+
+static void journal_run(mail_t *mail, void *ctx)
+{
+	entry_t *entry = (entry_t *) mail;
+	game_record_t *copy = (game_record_t *) entry->data;
+	int *written = ctx;
+
+	if (journal.used + copy->size > RECORD_SEGMENT)
+	{
+		segment_close();
+		if (segment_open() < 0)
+		{
+			exit(1);
+		}
+	}
+
+	// the magic goes in last, a reader never sees a half copied record
+	game_record_t *rec = (game_record_t *) (journal.data + journal.used);
+	memcpy((char *) rec + sizeof(rec->magic), entry->data + sizeof(rec->magic), copy->size - sizeof(rec->magic));
+	journal.used += copy->size;
+	atomic_thread_fence(memory_order_release);
+	rec->magic = RECORD_MAGIC;
+	pool_put(&entry_pool, entry);
+	(*written)++;
+}
+
+static void *journal_writer(void *arg)
+{
+	struct timespec idle = { 0, JOURNAL_IDLE_NS };
+
+	(void) arg;
+	while (1)
+	{
+		int written = 0;
+		mailbox_drain(&journal.box, journal_run, &written);
+
+		long now = journal_clock();
+		if (now - journal.last_sync >= JOURNAL_SYNC_NS)
+		{
+			journal_sync();
+			journal.last_sync = now;
+		}
+		if (written == 0)
+		{
+			nanosleep(&idle, NULL);
+		}
+	}
+	return NULL;
+}
+
+// start recording into dir after whatever segments it already holds
+int journal_open(const char *dir)
+{
+	char pattern[4200];
+	glob_t found;
+	pthread_t thread;
+
+	snprintf(journal.dir, sizeof(journal.dir), "%s", dir);
+	snprintf(pattern, sizeof(pattern), "%s/" RECORD_PATTERN, dir);
+	journal.seq = 0;
+	if (glob(pattern, 0, NULL, &found) == 0)
+	{
+		const char *last = strrchr(found.gl_pathv[found.gl_pathc - 1], '/') + 1;
+		sscanf(last, RECORD_FORMAT, &journal.seq);
+		journal.seq++;
+		globfree(&found);
+	}
+
+	if (segment_open() < 0)
+	{
+		return -1;
+	}
+	journal.last_sync = journal_clock();
+	if (pthread_create(&thread, NULL, journal_writer, NULL) != 0)
+	{
+		perror("pthread_create");
+		return -1;
+	}
+	pthread_detach(thread);
+	enabled = 1;
+	return 0;
+}
+
+int journal_enabled()
+{
+	return enabled;
+}
+
+// queue a copy of the record, the writer thread drains the mailbox on its
+// own schedule whatever the post reports
+void journal_append(const game_record_t *rec)
+{
+	entry_t *entry = pool_get(&entry_pool);
+	memcpy(entry->data, rec, rec->size);
+	mailbox_post(&journal.box, &entry->mail);
+}
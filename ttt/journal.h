@@ -0,0 +1,14 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "record.h"
+
+// game threads hand finished games to a writer thread that appends them to
+// memory-mapped segment files and syncs them in batches, so recording a
+// game never waits on the disk
+int journal_open(const char *dir);
+int journal_enabled();
+void journal_append(const game_record_t *rec);
+long journal_now();
+
+#endif // JOURNAL_H
@@ -0,0 +1,600 @@
+#include "protocol.h"
+#include "record.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#define SERVER_IP "127.0.0.1"
+#define SERVER_PORT 5000
+#define MAX_EVENTS 1024
+#define MAX_FIELDS 8
+
+// bot states
+#define BOT_WAITING 0
+#define BOT_PLAYING 1
+
+// how bots pick their moves
+#define PLAY_RANDOM 0
+#define PLAY_SCRIPT 1
+#define PLAY_RECORD 2
+
+typedef struct
+{
+	int fd;
+	int id;
+	int games;
+	int state;
+	int spectator;
+	char role;
+	int width;                  // board shape announced in BEGN
+	int cells;
+	char board[BOARD_MAX_CELLS + 1];
+	long move_sent;
+	unsigned char seq;
+	unsigned int seed;
+	long script;
+	msgbuf_t in;
+}
+bot_t;
+
+// growable list of latency samples in microseconds
+typedef struct
+{
+	long *values;
+	long count;
+	long size;
+}
+samples_t;
+
+static const char *server_ip = SERVER_IP;
+static int server_port = SERVER_PORT;
+static int framing = FRAME_LINE;
+static int play_mode = PLAY_RANDOM;
+static int play_house = 0;
+static long target_games = 1000;
+static long games_done = 0;
+static long invalid_msgs = 0;
+static int num_games = 1;               // games the bots keep going, spectators pick among them
+static long watched_games = 0;
+static long watched_msgs = 0;
+static long watch_refused = 0;
+static int epoll_fd;
+static samples_t connect_times;
+static samples_t move_times;
+static unsigned char *script_moves;    // every recorded game's moves back to back
+static long *script_start;              // script i is script_start[i] up to script_start[i + 1]
+static long num_scripts = 0;
+
+static long now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void sample_add(samples_t *samples, long value)
+{
+	if (samples->count == samples->size)
+	{
+		samples->size = samples->size ? samples->size * 2 : 4096;
+		samples->values = realloc(samples->values, samples->size * sizeof(long));
+		if (samples->values == NULL)
+		{
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	samples->values[samples->count++] = value;
+}
+
+static int compare_long(const void *a, const void *b)
+{
+	long x = *(const long *) a;
+	long y = *(const long *) b;
+	return (x > y) - (x < y);
+}
+
+// samples must be sorted
+static long percentile(const samples_t *samples, double p)
+{
+	if (samples->count == 0)
+	{
+		return 0;
+	}
+	long i = (long) (p * (samples->count - 1) + 0.5);
+	return samples->values[i];
+}
+
+// split a message into its fields, the pipe format also carries the length as field 1
+static int split_fields(char *msg, char *fields[MAX_FIELDS])
+{
+	const char *sep = (framing == FRAME_PIPE) ? "|" : " ";
+	int n = 0;
+	for (char *tok = strtok(msg, sep); tok != NULL && n < MAX_FIELDS; tok = strtok(NULL, sep))
+	{
+		fields[n++] = tok;
+	}
+	return n;
+}
+
+// keep the move sequences of a record log
+static void load_scripts(const char *path)
+{
+	record_reader_t reader;
+	const game_record_t *rec;
+	long size = 0;
+	long moves_size = 0;
+
+	if (record_open(&reader, path) < 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+	script_start = calloc(1, sizeof(long));
+	while ((rec = record_next(&reader)) != NULL)
+	{
+		long used = script_start[num_scripts];
+		if (num_scripts + 1 >= size)
+		{
+			size = size ? size * 2 : 4096;
+			script_start = realloc(script_start, size * sizeof(long));
+		}
+		if (used + rec->num_moves > moves_size)
+		{
+			moves_size = moves_size ? moves_size * 2 : 65536;
+			script_moves = realloc(script_moves, moves_size);
+		}
+		if (script_start == NULL || script_moves == NULL)
+		{
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(script_moves + used, rec->moves, rec->num_moves);
+		script_start[++num_scripts] = used + rec->num_moves;
+	}
+	record_close(&reader);
+	if (num_scripts == 0)
+	{
+		fprintf(stderr, "%s: no game records\n", path);
+		exit(EXIT_FAILURE);
+	}
+}
+
+// both bots of a game have to follow the same recorded game, so it is
+// picked from the X player's name, which O learns from BEGN
+static void bot_pick_script(bot_t *bot, const char *opponent)
+{
+	int id = bot->id;
+	int games = bot->games;
+
+	if (bot->role != 'X')
+	{
+		sscanf(opponent, "b%dg%d", &id, &games);
+	}
+	bot->script = ((unsigned long) id * 2654435761UL + games) % (num_scripts ? num_scripts : 1);
+}
+
+static void bot_send(bot_t *bot, const char *msg, int len)
+{
+	if (write(bot->fd, msg, len) < 0 && errno != EAGAIN)
+	{
+		perror("write");
+	}
+}
+
+// open a fresh session for the bot and announce its name
+static int bot_connect(bot_t *bot)
+{
+	char name[32];
+	char msg[64];
+
+	long start = now_us();
+	bot->fd = connect_to_server(server_ip, server_port);
+	if (bot->fd == -1)
+	{
+		return -1;
+	}
+	sample_add(&connect_times, now_us() - start);
+
+	int nodelay = 1;
+	setsockopt(bot->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	fcntl(bot->fd, F_SETFL, fcntl(bot->fd, F_GETFL, 0) | O_NONBLOCK);
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = bot;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, bot->fd, &ev);
+
+	// a new name per game, the old one may not have been released yet
+	snprintf(name, sizeof(name), "b%dg%d", bot->id, bot->games);
+	if (bot->spectator)
+	{
+		// the next game id in turn, ids are handed out from 0 up
+		int game_id = (bot->id + bot->games) % num_games;
+		snprintf(msg, sizeof(msg), "WTCH %s%d\n", framing == FRAME_BINARY ? "BIN " : "", game_id);
+	}
+	else if (framing == FRAME_PIPE)
+	{
+		snprintf(msg, sizeof(msg), "PLAY|%d|%s|", (int) strlen(name) + 1, name);
+	}
+	else if (framing == FRAME_BINARY)
+	{
+		snprintf(msg, sizeof(msg), BIN_HANDSHAKE "%s\n", name);
+	}
+	else
+	{
+		snprintf(msg, sizeof(msg), "%s\n", name);
+	}
+
+	msgbuf_init(&bot->in, (bot->spectator && framing == FRAME_PIPE) ? FRAME_LINE : framing);
+	bot->state = BOT_WAITING;
+	bot->seq = 0;
+	bot_send(bot, msg, strlen(msg));
+	return 0;
+}
+
+static void bot_disconnect(bot_t *bot)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, bot->fd, NULL);
+	close(bot->fd);
+	bot->fd = -1;
+}
+
+// pick a legal cell from the bot's view of the board and send it
+static void bot_move(bot_t *bot)
+{
+	int empty[BOARD_MAX_CELLS];
+	int num_empty = 0;
+	char msg[32];
+
+	for (int i = 0; i < bot->cells; i++)
+	{
+		if (bot->board[i] == '.')
+		{
+			empty[num_empty++] = i;
+		}
+	}
+	if (num_empty == 0)
+	{
+		return;
+	}
+
+	int cell = (play_mode == PLAY_SCRIPT) ? empty[0] : empty[rand_r(&bot->seed) % num_empty];
+	if (play_mode == PLAY_RECORD)
+	{
+		// the recorded move, unless the record ended before the game did
+		const unsigned char *script = script_moves + script_start[bot->script];
+		int played = bot->cells - num_empty;
+		if (played < script_start[bot->script + 1] - script_start[bot->script] && script[played] < bot->cells && bot->board[script[played]] == '.')
+		{
+			cell = script[played];
+		}
+	}
+	bot->move_sent = now_us();
+	if (framing == FRAME_BINARY)
+	{
+		msg[0] = OP_MOVE;
+		msg[1] = 2;
+		msg[2] = cell;
+		msg[3] = ++bot->seq;
+		bot_send(bot, msg, 4);
+		return;
+	}
+	int row = cell / bot->width + 1;
+	int col = cell % bot->width + 1;
+	if (framing == FRAME_PIPE)
+	{
+		char pos[16];
+		int len = snprintf(pos, sizeof(pos), "%d,%d", row, col);
+		snprintf(msg, sizeof(msg), "MOVE|%d|%c|%s|", len + 3, bot->role, pos);
+	}
+	else
+	{
+		snprintf(msg, sizeof(msg), "MOVE %c %d,%d\n", bot->role, row, col);
+	}
+	bot_send(bot, msg, strlen(msg));
+}
+
+// a new game starts on an empty board of the shape the server announced
+static void bot_begin(bot_t *bot, int width, int height)
+{
+	if (width < 1 || height < 1 || width * height > BOARD_MAX_CELLS)
+	{
+		width = height = 3;
+	}
+	bot->state = BOT_PLAYING;
+	bot->width = width;
+	bot->cells = width * height;
+	memset(bot->board, '.', bot->cells);
+	bot->board[bot->cells] = '\0';
+	if (bot->role == 'X')
+	{
+		bot_move(bot);
+	}
+}
+
+// a spectator only counts what it sees, returns -1 once its game is over
+static int spectator_handle(bot_t *bot, const char *msg)
+{
+	int op = (bot->in.framing == FRAME_BINARY) ? msg[0] : 0;
+
+	watched_msgs++;
+	if (op == OP_OVER || strncmp(msg, "OVER", 4) == 0)
+	{
+		watched_games++;
+		return -1;
+	}
+	if (op == OP_INVL || strncmp(msg, "INVL", 4) == 0)
+	{
+		watch_refused++;
+		return -1;
+	}
+	return 0;
+}
+
+// binary frames carry the same events at fixed offsets
+static int bot_handle_binary(bot_t *bot, const char *frame)
+{
+	switch (frame[0])
+	{
+	case OP_WAIT:
+		if (play_house)
+		{
+			char hous[BIN_HEADER] = { OP_HOUS, 0 };
+			bot_send(bot, hous, sizeof(hous));
+		}
+		return 0;
+
+	case OP_BEGN:
+	{
+		// role, name, then '\0', width, height, k when the board is not 3x3x3
+		int name_len = strnlen(frame + 3, (unsigned char) frame[1] - 1);
+		const unsigned char *shape = (const unsigned char *) frame + 4 + name_len;
+		int has_shape = (unsigned char) frame[1] >= name_len + 5;
+		bot->role = frame[2];
+		bot_pick_script(bot, frame + 3);
+		bot_begin(bot, has_shape ? shape[0] : 3, has_shape ? shape[1] : 3);
+		return 0;
+	}
+
+	case OP_MOVD:
+		memcpy(bot->board, frame + 5, bot->cells);
+		if (frame[2] == bot->role)
+		{
+			sample_add(&move_times, now_us() - bot->move_sent);
+		}
+		else
+		{
+			bot_move(bot);
+		}
+		return 0;
+
+	case OP_OVER:
+	case OP_GONE:
+		if (bot->role == 'X')
+		{
+			games_done++;
+		}
+		return -1;
+
+	case OP_INVL:
+		invalid_msgs++;
+		return -1;
+	}
+	return 0;
+}
+
+// react to one server message, returns -1 once the bot's session is over
+static int bot_handle(bot_t *bot, char *msg)
+{
+	char *fields[MAX_FIELDS];
+	int n = split_fields(msg, fields);
+	int base = (framing == FRAME_PIPE) ? 2 : 1;
+
+	if (n == 0)
+	{
+		return 0;
+	}
+
+	if (strcmp(fields[0], "WAIT") == 0 && play_house && framing == FRAME_LINE)
+	{
+		bot_send(bot, "HOUS\n", 5);
+	}
+	else if (strcmp(fields[0], "BEGN") == 0 && n > base)
+	{
+		int width = 3, height = 3;
+		if (n > base + 2)
+		{
+			sscanf(fields[base + 2], "%dx%d", &width, &height);
+		}
+		bot->role = fields[base][0];
+		bot_pick_script(bot, n > base + 1 ? fields[base + 1] : "");
+		bot_begin(bot, width, height);
+	}
+	else if (strcmp(fields[0], "MOVD") == 0 && n > base + 2)
+	{
+		strncpy(bot->board, fields[base + 2], bot->cells);
+		if (fields[base][0] == bot->role)
+		{
+			sample_add(&move_times, now_us() - bot->move_sent);
+		}
+		else
+		{
+			bot_move(bot);
+		}
+	}
+	else if (strcmp(fields[0], "OVER") == 0 || strcmp(fields[0], "Player") == 0)
+	{
+		// both players see the end of the game, only X counts it
+		if (bot->role == 'X')
+		{
+			games_done++;
+		}
+		return -1;
+	}
+	else if (strcmp(fields[0], "INVL") == 0)
+	{
+		invalid_msgs++;
+		return -1;
+	}
+	return 0;
+}
+
+static void bot_input(bot_t *bot)
+{
+	char msg[MAX_MSG_LEN];
+	int len;
+
+	int bytes_read = msgbuf_fill(&bot->in, bot->fd);
+	if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR))
+	{
+		return;
+	}
+
+	int over = (bytes_read <= 0);
+	while (!over && (len = msgbuf_next(&bot->in, msg, sizeof(msg))) != 0)
+	{
+		if (len < 0)
+		{
+			over = 1;
+		}
+		else if (bot->spectator)
+		{
+			over = (spectator_handle(bot, msg) < 0);
+		}
+		else
+		{
+			over = ((framing == FRAME_BINARY ? bot_handle_binary(bot, msg) : bot_handle(bot, msg)) < 0);
+		}
+	}
+
+	if (over)
+	{
+		bot_disconnect(bot);
+		bot->games++;
+		if (games_done < target_games && bot_connect(bot) < 0)
+		{
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void report(int num_bots, int num_spectators, long elapsed)
+{
+	qsort(connect_times.values, connect_times.count, sizeof(long), compare_long);
+	qsort(move_times.values, move_times.count, sizeof(long), compare_long);
+
+	long connect_total = 0;
+	for (long i = 0; i < connect_times.count; i++)
+	{
+		connect_total += connect_times.values[i];
+	}
+
+	printf("protocol %s, %d bots, %ld games in %.3f s: %.1f games/s\n",
+		framing == FRAME_PIPE ? "pipe" : framing == FRAME_BINARY ? "binary" : "text", num_bots, games_done, elapsed / 1e6, games_done * 1e6 / elapsed);
+	printf("connect  n=%ld mean=%ld us p50=%ld us p99=%ld us\n",
+		connect_times.count, connect_times.count ? connect_total / connect_times.count : 0,
+		percentile(&connect_times, 0.50), percentile(&connect_times, 0.99));
+	printf("move     n=%ld p50=%ld us p99=%ld us p999=%ld us\n",
+		move_times.count, percentile(&move_times, 0.50), percentile(&move_times, 0.99), percentile(&move_times, 0.999));
+	if (num_spectators > 0)
+	{
+		printf("watch    n=%d games=%ld msgs=%ld refused=%ld\n", num_spectators, watched_games, watched_msgs, watch_refused);
+	}
+	if (invalid_msgs > 0)
+	{
+		printf("invalid  %ld\n", invalid_msgs);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int num_bots = 100;
+	int num_spectators = 0;
+	unsigned int seed = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "h:p:n:g:P:m:s:r:Hw:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'h': server_ip = optarg; break;
+		case 'p': server_port = atoi(optarg); break;
+		case 'n': num_bots = atoi(optarg); break;
+		case 'g': target_games = atol(optarg); break;
+		case 'P':
+			framing = (strcmp(optarg, "pipe") == 0) ? FRAME_PIPE : (strcmp(optarg, "binary") == 0) ? FRAME_BINARY : FRAME_LINE;
+			break;
+		case 'm': play_mode = (strcmp(optarg, "script") == 0) ? PLAY_SCRIPT : PLAY_RANDOM; break;
+		case 's': seed = strtoul(optarg, NULL, 10); break;
+		case 'r': play_mode = PLAY_RECORD; load_scripts(optarg); break;
+		case 'H': play_house = 1; break;
+		case 'w': num_spectators = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-h ip] [-p port] [-n bots] [-g games] [-P text|pipe|binary] [-m random|script] [-s seed] [-r record_dir] [-H] [-w spectators]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// bots come in pairs so nobody is left waiting
+	num_bots += num_bots % 2;
+	num_games = num_bots / 2;
+
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	epoll_fd = epoll_create1(0);
+	if (epoll_fd < 0)
+	{
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+
+	bot_t *bots = calloc(num_bots + num_spectators, sizeof(bot_t));
+	long start = now_us();
+	for (int i = 0; i < num_bots + num_spectators; i++)
+	{
+		bots[i].id = i;
+		bots[i].seed = seed + i;
+		bots[i].spectator = (i >= num_bots);
+		if (bot_connect(&bots[i]) < 0)
+		{
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	struct epoll_event events[MAX_EVENTS];
+	while (games_done < target_games)
+	{
+		int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 5000);
+		if (n < 0 && errno != EINTR)
+		{
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+		if (n == 0)
+		{
+			fprintf(stderr, "no progress for 5 s, giving up\n");
+			break;
+		}
+		for (int i = 0; i < n; i++)
+		{
+			bot_input(events[i].data.ptr);
+		}
+	}
+
+	report(num_bots, num_spectators, now_us() - start);
+	return 0;
+}
@@ -0,0 +1,197 @@
+#include "lobby.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+
+// games live in fixed-size chunks that are never moved, so a game id and the
+// game_t it names stay valid for as long as a session holds them
+typedef struct
+{
+	pthread_mutex_t lock;
+	game_t *chunks[MAX_GAME_CHUNKS];
+	int num_games;
+
+	// recycled game ids, linked through lobby_next
+	int free_head;
+
+	// FIFO of games with one player waiting for an opponent
+	int lobby_head;
+	int lobby_tail;
+	atomic_int waiting;
+}
+shard_t;
+
+static shard_t shards[MAX_SHARDS];
+static int num_shards = 0;
+
+// order in which games entered any lobby
+static atomic_long next_ticket = 0;
+
+void lobby_init(int count)
+{
+	num_shards = (count < 1) ? 1 : (count > MAX_SHARDS) ? MAX_SHARDS : count;
+	for (int i = 0; i < num_shards; i++)
+	{
+		pthread_mutex_init(&shards[i].lock, NULL);
+		shards[i].num_games = 0;
+		shards[i].free_head = -1;
+		shards[i].lobby_head = -1;
+		shards[i].lobby_tail = -1;
+		shards[i].waiting = 0;
+	}
+}
+
+int lobby_shards()
+{
+	return num_shards;
+}
+
+game_t *get_game(int game_id)
+{
+	int local = game_id & ((1 << SHARD_SHIFT) - 1);
+	return &shards[game_id >> SHARD_SHIFT].chunks[local / GAME_CHUNK][local % GAME_CHUNK];
+}
+
+int game_shard(int game_id)
+{
+	return game_id >> SHARD_SHIFT;
+}
+
+// whether any game ever had this id, for ids that come from outside
+int game_exists(int game_id)
+{
+	int shard = game_id >> SHARD_SHIFT;
+	int exists;
+
+	if (game_id < 0 || shard >= num_shards)
+	{
+		return 0;
+	}
+	pthread_mutex_lock(&shards[shard].lock);
+	exists = (game_id & ((1 << SHARD_SHIFT) - 1)) < shards[shard].num_games;
+	pthread_mutex_unlock(&shards[shard].lock);
+	return exists;
+}
+
+pthread_mutex_t *shard_lock(int shard)
+{
+	return &shards[shard].lock;
+}
+
+// how many games wait in the shard's lobby, a hint that needs no lock
+int lobby_waiting(int shard)
+{
+	return atomic_load_explicit(&shards[shard].waiting, memory_order_relaxed);
+}
+
+// hand out a recycled id, or grow the shard by one chunk when none is left
+int game_alloc(int shard)
+{
+	shard_t *s = &shards[shard];
+	int game_id;
+
+	if (s->free_head != -1)
+	{
+		game_id = s->free_head;
+		s->free_head = get_game(game_id)->lobby_next;
+		return game_id;
+	}
+
+	if (s->num_games == MAX_GAMES)
+	{
+		return -1;
+	}
+
+	if (s->num_games % GAME_CHUNK == 0)
+	{
+		game_t *chunk = calloc(GAME_CHUNK, sizeof(game_t));
+		if (chunk == NULL)
+		{
+			return -1;
+		}
+		for (int i = 0; i < GAME_CHUNK; i++)
+		{
+			chunk[i].status = GAME_FREE;
+		}
+		s->chunks[s->num_games / GAME_CHUNK] = chunk;
+	}
+
+	return (shard << SHARD_SHIFT) | s->num_games++;
+}
+
+void game_free(int game_id)
+{
+	shard_t *s = &shards[game_shard(game_id)];
+	game_t *game = get_game(game_id);
+	game->status = GAME_FREE;
+	game->lobby_next = s->free_head;
+	s->free_head = game_id;
+}
+
+void lobby_push(int game_id)
+{
+	shard_t *s = &shards[game_shard(game_id)];
+	game_t *game = get_game(game_id);
+	game->ticket = atomic_fetch_add(&next_ticket, 1);
+	game->lobby_prev = s->lobby_tail;
+	game->lobby_next = -1;
+	if (s->lobby_tail != -1)
+	{
+		get_game(s->lobby_tail)->lobby_next = game_id;
+	}
+	else
+	{
+		s->lobby_head = game_id;
+	}
+	s->lobby_tail = game_id;
+	s->waiting++;
+}
+
+// take the longest waiting game, -1 when nobody is waiting
+int lobby_pop(int shard)
+{
+	int game_id = shards[shard].lobby_head;
+	if (game_id != -1)
+	{
+		lobby_remove(game_id);
+	}
+	return game_id;
+}
+
+// unlink a game whose waiting player left before being paired
+void lobby_remove(int game_id)
+{
+	shard_t *s = &shards[game_shard(game_id)];
+	game_t *game = get_game(game_id);
+	if (game->lobby_prev != -1)
+	{
+		get_game(game->lobby_prev)->lobby_next = game->lobby_next;
+	}
+	else
+	{
+		s->lobby_head = game->lobby_next;
+	}
+	if (game->lobby_next != -1)
+	{
+		get_game(game->lobby_next)->lobby_prev = game->lobby_prev;
+	}
+	else
+	{
+		s->lobby_tail = game->lobby_prev;
+	}
+	game->lobby_prev = -1;
+	game->lobby_next = -1;
+	s->waiting--;
+}
+
+// whether the game is still waiting in the lobby or was already popped
+int lobby_queued(int game_id)
+{
+	return shards[game_shard(game_id)].lobby_head == game_id || get_game(game_id)->lobby_prev != -1;
+}
+
+// ticket of the longest waiting game, -1 when the lobby is empty
+long lobby_head_ticket(int shard)
+{
+	int game_id = shards[shard].lobby_head;
+	return (game_id == -1) ? -1 : get_game(game_id)->ticket;
+}
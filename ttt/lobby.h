@@ -0,0 +1,31 @@
+#ifndef LOBBY_H
+#define LOBBY_H
+
+#include <pthread.h>
+#include "server.h"
+
+#define MAX_SHARDS 64
+#define SHARD_SHIFT 20
+
+// game ids carry their shard in the bits above SHARD_SHIFT, so any thread
+// can find a game without knowing which event loop created it
+void lobby_init(int shards);
+int lobby_shards();
+game_t *get_game(int game_id);
+int game_shard(int game_id);
+int game_exists(int game_id);
+pthread_mutex_t *shard_lock(int shard);
+int lobby_waiting(int shard);
+
+// every call below expects the caller to hold the shard's lock
+
+int game_alloc(int shard);
+void game_free(int game_id);
+
+void lobby_push(int game_id);
+int lobby_pop(int shard);
+void lobby_remove(int game_id);
+int lobby_queued(int game_id);
+long lobby_head_ticket(int shard);
+
+#endif // LOBBY_H
@@ -0,0 +1,248 @@
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_RING 64         // lines a thread can have pending, a power of two
+#define LOG_LINE 120
+#define LOG_RATE 1000       // lines per thread and second before lines are dropped
+#define LOG_IDLE_NS 10000000L
+
+// ring states
+#define RING_FREE 0
+#define RING_OWNED 1
+#define RING_EXITED 2
+
+typedef struct
+{
+	long time;
+	int level;
+	char text[LOG_LINE];
+}
+entry_t;
+
+// single producer, the owning thread, and single consumer, the writer;
+// rings are never freed, a ring whose thread exited is drained and then
+// claimed by the next thread that logs
+typedef struct ring
+{
+	atomic_uint head;
+	atomic_uint tail;
+	atomic_int state;
+	atomic_ulong dropped;
+	unsigned long reported;
+	long window;
+	int budget;
+	struct ring *next;
+	entry_t entries[LOG_RING];
+}
+ring_t;
+
+static const char *level_names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+int log_threshold = LOG_INFO;
+
+static _Atomic(ring_t *) rings = NULL;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_key;
+static __thread ring_t *local = NULL;
+
+static long log_clock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// hand the ring to the writer, which recycles it once it is drained
+static void ring_release(void *arg)
+{
+	ring_t *ring = arg;
+	atomic_store_explicit(&ring->state, RING_EXITED, memory_order_release);
+}
+
+static void log_init()
+{
+	pthread_key_create(&log_key, ring_release);
+}
+
+static ring_t *ring_get()
+{
+	if (local != NULL)
+	{
+		return local;
+	}
+
+	pthread_once(&log_once, log_init);
+	for (ring_t *ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+	{
+		int expected = RING_FREE;
+		if (atomic_load_explicit(&ring->state, memory_order_relaxed) == RING_FREE && atomic_compare_exchange_strong(&ring->state, &expected, RING_OWNED))
+		{
+			local = ring;
+			break;
+		}
+	}
+
+	if (local == NULL)
+	{
+		if ((local = calloc(1, sizeof(ring_t))) == NULL)
+		{
+			return NULL;
+		}
+		atomic_init(&local->state, RING_OWNED);
+		local->next = atomic_load(&rings);
+		while (!atomic_compare_exchange_weak(&rings, &local->next, local))
+		{
+		}
+	}
+	local->window = 0;
+	local->budget = 0;
+	pthread_setspecific(log_key, local);
+	return local;
+}
+
+// only the owning thread writes dropped, a plain load and store will do
+static void ring_drop(ring_t *ring)
+{
+	atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+void log_write(int level, const char *fmt, ...)
+{
+	ring_t *ring = ring_get();
+	if (ring == NULL)
+	{
+		return;
+	}
+
+	long now = log_clock();
+	if (now - ring->window >= 1000000000L)
+	{
+		ring->window = now;
+		ring->budget = LOG_RATE;
+	}
+
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	if (ring->budget == 0 || tail - atomic_load_explicit(&ring->head, memory_order_acquire) == LOG_RING)
+	{
+		ring_drop(ring);
+		return;
+	}
+	ring->budget--;
+
+	entry_t *entry = &ring->entries[tail & (LOG_RING - 1)];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(entry->text, sizeof(entry->text), fmt, args);
+	va_end(args);
+	entry->time = now;
+	entry->level = level;
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+int log_parse_level(const char *name)
+{
+	for (int i = LOG_DEBUG; i <= LOG_ERROR; i++)
+	{
+		if (strcasecmp(name, level_names[i]) == 0)
+		{
+			return i;
+		}
+	}
+	return strcasecmp(name, "off") == 0 ? LOG_OFF : -1;
+}
+
+static int log_format(char *out, int size, entry_t *entry)
+{
+	struct tm tm;
+	time_t secs = entry->time / 1000000000L;
+	gmtime_r(&secs, &tm);
+	return snprintf(out, size, "%04d-%02d-%02dT%02d:%02d:%02d.%06ldZ %-5s %s\n",
+		tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+		(entry->time % 1000000000L) / 1000, level_names[entry->level], entry->text);
+}
+
+// drain every ring into one buffer and write it out in as few calls as it takes
+static void *log_writer(void *arg)
+{
+	static char out[16384];
+	struct timespec idle = { 0, LOG_IDLE_NS };
+	int used = 0;
+
+	(void) arg;
+	while (1)
+	{
+		for (ring_t *ring = atomic_load(&rings); ring != NULL; ring = ring->next)
+		{
+			int state = atomic_load_explicit(&ring->state, memory_order_acquire);
+			if (state == RING_FREE)
+			{
+				continue;
+			}
+
+			unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+			unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+			for (; head != tail; head++)
+			{
+				if (used > (int) sizeof(out) - LOG_LINE - 64)
+				{
+					write(STDERR_FILENO, out, used);
+					used = 0;
+				}
+				used += log_format(out + used, sizeof(out) - used, &ring->entries[head & (LOG_RING - 1)]);
+			}
+			atomic_store_explicit(&ring->head, head, memory_order_release);
+
+			unsigned long dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+			if (dropped != ring->reported && used <= (int) sizeof(out) - 64)
+			{
+				used += snprintf(out + used, sizeof(out) - used, "%lu log lines dropped\n", dropped - ring->reported);
+				ring->reported = dropped;
+			}
+			if (state == RING_EXITED && dropped == ring->reported)
+			{
+				// nobody writes the ring until it is claimed again
+				atomic_store_explicit(&ring->dropped, 0, memory_order_relaxed);
+				ring->reported = 0;
+				atomic_store_explicit(&ring->state, RING_FREE, memory_order_release);
+			}
+		}
+
+		if (used > 0)
+		{
+			write(STDERR_FILENO, out, used);
+			used = 0;
+		}
+		else
+		{
+			nanosleep(&idle, NULL);
+		}
+	}
+	return NULL;
+}
+
+// set the level lines have to reach and start draining, a no-op when
+// logging was compiled out
+void log_start(int level)
+{
+	pthread_t thread;
+
+	log_threshold = level;
+	if (LOG_LEVEL >= LOG_OFF || level >= LOG_OFF)
+	{
+		return;
+	}
+	if (pthread_create(&thread, NULL, log_writer, NULL) != 0)
+	{
+		perror("pthread_create");
+		exit(1);
+	}
+	pthread_detach(thread);
+}
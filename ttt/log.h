@@ -0,0 +1,41 @@
+#ifndef LOG_H
+#define LOG_H
+
+// levels
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+#define LOG_OFF 4
+
+// lowest level compiled in, everything below it costs nothing at all,
+// build with -DLOG_LEVEL=LOG_OFF to drop logging entirely
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_DEBUG
+#endif
+
+// lowest level written at run time
+extern int log_threshold;
+
+#define log_at(level, ...) \
+	do \
+	{ \
+		if ((level) >= LOG_LEVEL && (level) >= log_threshold) \
+		{ \
+			log_write((level), __VA_ARGS__); \
+		} \
+	} \
+	while (0)
+
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...) log_at(LOG_INFO, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_WARN, __VA_ARGS__)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+
+// every thread formats into a ring of its own and a writer thread drains
+// the rings to stderr, so logging never takes a lock or does a syscall
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int log_parse_level(const char *name);
+void log_start(int level);
+
+#endif // LOG_H
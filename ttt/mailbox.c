@@ -0,0 +1,54 @@
+#include "mailbox.h"
+#include <stddef.h>
+#include <sched.h>
+
+// push mail, returns 1 when the caller has to drain the mailbox itself
+int mailbox_post(mailbox_t *mb, mail_t *mail)
+{
+	// count the mail before it is visible so the worker cannot stop early
+	int idle = (atomic_fetch_add(&mb->pending, 1) == 0);
+
+	mail->next = atomic_load(&mb->head);
+	while (!atomic_compare_exchange_weak(&mb->head, &mail->next, mail))
+		;
+	return idle;
+}
+
+// run every posted mail in arrival order until none is pending, run owns
+// (and may free) each mail it is given
+void mailbox_drain(mailbox_t *mb, void (*run)(mail_t *mail, void *ctx), void *ctx)
+{
+	while (1)
+	{
+		mail_t *batch = atomic_exchange(&mb->head, NULL);
+		mail_t *fifo = NULL;
+		int done = 0;
+
+		// the stack holds the newest mail first
+		while (batch != NULL)
+		{
+			mail_t *next = batch->next;
+			batch->next = fifo;
+			fifo = batch;
+			batch = next;
+		}
+
+		while (fifo != NULL)
+		{
+			mail_t *next = fifo->next;
+			run(fifo, ctx);
+			fifo = next;
+			done++;
+		}
+
+		if (atomic_fetch_sub(&mb->pending, done) == done)
+		{
+			return;
+		}
+		if (done == 0)
+		{
+			// a poster has counted its mail but not pushed it yet
+			sched_yield();
+		}
+	}
+}
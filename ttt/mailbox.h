@@ -0,0 +1,25 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdatomic.h>
+
+// intrusive link, embedded at the start of whatever gets posted
+typedef struct mail
+{
+	struct mail *next;
+}
+mail_t;
+
+// multi-producer, single-consumer queue: any thread may post, and the
+// poster that finds the mailbox idle becomes the one worker draining it
+typedef struct
+{
+	_Atomic(mail_t *) head;
+	atomic_int pending;
+}
+mailbox_t;
+
+int mailbox_post(mailbox_t *mb, mail_t *mail);
+void mailbox_drain(mailbox_t *mb, void (*run)(mail_t *mail, void *ctx), void *ctx);
+
+#endif // MAILBOX_H
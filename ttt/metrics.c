@@ -0,0 +1,369 @@
+#include "metrics.h"
+#include "pool.h"
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+// log-linear buckets: values below HIST_SUB are exact, above that every
+// power of two is split into HIST_SUB buckets (about 12% wide)
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (40 * HIST_SUB)
+
+typedef struct stats
+{
+	atomic_ulong counters[NUM_COUNTERS];
+	atomic_ulong sums[NUM_HISTS];
+	atomic_uint buckets[NUM_HISTS][HIST_BUCKETS];
+	struct stats *prev;
+	struct stats *next;
+}
+stats_t;
+
+static const char *counter_names[NUM_COUNTERS] = {
+	"ttt_accepts_total",
+	"ttt_name_rejects_total",
+	"ttt_bytes_received_total",
+	"ttt_bytes_sent_total",
+	"ttt_games_started_total",
+	"ttt_games_finished_total{outcome=\"win\"}",
+	"ttt_games_finished_total{outcome=\"draw\"}",
+	"ttt_games_finished_total{outcome=\"resign\"}",
+	"ttt_games_finished_total{outcome=\"abandoned\"}",
+	"ttt_spectators_total",
+	"ttt_spectator_drops_total",
+	"ttt_games_finished_total{outcome=\"timeout\"}",
+	"ttt_timeouts_total{kind=\"handshake\"}",
+	"ttt_timeouts_total{kind=\"lobby\"}",
+	"ttt_detaches_total",
+	"ttt_resumes_total",
+};
+
+static const char *hist_names[NUM_HISTS] = {
+	"ttt_lobby_wait_seconds",
+	"ttt_command_seconds{command=\"MOVE\"",
+	"ttt_command_seconds{command=\"DRAW\"",
+	"ttt_command_seconds{command=\"RSGN\"",
+};
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+// whether two metric names differ in their labels only
+static int same_family(const char *a, const char *b)
+{
+	size_t base = strcspn(a, "{");
+	return strcspn(b, "{") == base && strncmp(a, b, base) == 0;
+}
+
+// live blocks, what the threads that already exited left behind, and the
+// blocks of those threads kept for reuse
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static stats_t *stats_head = NULL;
+static stats_t *stats_spare = NULL;
+static stats_t retired;
+static __thread stats_t *local = NULL;
+
+long metrics_now()
+{
+#ifdef TTT_SIM
+	return sim_clock;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+#endif
+}
+
+// only the owning thread writes a block, so a plain load and store is
+// enough and stays free of locked instructions
+static void bump(atomic_ulong *c, unsigned long n)
+{
+	atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static void stats_merge(stats_t *into, stats_t *from)
+{
+	for (int i = 0; i < NUM_COUNTERS; i++)
+	{
+		bump(&into->counters[i], atomic_load_explicit(&from->counters[i], memory_order_relaxed));
+	}
+	for (int h = 0; h < NUM_HISTS; h++)
+	{
+		bump(&into->sums[h], atomic_load_explicit(&from->sums[h], memory_order_relaxed));
+		for (int i = 0; i < HIST_BUCKETS; i++)
+		{
+			unsigned int n = atomic_load_explicit(&from->buckets[h][i], memory_order_relaxed);
+			atomic_store_explicit(&into->buckets[h][i], atomic_load_explicit(&into->buckets[h][i], memory_order_relaxed) + n, memory_order_relaxed);
+		}
+	}
+}
+
+// fold an exiting thread's numbers into the retired block
+static void stats_release(void *arg)
+{
+	stats_t *stats = arg;
+
+	pthread_mutex_lock(&stats_lock);
+	stats_merge(&retired, stats);
+	if (stats->prev != NULL)
+	{
+		stats->prev->next = stats->next;
+	}
+	else
+	{
+		stats_head = stats->next;
+	}
+	if (stats->next != NULL)
+	{
+		stats->next->prev = stats->prev;
+	}
+	stats->next = stats_spare;
+	stats_spare = stats;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static void stats_init()
+{
+	pthread_key_create(&stats_key, stats_release);
+}
+
+static stats_t *stats_get()
+{
+	if (local != NULL)
+	{
+		return local;
+	}
+
+	pthread_once(&stats_once, stats_init);
+	pthread_mutex_lock(&stats_lock);
+	if (stats_spare != NULL)
+	{
+		local = stats_spare;
+		stats_spare = local->next;
+		memset(local, 0, sizeof(stats_t));
+	}
+	else if ((local = calloc(1, sizeof(stats_t))) == NULL)
+	{
+		perror("calloc");
+		exit(1);
+	}
+	local->prev = NULL;
+	local->next = stats_head;
+	if (stats_head != NULL)
+	{
+		stats_head->prev = local;
+	}
+	stats_head = local;
+	pthread_mutex_unlock(&stats_lock);
+	pthread_setspecific(stats_key, local);
+	return local;
+}
+
+void metric_add(int counter, long n)
+{
+	bump(&stats_get()->counters[counter], n);
+}
+
+static int bucket_index(unsigned long v)
+{
+	if (v < HIST_SUB)
+	{
+		return v;
+	}
+	int msb = 63 - __builtin_clzl(v);
+	int index = (msb - HIST_SUB_BITS + 1) * HIST_SUB + (int) ((v >> (msb - HIST_SUB_BITS)) - HIST_SUB);
+	return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+// middle of the range a bucket covers
+static double bucket_value(int index)
+{
+	int e = index / HIST_SUB;
+	int s = index % HIST_SUB;
+	if (e == 0)
+	{
+		return s;
+	}
+	double width = (double) (1UL << (e - 1));
+	return (HIST_SUB + s) * width + width / 2;
+}
+
+void metric_time(int hist, long ns)
+{
+	stats_t *stats = stats_get();
+	atomic_uint *b = &stats->buckets[hist][bucket_index(ns > 0 ? ns : 0)];
+	atomic_store_explicit(b, atomic_load_explicit(b, memory_order_relaxed) + 1, memory_order_relaxed);
+	bump(&stats->sums[hist], ns > 0 ? ns : 0);
+}
+
+// merge every block and print it in the Prometheus text format
+static void metrics_dump(FILE *out)
+{
+	stats_t *total = calloc(1, sizeof(stats_t));
+	if (total == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	stats_merge(total, &retired);
+	for (stats_t *s = stats_head; s != NULL; s = s->next)
+	{
+		stats_merge(total, s);
+	}
+	pthread_mutex_unlock(&stats_lock);
+
+	// a family's samples go out together under one TYPE line, wherever its
+	// counters sit among the others
+	for (int i = 0; i < NUM_COUNTERS; i++)
+	{
+		const char *name = counter_names[i];
+		int base = strcspn(name, "{");
+		int seen = 0;
+		for (int j = 0; j < i; j++)
+		{
+			seen |= same_family(name, counter_names[j]);
+		}
+		if (seen)
+		{
+			continue;
+		}
+		fprintf(out, "# TYPE %.*s counter\n", base, name);
+		for (int j = i; j < NUM_COUNTERS; j++)
+		{
+			if (same_family(name, counter_names[j]))
+			{
+				fprintf(out, "%s %lu\n", counter_names[j], atomic_load(&total->counters[j]));
+			}
+		}
+	}
+
+	fprintf(out, "# TYPE ttt_pool_slabs_total counter\n");
+	fprintf(out, "ttt_pool_slabs_total %ld\n", pool_slabs());
+
+	for (int h = 0; h < NUM_HISTS; h++)
+	{
+		const char *name = hist_names[h];
+		int base = strcspn(name, "{");
+		int labelled = name[base] == '{';
+		unsigned long count = 0;
+
+		if (h == 0 || strncmp(name, hist_names[h - 1], base) != 0)
+		{
+			fprintf(out, "# TYPE %.*s summary\n", base, name);
+		}
+		for (int i = 0; i < HIST_BUCKETS; i++)
+		{
+			count += atomic_load(&total->buckets[h][i]);
+		}
+
+		for (unsigned int q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+		{
+			unsigned long rank = (unsigned long) (quantiles[q] * count), seen = 0;
+			double value = 0;
+			for (int i = 0; i < HIST_BUCKETS && count > 0; i++)
+			{
+				seen += atomic_load(&total->buckets[h][i]);
+				if (seen > rank)
+				{
+					value = bucket_value(i);
+					break;
+				}
+			}
+			fprintf(out, "%s%squantile=\"%g\"} %.9f\n", name, labelled ? "," : "{", quantiles[q], value / 1e9);
+		}
+		fprintf(out, "%.*s_sum%s%s %.9f\n", base, name, name + base, labelled ? "}" : "", atomic_load(&total->sums[h]) / 1e9);
+		fprintf(out, "%.*s_count%s%s %lu\n", base, name, name + base, labelled ? "}" : "", count);
+	}
+	free(total);
+}
+
+// answer every connection with a snapshot, plain HTTP so a scraper can read it
+static void *admin_loop(void *arg)
+{
+	int admin_fd = *(int *) arg;
+	free(arg);
+
+	while (1)
+	{
+		int fd = accept(admin_fd, NULL, NULL);
+		if (fd < 0)
+		{
+			continue;
+		}
+
+		// swallow the request if one comes, a bare connect gets the dump too
+		char request[1024];
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 100) > 0)
+		{
+			recv(fd, request, sizeof(request), MSG_DONTWAIT);
+		}
+
+		char *body = NULL;
+		size_t len = 0;
+		FILE *out = open_memstream(&body, &len);
+		if (out != NULL)
+		{
+			metrics_dump(out);
+			fclose(out);
+			char header[128];
+			int n = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", len);
+			send(fd, header, n, MSG_NOSIGNAL);
+			send(fd, body, len, MSG_NOSIGNAL);
+			free(body);
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+// serve the metrics on 127.0.0.1:port from a thread of their own
+int metrics_listen(int port)
+{
+	struct sockaddr_in address;
+	int reuseaddr = 1;
+	pthread_t thread;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		perror("socket");
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr));
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(fd, 16) < 0)
+	{
+		perror("admin port");
+		close(fd);
+		return -1;
+	}
+
+	int *arg = malloc(sizeof(int));
+	*arg = fd;
+	if (pthread_create(&thread, NULL, admin_loop, arg) != 0)
+	{
+		perror("pthread_create");
+		close(fd);
+		free(arg);
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// counters
+#define METRIC_ACCEPTS 0
+#define METRIC_NAME_REJECTS 1
+#define METRIC_BYTES_IN 2
+#define METRIC_BYTES_OUT 3
+#define METRIC_GAMES_STARTED 4
+#define METRIC_GAMES_WON 5
+#define METRIC_GAMES_DRAWN 6
+#define METRIC_GAMES_RESIGNED 7
+#define METRIC_GAMES_ABANDONED 8
+#define METRIC_SPECTATORS 9
+#define METRIC_SPECTATOR_DROPS 10
+#define METRIC_GAMES_TIMED_OUT 11
+#define METRIC_HANDSHAKE_TIMEOUTS 12
+#define METRIC_LOBBY_TIMEOUTS 13
+#define METRIC_DETACHES 14
+#define METRIC_RESUMES 15
+#define NUM_COUNTERS 16
+
+// latency histograms, recorded in nanoseconds
+#define HIST_LOBBY_WAIT 0
+#define HIST_MOVE 1
+#define HIST_DRAW 2
+#define HIST_RSGN 3
+#define NUM_HISTS 4
+
+// every thread records into its own block, blocks are only merged when the
+// admin port is scraped, so recording never takes a lock
+long metrics_now();
+void metric_add(int counter, long n);
+void metric_time(int hist, long ns);
+int metrics_listen(int port);
+
+#endif // METRICS_H
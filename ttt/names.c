@@ -0,0 +1,168 @@
+#include "names.h"
+#include "server.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define SHARD_MIN_SLOTS 64
+
+// slot states
+#define SLOT_EMPTY 0
+#define SLOT_USED 1
+#define SLOT_DELETED 2
+
+typedef struct
+{
+	unsigned int hash;
+	char state;
+	char name[MAX_NAME_LEN];
+}
+name_slot_t;
+
+// open addressing table, each shard grows on its own
+typedef struct
+{
+	pthread_mutex_t lock;
+	name_slot_t *slots;
+	unsigned int size;
+	unsigned int used;
+	unsigned int deleted;
+}
+name_shard_t;
+
+static name_shard_t shards[NAME_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static void shards_init()
+{
+	for (int i = 0; i < NAME_SHARDS; i++)
+	{
+		pthread_mutex_init(&shards[i].lock, NULL);
+	}
+}
+
+// FNV-1a, the low bits pick the shard and the rest pick the slot
+static unsigned int name_hash(const char *name)
+{
+	unsigned int hash = 2166136261u;
+	for (; *name; name++)
+	{
+		hash ^= (unsigned char) *name;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// slot holding name, or the first reusable slot on its probe path
+static name_slot_t *shard_find(name_shard_t *shard, const char *name, unsigned int hash, int *found)
+{
+	unsigned int mask = shard->size - 1;
+	name_slot_t *reuse = NULL;
+
+	for (unsigned int i = (hash / NAME_SHARDS) & mask;; i = (i + 1) & mask)
+	{
+		name_slot_t *slot = &shard->slots[i];
+		if (slot->state == SLOT_EMPTY)
+		{
+			*found = 0;
+			return reuse != NULL ? reuse : slot;
+		}
+		if (slot->state == SLOT_DELETED)
+		{
+			if (reuse == NULL)
+			{
+				reuse = slot;
+			}
+		}
+		else if (slot->hash == hash && strcmp(slot->name, name) == 0)
+		{
+			*found = 1;
+			return slot;
+		}
+	}
+}
+
+// rebuild the shard at a size that keeps it under 3/4 full, dropping tombstones
+static int shard_grow(name_shard_t *shard)
+{
+	unsigned int size = SHARD_MIN_SLOTS;
+	while (size * 3 / 4 <= (shard->used + 1) * 2)
+	{
+		size *= 2;
+	}
+
+	name_slot_t *old = shard->slots;
+	unsigned int old_size = shard->size;
+	shard->slots = calloc(size, sizeof(name_slot_t));
+	if (shard->slots == NULL)
+	{
+		shard->slots = old;
+		return -1;
+	}
+	shard->size = size;
+	shard->deleted = 0;
+
+	for (unsigned int i = 0; i < old_size; i++)
+	{
+		if (old[i].state == SLOT_USED)
+		{
+			int found;
+			*shard_find(shard, old[i].name, old[i].hash, &found) = old[i];
+		}
+	}
+	free(old);
+	return 0;
+}
+
+// claim the name in one step, returns 0 if someone already holds it
+int name_reserve(const char *name)
+{
+	unsigned int hash = name_hash(name);
+	name_shard_t *shard = &shards[hash % NAME_SHARDS];
+	int found;
+
+	pthread_once(&shards_once, shards_init);
+	pthread_mutex_lock(&shard->lock);
+	if ((shard->used + shard->deleted + 1) * 4 > shard->size * 3 && shard_grow(shard) < 0)
+	{
+		pthread_mutex_unlock(&shard->lock);
+		return 0;
+	}
+
+	name_slot_t *slot = shard_find(shard, name, hash, &found);
+	if (!found)
+	{
+		if (slot->state == SLOT_DELETED)
+		{
+			shard->deleted--;
+		}
+		slot->hash = hash;
+		slot->state = SLOT_USED;
+		strncpy(slot->name, name, MAX_NAME_LEN - 1);
+		slot->name[MAX_NAME_LEN - 1] = '\0';
+		shard->used++;
+	}
+	pthread_mutex_unlock(&shard->lock);
+	return !found;
+}
+
+void name_release(const char *name)
+{
+	unsigned int hash = name_hash(name);
+	name_shard_t *shard = &shards[hash % NAME_SHARDS];
+	int found;
+
+	pthread_once(&shards_once, shards_init);
+	pthread_mutex_lock(&shard->lock);
+	if (shard->size > 0)
+	{
+		name_slot_t *slot = shard_find(shard, name, hash, &found);
+		if (found)
+		{
+			slot->state = SLOT_DELETED;
+			shard->used--;
+			shard->deleted++;
+		}
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
@@ -0,0 +1,9 @@
+#ifndef NAMES_H
+#define NAMES_H
+
+#define NAME_SHARDS 64
+
+int name_reserve(const char *name);
+void name_release(const char *name);
+
+#endif // NAMES_H
@@ -0,0 +1,270 @@
+#include "outq.h"
+#include "metrics.h"
+#include "pool.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static pool_t outq_pool = POOL_INITIALIZER(outq_t);
+
+outq_t *outq_new(int fd)
+{
+	outq_t *q = pool_get(&outq_pool);
+	if (q == NULL)
+	{
+		return NULL;
+	}
+	pthread_mutex_init(&q->lock, NULL);
+	q->fd = fd;
+	q->refs = 1;
+	q->head = 0;
+	q->tail = 0;
+	q->watch = NULL;
+	q->watching = 0;
+	q->submit = NULL;
+	q->inflight = 0;
+	q->lingering = 0;
+	q->hangup = NULL;
+	q->ctx = NULL;
+	return q;
+}
+
+void outq_hold(outq_t *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->refs++;
+	pthread_mutex_unlock(&q->lock);
+}
+
+void outq_put(outq_t *q)
+{
+	pthread_mutex_lock(&q->lock);
+	int refs = --q->refs;
+	pthread_mutex_unlock(&q->lock);
+	if (refs == 0)
+	{
+		pthread_mutex_destroy(&q->lock);
+		pool_put(&outq_pool, q);
+	}
+}
+
+// detach the queue from its socket before the owner closes it, so a late
+// flush from another session can never hit a recycled descriptor; with a
+// submitted send still out, the bytes queued behind it would be lost, so the
+// queue keeps the socket until they followed and closes it then, returns 1
+// when the owner must leave the socket open for that
+int outq_close(outq_t *q)
+{
+	int lingering = 0;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->inflight)
+	{
+		q->lingering = lingering = 1;
+	}
+	else
+	{
+		q->fd = -1;
+		q->head = q->tail;
+	}
+	q->watch = NULL;
+	pthread_mutex_unlock(&q->lock);
+	return lingering;
+}
+
+// wake the owner's reader so its session ends, a no-op once the owner closed
+void outq_shutdown(outq_t *q)
+{
+	pthread_mutex_lock(&q->lock);
+	if (q->fd != -1 && !q->lingering && q->hangup != NULL)
+	{
+		q->hangup(q);
+	}
+	else if (q->fd != -1 && !q->lingering)
+	{
+		shutdown(q->fd, SHUT_RD);
+	}
+	pthread_mutex_unlock(&q->lock);
+}
+
+// append without any syscall, a peer that lets a whole ring pile up is cut off
+int outq_push(outq_t *q, const char *msg, int len)
+{
+	pthread_mutex_lock(&q->lock);
+	if (q->fd == -1 || q->lingering)
+	{
+		pthread_mutex_unlock(&q->lock);
+		return -1;
+	}
+	if (q->tail - q->head + len > OUTQ_SIZE)
+	{
+		log_warn("Output queue full on %d, dropping slow client", q->fd);
+		if (q->hangup != NULL)
+		{
+			q->hangup(q);
+		}
+		else
+		{
+			shutdown(q->fd, SHUT_RDWR);
+		}
+		pthread_mutex_unlock(&q->lock);
+		return -1;
+	}
+
+	unsigned int start = q->tail & (OUTQ_SIZE - 1);
+	unsigned int first = (OUTQ_SIZE - start < (unsigned int) len) ? OUTQ_SIZE - start : (unsigned int) len;
+	memcpy(q->data + start, msg, first);
+	memcpy(q->data, msg + first, len - first);
+	q->tail += len;
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+// send everything queued in as few syscalls as the ring allows, never blocking,
+// returns 0 once drained, 1 if bytes are left waiting for POLLOUT and -1 on error
+int outq_flush(outq_t *q)
+{
+	int result = 0;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->submit != NULL)
+	{
+		// one send at a time, the queue holds a reference until it completes
+		if (!q->inflight && q->tail != q->head && q->fd != -1)
+		{
+			unsigned int start = q->head & (OUTQ_SIZE - 1);
+			unsigned int used = q->tail - q->head;
+			q->inflight = 1;
+			q->refs++;
+			q->submit(q, q->data + start, (OUTQ_SIZE - start < used) ? OUTQ_SIZE - start : used);
+		}
+		result = (q->tail != q->head);
+		pthread_mutex_unlock(&q->lock);
+		return result;
+	}
+
+	while (q->tail != q->head && q->fd != -1)
+	{
+		unsigned int used = q->tail - q->head;
+		unsigned int start = q->head & (OUTQ_SIZE - 1);
+		struct iovec iov[2];
+		struct msghdr mh;
+
+		memset(&mh, 0, sizeof(mh));
+		iov[0].iov_base = q->data + start;
+		iov[0].iov_len = (OUTQ_SIZE - start < used) ? OUTQ_SIZE - start : used;
+		iov[1].iov_base = q->data;
+		iov[1].iov_len = used - iov[0].iov_len;
+		mh.msg_iov = iov;
+		mh.msg_iovlen = iov[1].iov_len ? 2 : 1;
+
+		ssize_t sent = sendmsg(q->fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent > 0)
+		{
+			q->head += sent;
+			metric_add(METRIC_BYTES_OUT, sent);
+		}
+		else if (sent < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			result = 1;
+			break;
+		}
+		else
+		{
+			// peer is gone, nothing queued can be delivered anymore
+			q->head = q->tail;
+			result = -1;
+			break;
+		}
+	}
+	if (q->watch != NULL && q->watching != (result == 1))
+	{
+		q->watching = (result == 1);
+		q->watch(q, q->watching);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return result;
+}
+
+// completion of a submitted send: consume what went out and send whatever
+// was queued in the meantime
+void outq_sent(outq_t *q, int result)
+{
+	pthread_mutex_lock(&q->lock);
+	q->inflight = 0;
+	if (q->fd != -1 && result > 0)
+	{
+		q->head += result;
+		metric_add(METRIC_BYTES_OUT, result);
+	}
+	else if (q->fd != -1)
+	{
+		// peer is gone, nothing queued can be delivered anymore
+		q->head = q->tail;
+	}
+	if (q->lingering && q->head == q->tail)
+	{
+		// the last bytes of a closed session are out
+		close(q->fd);
+		q->fd = -1;
+		q->lingering = 0;
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	outq_flush(q);
+	outq_put(q);
+}
+
+void outbox_init(outbox_t *box)
+{
+	box->n = 0;
+}
+
+// queue len bytes for q and remember q for the flush, holding a reference until then
+void queue_bytes(outbox_t *box, outq_t *q, const char *msg, int len)
+{
+	if (q == NULL)
+	{
+		return;
+	}
+
+	outq_push(q, msg, len);
+	for (int i = 0; i < box->n; i++)
+	{
+		if (box->q[i] == q)
+		{
+			return;
+		}
+	}
+	if (box->n == OUTBOX_MAX)
+	{
+		outq_flush(q);
+		return;
+	}
+	outq_hold(q);
+	box->q[box->n++] = q;
+}
+
+void queue_msg(outbox_t *box, outq_t *q, const char *msg)
+{
+	queue_bytes(box, q, msg, strlen(msg));
+}
+
+void outbox_flush(outbox_t *box)
+{
+	for (int i = 0; i < box->n; i++)
+	{
+		outq_flush(box->q[i]);
+		outq_put(box->q[i]);
+	}
+	box->n = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef OUTQ_H
+#define OUTQ_H
+
+#include <pthread.h>
+
+#define OUTQ_SIZE 4096
+#define OUTBOX_MAX 4
+
+// per-connection output ring, shared by reference between the connection's
+// owner and whichever session is writing to it from inside a game
+typedef struct outq
+{
+	pthread_mutex_t lock;
+	int fd;
+	int refs;
+	unsigned int head;
+	unsigned int tail;
+	// told under the lock whenever the queue starts or stops needing the
+	// socket to become writable, so the owner can watch for it
+	void (*watch)(struct outq *q, int writable);
+	int watching;
+	// when set, flushes hand the queued bytes to an asynchronous sender
+	// instead of calling sendmsg(), and the sender reports back through
+	// outq_sent() once they are out
+	void (*submit)(struct outq *q, const char *data, unsigned int len);
+	int inflight;
+	// closed by its owner while a send was in flight, the queue sends what
+	// is left and closes the socket itself
+	int lingering;
+	// when set, takes over from shutdown() on the socket
+	void (*hangup)(struct outq *q);
+	void *ctx;
+	char data[OUTQ_SIZE];
+}
+outq_t;
+
+// queues touched while handling one input event, flushed once the game lock is released
+typedef struct
+{
+	outq_t *q[OUTBOX_MAX];
+	int n;
+}
+outbox_t;
+
+outq_t *outq_new(int fd);
+void outq_hold(outq_t *q);
+void outq_put(outq_t *q);
+int outq_close(outq_t *q);
+void outq_shutdown(outq_t *q);
+int outq_push(outq_t *q, const char *msg, int len);
+int outq_flush(outq_t *q);
+void outq_sent(outq_t *q, int result);
+
+void outbox_init(outbox_t *box);
+void queue_bytes(outbox_t *box, outq_t *q, const char *msg, int len);
+void queue_msg(outbox_t *box, outq_t *q, const char *msg);
+void outbox_flush(outbox_t *box);
+
+#endif // OUTQ_H
@@ -0,0 +1,172 @@
+#include "protocol.h"
+#include "codec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// what players send, weighted the way a game sends it: mostly moves
+static const char *lines[] = {
+	"MOVE X 2,2",
+	"MOVE O 1,3",
+	"MOVE X 3,1",
+	"MOVE O 2,1",
+	"MOVE X 1,1",
+	"MOVE O 4,1",
+	"DRAW S",
+	"DRAW R",
+	"RSGN",
+	"HELLO there",
+};
+
+// the same messages in the pipe framing of changed/
+static const char *pipe_lines[] = {
+	"MOVE|6|X|2,2|",
+	"MOVE|6|O|1,3|",
+	"MOVE|6|X|3,1|",
+	"MOVE|6|O|2,1|",
+	"MOVE|6|X|1,1|",
+	"MOVE|6|O|4,1|",
+	"DRAW|2|S|",
+	"DRAW|2|R|",
+	"RSGN|0|",
+	"HELO|6|there|",
+};
+
+#define NUM_LINES ((int) (sizeof(lines) / sizeof(lines[0])))
+
+// the server's text parser before parse_request(), kept to measure against
+static int parse_sscanf(const char **lines, int i, char role, request_t *req)
+{
+	char cmd[50];
+	char msg[50];
+	int args = sscanf(lines[i], "%49s %49[^\n]", cmd, msg);
+
+	memset(req, 0, sizeof(*req));
+	if (args == 2 && strcmp(cmd, "MOVE") == 0)
+	{
+		char pos[50];
+		char r;
+		int row, col;
+		req->op = OP_MOVE;
+		if (sscanf(msg, "%c %49s", &r, pos) != 2)
+		{
+			req->error = "Invalid command";
+			return req->op;
+		}
+		if (sscanf(pos, "%d,%d", &row, &col) != 2 || row < 1 || row > 3 || col < 1 || col > 3)
+		{
+			req->error = "Cell out of bounds";
+		}
+		else if (r != role)
+		{
+			req->error = "Not your role";
+		}
+		req->cell = (row - 1) * 3 + col - 1;
+	}
+	else if (args == 2 && strcmp(cmd, "DRAW") == 0)
+	{
+		req->op = OP_DRAW;
+		req->arg = msg[0];
+		if (msg[1] != '\0' || (msg[0] != 'S' && msg[0] != 'A' && msg[0] != 'R'))
+		{
+			req->error = "Invalid parameter";
+		}
+	}
+	else if (args == 1 && strcmp(cmd, "RSGN") == 0)
+	{
+		req->op = OP_RSGN;
+	}
+	else if (args == 1 && strcmp(cmd, "HOUS") == 0)
+	{
+		req->op = OP_HOUS;
+	}
+	return req->op;
+}
+
+static int parse_line(const char **lines, int i, char role, request_t *req)
+{
+	message_t msg;
+	if (codec_decode(FRAME_LINE, lines[i], strlen(lines[i]), &msg) < 0)
+	{
+		memset(req, 0, sizeof(*req));
+		return 0;
+	}
+	return parse_request(&msg, 3, 3, role, req);
+}
+
+static int parse_pipe(const char **lines, int i, char role, request_t *req)
+{
+	message_t msg;
+	if (codec_decode(FRAME_PIPE, lines[i], strlen(lines[i]), &msg) < 0)
+	{
+		memset(req, 0, sizeof(*req));
+		return 0;
+	}
+	return parse_request(&msg, 3, 3, role, req);
+}
+
+static long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// ns per message over n passes through the messages, the checksum keeps the
+// compiler from dropping the work
+static double run(int (*parse)(const char **, int, char, request_t *), const char **msgs, long n, long *sum)
+{
+	request_t req;
+	long start = now_ns();
+
+	for (long i = 0; i < n; i++)
+	{
+		*sum += parse(msgs, i % NUM_LINES, 'X', &req) + req.cell + (req.error != NULL);
+	}
+	return (double) (now_ns() - start) / n;
+}
+
+int main(int argc, char *argv[])
+{
+	long n = 10000000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1)
+	{
+		if (opt == 'n')
+		{
+			n = atol(optarg);
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [-n messages]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// the parsers must agree on every message before their times mean anything
+	for (int i = 0; i < NUM_LINES; i++)
+	{
+		request_t a, b, c;
+		parse_sscanf(lines, i, 'X', &a);
+		parse_line(lines, i, 'X', &b);
+		parse_pipe(pipe_lines, i, 'X', &c);
+		if (a.op != b.op || (a.error == NULL) != (b.error == NULL) || (a.error != NULL && strcmp(a.error, b.error) != 0) || (a.error == NULL && a.op == OP_MOVE && a.cell != b.cell) || memcmp(&b, &c, sizeof(b)) != 0)
+		{
+			fprintf(stderr, "parsers disagree on \"%s\"\n", lines[i]);
+			return 1;
+		}
+	}
+
+	long sum = 0;
+	double before = run(parse_sscanf, lines, n, &sum);
+	double after = run(parse_line, lines, n, &sum);
+	double pipe = run(parse_pipe, pipe_lines, n, &sum);
+	printf("sscanf   %.1f ns/msg\n", before);
+	printf("line     %.1f ns/msg\n", after);
+	printf("pipe     %.1f ns/msg\n", pipe);
+	printf("speedup  %.1fx (checksum %ld)\n", before / after, sum);
+	return 0;
+}
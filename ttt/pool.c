@@ -0,0 +1,143 @@
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+typedef struct
+{
+	void *head;
+	int count;
+}
+cache_t;
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
+static pool_t *pools[MAX_POOLS];
+static atomic_int num_pools = 0;
+static atomic_long slabs = 0;
+static __thread cache_t caches[MAX_POOLS];
+static __thread int cache_used = 0;
+
+#define NEXT(obj) (*(void **) (obj))
+
+// move up to n objects from one list to another, returns how many moved
+static int list_move(void **from, void **to, int n)
+{
+	int moved = 0;
+	while (moved < n && *from != NULL)
+	{
+		void *obj = *from;
+		*from = NEXT(obj);
+		NEXT(obj) = *to;
+		*to = obj;
+		moved++;
+	}
+	return moved;
+}
+
+// a thread that exits gives its cached objects back to the shared lists
+static void pool_release(void *arg)
+{
+	cache_t *cache = arg;
+	for (int i = 0; i < atomic_load(&num_pools); i++)
+	{
+		pthread_mutex_lock(&pools[i]->lock);
+		list_move(&cache[i].head, &pools[i]->free, cache[i].count);
+		pthread_mutex_unlock(&pools[i]->lock);
+		cache[i].count = 0;
+	}
+}
+
+static void pool_init()
+{
+	pthread_key_create(&pool_key, pool_release);
+}
+
+static cache_t *pool_cache(pool_t *pool)
+{
+	if (!cache_used)
+	{
+		pthread_once(&pool_once, pool_init);
+		pthread_setspecific(pool_key, caches);
+		cache_used = 1;
+	}
+
+	if (pool->index == -1)
+	{
+		// first use of the pool anywhere, give it a cache slot
+		pthread_mutex_lock(&pool->lock);
+		if (pool->index == -1)
+		{
+			int index = atomic_load(&num_pools);
+			if (index == MAX_POOLS)
+			{
+				fprintf(stderr, "Too many pools\n");
+				exit(1);
+			}
+			pools[index] = pool;
+			atomic_store(&num_pools, index + 1);
+			pool->index = index;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return &caches[pool->index];
+}
+
+// carve a fresh slab into the shared free list, the caller holds pool->lock
+static void pool_grow(pool_t *pool)
+{
+	size_t size = (pool->size + 15) & ~(size_t) 15;
+	char *slab = malloc(size * POOL_SLAB);
+	if (slab == NULL)
+	{
+		perror("malloc");
+		exit(1);
+	}
+	atomic_fetch_add(&slabs, 1);
+	for (int i = POOL_SLAB - 1; i >= 0; i--)
+	{
+		NEXT(slab + i * size) = pool->free;
+		pool->free = slab + i * size;
+	}
+}
+
+void *pool_get(pool_t *pool)
+{
+	cache_t *cache = pool_cache(pool);
+
+	if (cache->head == NULL)
+	{
+		pthread_mutex_lock(&pool->lock);
+		if (pool->free == NULL)
+		{
+			pool_grow(pool);
+		}
+		cache->count += list_move(&pool->free, &cache->head, POOL_CACHE / 2);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	void *obj = cache->head;
+	cache->head = NEXT(obj);
+	cache->count--;
+	return obj;
+}
+
+void pool_put(pool_t *pool, void *obj)
+{
+	cache_t *cache = pool_cache(pool);
+
+	NEXT(obj) = cache->head;
+	cache->head = obj;
+	if (++cache->count > POOL_CACHE)
+	{
+		pthread_mutex_lock(&pool->lock);
+		cache->count -= list_move(&cache->head, &pool->free, POOL_CACHE / 2);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+// slabs taken from the system allocator so far, flat once the server is warm
+long pool_slabs()
+{
+	return atomic_load(&slabs);
+}
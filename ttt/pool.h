@@ -0,0 +1,30 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define MAX_POOLS 16
+#define POOL_SLAB 64    // objects carved out of one malloc
+#define POOL_CACHE 32   // objects a thread keeps before handing half back
+
+// fixed-size object pool: memory comes from the system in slabs and is never
+// given back, every thread serves itself from a small private cache and only
+// touches the shared free list when that cache runs empty or overflows
+typedef struct
+{
+	size_t size;
+	atomic_int index;
+	pthread_mutex_t lock;
+	void *free;
+}
+pool_t;
+
+#define POOL_INITIALIZER(type) { sizeof(type), -1, PTHREAD_MUTEX_INITIALIZER, NULL }
+
+void *pool_get(pool_t *pool);
+void pool_put(pool_t *pool, void *obj);
+long pool_slabs();
+
+#endif // POOL_H
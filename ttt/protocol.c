@@ -2,7 +2,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdarg.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -10,6 +9,8 @@
 #include <unistd.h>
 #include <sys/select.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <errno.h>
 
 #define BUFFER_SIZE 512
 #define BOARD_SIZE 9
@@ -23,7 +24,7 @@ void write_msg(int sock_fd, char *msg) {
 }
 
 char *receive_msg(int sock_fd) {
-    char *buf = (char *)malloc(BUFFER_SIZE * sizeof(char));
+    char *buf = (char *)malloc((BUFFER_SIZE + 1) * sizeof(char));
     int bytes_read = read(sock_fd, buf, BUFFER_SIZE);
     if (bytes_read <= 0) {
         free(buf);
@@ -33,6 +34,207 @@ char *receive_msg(int sock_fd) {
     return buf;
 }
 
+void msgbuf_init(msgbuf_t *mb, int framing) {
+    mb->head = 0;
+    mb->tail = 0;
+    mb->framing = framing;
+}
+
+// read whatever the socket has into the free part of the ring, same return as read()
+int msgbuf_fill(msgbuf_t *mb, int sock_fd) {
+    unsigned int used = mb->tail - mb->head;
+    unsigned int start = mb->tail & (MSGBUF_SIZE - 1);
+    unsigned int space = MSGBUF_SIZE - used;
+    struct iovec iov[2];
+    int iovcnt = 1;
+
+    if (space == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    iov[0].iov_base = mb->data + start;
+    iov[0].iov_len = (MSGBUF_SIZE - start < space) ? MSGBUF_SIZE - start : space;
+    if (iov[0].iov_len < space) {
+        iov[1].iov_base = mb->data;
+        iov[1].iov_len = space - iov[0].iov_len;
+        iovcnt = 2;
+    }
+
+    int bytes_read = readv(sock_fd, iov, iovcnt);
+    if (bytes_read > 0) {
+        mb->tail += bytes_read;
+    }
+    return bytes_read;
+}
+
+// copy bytes that arrived some other way into the ring, returns how many fit
+int msgbuf_put(msgbuf_t *mb, const char *data, int len) {
+    unsigned int space = MSGBUF_SIZE - (mb->tail - mb->head);
+    unsigned int start = mb->tail & (MSGBUF_SIZE - 1);
+    unsigned int n = ((unsigned int)len < space) ? (unsigned int)len : space;
+    unsigned int first = (MSGBUF_SIZE - start < n) ? MSGBUF_SIZE - start : n;
+
+    memcpy(mb->data + start, data, first);
+    memcpy(mb->data, data + first, n - first);
+    mb->tail += n;
+    return n;
+}
+
+static char msgbuf_at(const msgbuf_t *mb, unsigned int i) {
+    return mb->data[(mb->head + i) & (MSGBUF_SIZE - 1)];
+}
+
+// drop everything buffered so the stream can resync on the next frame
+static int msgbuf_reject(msgbuf_t *mb) {
+    mb->head = mb->tail;
+    return -1;
+}
+
+// copy the next complete message into msg, returns its length,
+// 0 if more bytes are needed and -1 if the stream held a bad frame
+int msgbuf_next(msgbuf_t *mb, char *msg, int size) {
+    unsigned int used = mb->tail - mb->head;
+    unsigned int len, frame;
+
+    // skip separators left between text messages
+    while (mb->framing != FRAME_BINARY && used > 0 && (msgbuf_at(mb, 0) == '\n' || msgbuf_at(mb, 0) == '\r')) {
+        mb->head++;
+        used--;
+    }
+
+    if (mb->framing == FRAME_DETECT) {
+        // a pipe message gives itself away by the '|' after its type
+        for (len = 0; len < used && len < 5 && msgbuf_at(mb, len) != '\n'; len++)
+            ;
+        if (len == used && len < 5) {
+            return 0;
+        }
+        mb->framing = (len == 5 && msgbuf_at(mb, 4) == '|') ? FRAME_PIPE : FRAME_LINE;
+    }
+
+    if (mb->framing == FRAME_BINARY) {
+        // the whole frame, header included, is handed to the caller
+        if (used < BIN_HEADER) {
+            return 0;
+        }
+        frame = BIN_HEADER + (unsigned char)msgbuf_at(mb, 1);
+        if (frame > used) {
+            return 0;
+        }
+        len = frame;
+    } else if (mb->framing == FRAME_LINE) {
+        for (len = 0; len < used && msgbuf_at(mb, len) != '\n'; len++)
+            ;
+        if (len == used) {
+            return (used == MSGBUF_SIZE) ? msgbuf_reject(mb) : 0;
+        }
+        frame = len + 1;
+        if (msgbuf_at(mb, len - 1) == '\r') {
+            len--;
+        }
+    } else {
+        // header is a four letter type, then the decimal length
+        unsigned int pos, value = 0;
+        for (pos = 0; pos < 5 && pos < used; pos++) {
+            char c = msgbuf_at(mb, pos);
+            if ((pos < 4 && (c < 'A' || c > 'Z')) || (pos == 4 && c != '|')) {
+                return msgbuf_reject(mb);
+            }
+        }
+        for (; pos < used && msgbuf_at(mb, pos) != '|'; pos++) {
+            char c = msgbuf_at(mb, pos);
+            if (c < '0' || c > '9' || pos > 8) {
+                return msgbuf_reject(mb);
+            }
+            value = value * 10 + (c - '0');
+        }
+        if (pos >= used) {
+            return 0;
+        }
+        if (pos == 5) {
+            return msgbuf_reject(mb);
+        }
+        frame = pos + 1 + value;
+        if (frame > MSGBUF_SIZE) {
+            return msgbuf_reject(mb);
+        }
+        if (frame > used) {
+            return 0;
+        }
+        len = frame;
+    }
+
+    if ((int)len >= size) {
+        mb->head += frame;
+        return -1;
+    }
+
+    unsigned int start = mb->head & (MSGBUF_SIZE - 1);
+    unsigned int first = (MSGBUF_SIZE - start < len) ? MSGBUF_SIZE - start : len;
+    memcpy(msg, mb->data + start, first);
+    memcpy(msg + first, mb->data, len - first);
+    msg[len] = '\0';
+    mb->head += frame;
+    return len;
+}
+
+// block until a whole message is buffered, returns -1 once the peer is gone
+int read_msg(msgbuf_t *mb, int sock_fd, char *msg, int size) {
+    int len;
+    while ((len = msgbuf_next(mb, msg, size)) == 0) {
+        int bytes_read = msgbuf_fill(mb, sock_fd);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            return -1;
+        }
+    }
+    return len;
+}
+
+// build a binary frame around payload, returns the frame length
+int bin_frame(char *frame, int op, const char *payload, int len) {
+    if (len > BIN_MAX_PAYLOAD) {
+        len = BIN_MAX_PAYLOAD;
+    }
+    frame[0] = (char)op;
+    frame[1] = (char)len;
+    memcpy(frame + BIN_HEADER, payload, len);
+    return BIN_HEADER + len;
+}
+
+// open a TCP connection to the server, returns -1 on failure
+int connect_to_server(const char *ip, int port) {
+    // Create a socket
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd == -1) {
+        perror("Error creating socket");
+        return -1;
+    }
+
+    // Set server address
+    struct sockaddr_in server_address;
+    memset(&server_address, 0, sizeof(server_address));
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &server_address.sin_addr) != 1) {
+        perror("Error parsing server IP address");
+        close(sockfd);
+        return -1;
+    }
+
+    // Connect to server
+    if (connect(sockfd, (struct sockaddr *) &server_address, sizeof(server_address)) == -1) {
+        perror("Error connecting to server");
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
 int parse_index(char *move){
     int row = move[0] - '1';
     int col = move[2] - '1';
@@ -40,73 +242,42 @@ int parse_index(char *move){
     return index;
 }
 
-// Message *parse_message(const char *msg) {
-//     Message *message = (Message *)malloc(sizeof(Message));
-//     char *msg_copy = (char *)malloc(strlen(msg) + 1);
-//     strcpy(msg_copy, msg);
-
-//     char *token = strtok(msg_copy, "|");
-//     message->msg_type = strdup(token);
-//     token = strtok(NULL, "|");
-//     message->size = atoi(token);
-//     message->content = strdup(msg + strlen(message->msg_type) + 1 + strlen(token) + 1);
-//     free(msg_copy);
-
-//     return message;
-// }
-
-// char *format_message(const char *msg_type, ...) {
-//     char *formatted_msg;
-//     char content[BUFFER_SIZE] = {0};
-//     va_list args;
-//     va_start(args, msg_type);
-
-//     if (strcmp(msg_type, "NAME") == 0) {
-//         snprintf(content, BUFFER_SIZE, "%s|", va_arg(args, char *));
-//     } else if (strcmp(msg_type, "MOVE") == 0) {
-//         snprintf(content, BUFFER_SIZE, "%s|%s|", va_arg(args, char *), va_arg(args, char *));
-//     } else if (strcmp(msg_type, "BEGN") == 0) {
-//         snprintf(content, BUFFER_SIZE, "%s|%s|", va_arg(args, char *), va_arg(args, char *));
-//     } else if (strcmp(msg_type, "MOVD") == 0) {
-//         snprintf(content, BUFFER_SIZE, "%s|%s|%s|", va_arg(args, char *), va_arg(args, char *), va_arg(args, char *));
-//     } else if (strcmp(msg_type, "INVL") == 0) {
-//         snprintf(content, BUFFER_SIZE, "%s|", va_arg(args, char *));
-//     } else if (strcmp(msg_type, "RSGN") == 0 || strcmp(msg_type, "WAIT") == 0) {
-//         // Do nothing since these messages don't have any content.
-//     } else if (strcmp(msg_type, "DRAW") == 0) {
-//         snprintf(content, BUFFER_SIZE, "%s|", va_arg(args, char *));
-//     } else if (strcmp(msg_type, "OVER") == 0) {
-//         snprintf(content, BUFFER_SIZE, "%s|%s|", va_arg(args, char *), va_arg(args, char *));
-//     }
-
-//     va_end(args);
-
-//     if (strcmp(msg_type, "WAIT") == 0) {
-//         formatted_msg = (char *)malloc(strlen("WAIT|0|") + 1);
-//         snprintf(formatted_msg, strlen("WAIT|0|") + 1, "WAIT|0|");
-//     } else {
-//         int size = strlen(content);
-//         if (strcmp(msg_type, "NAME") == 0) {
-//             size++;  // Add one to the size for the vertical bar in the "NAME" case.
-//         }
-//         formatted_msg = (char *)malloc(strlen(msg_type) + 1 + 3 + 1 + size + 1);
-//         snprintf(formatted_msg, strlen(msg_type) + 1 + 1 + 3 + size + 1, "%s|%d|%s\n", msg_type, size, content); // Corrected buffer size
-//     }
-
-//     return formatted_msg;
-// }
-
-
 int validate_move(const char *move) {
     // Check if the move has the correct format and is within the valid range
+    return parse_position(move, 3, 3) != -1;
+}
+
+// up to three decimal digits, anything longer is out of range anyway
+static const char *scan_number(const char *p, const char *end, int *value) {
+    const char *start = p;
+    int n = 0;
+    while (p < end && p - start < 3 && *p >= '0' && *p <= '9') {
+        n = n * 10 + (*p++ - '0');
+    }
+    *value = n;
+    return (p == start) ? NULL : p;
+}
+
+// the len bytes at pos as "row,col" counted from 1, the cell index on a
+// width x height board or -1
+int parse_cell(const char *pos, int len, int width, int height) {
+    const char *end = pos + len;
     int row, col;
-    if (sscanf(move, "%d,%d", &row, &col) != 2) {
-        return 0;
+
+    pos = scan_number(pos, end, &row);
+    if (pos == NULL || pos == end || *pos != ',') {
+        return -1;
     }
-    if (row < 1 || row > 3 || col < 1 || col > 3) {
-        return 0;
+    pos = scan_number(pos + 1, end, &col);
+    if (pos != end || row < 1 || row > height || col < 1 || col > width) {
+        return -1;
     }
-    return 1;
+    return (row - 1) * width + col - 1;
+}
+
+// "row,col" counted from 1 on a width x height board, the cell index or -1
+int parse_position(const char *move, int width, int height) {
+    return parse_cell(move, strlen(move), width, height);
 }
 
 int check_win(const char board[9])
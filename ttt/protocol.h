@@ -1,11 +1,31 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+// one client request, decoded from either encoding before the game is locked
 typedef struct {
-    char *msg_type;
-    int size;
-    char *content;
-} Message;
+    int op;             // OP_MOVE to OP_HOUS, 0 for a line that is no request
+    int cell;
+    int seq;
+    char arg;           // 'S', 'A' or 'R' of a DRAW, the role named by a text MOVE
+    const char *error;
+} request_t;
+
+#define MAX_MSG_LEN 512
+#define MSGBUF_SIZE 1024
+
+// framing used on the wire
+#define FRAME_LINE 0    // one message per '\n' terminated line
+#define FRAME_PIPE 1    // TYPE|len|fields...| where len counts the bytes after the second '|'
+#define FRAME_BINARY 2  // opcode byte, length byte, then that many payload bytes
+#define FRAME_DETECT 3  // FRAME_PIPE if the first message opens with "TYPE|", else FRAME_LINE
+
+// per-connection input ring, messages are cut out of it as they complete
+typedef struct {
+    char data[MSGBUF_SIZE];
+    unsigned int head;
+    unsigned int tail;
+    int framing;
+} msgbuf_t;
 
 #define MSG_PLAY "PLAY"
 #define MSG_NAME "NAME"
@@ -18,6 +38,39 @@ typedef struct {
 #define MSG_DRAW "DRAW"
 #define MSG_OVER "OVER"
 
+// binary clients announce themselves with a "PLAY BIN <name>" line,
+// every frame after it uses FRAME_BINARY
+#define BIN_HANDSHAKE "PLAY BIN "
+#define BIN_HEADER 2
+#define BIN_MAX_PAYLOAD 255
+
+// spectators send "WTCH <game_id>", or "WTCH BIN <game_id>" for binary
+// frames, instead of a name
+#define WATCH_HANDSHAKE "WTCH "
+
+// a player whose connection dropped mid-game sends "RSUM <token>", or
+// "RSUM BIN <token>", with the token it got after BEGN to take its seat back
+#define RESUME_HANDSHAKE "RSUM "
+#define RESUME_TOKEN_LEN 24
+
+// client to server opcodes
+#define OP_MOVE 0x01    // cell index, sequence number echoed back in MOVD
+#define OP_DRAW 0x02    // 'S', 'A' or 'R'
+#define OP_RSGN 0x03
+#define OP_HOUS 0x04    // play the house instead of waiting
+
+// server to client opcodes
+#define OP_WAIT 0x11
+#define OP_BEGN 0x12    // role, opponent name, then '\0', width, height, k off 3x3x3
+#define OP_MOVD 0x13    // role, cell, sequence number, one byte per cell
+#define OP_INVL 0x14    // reason
+#define OP_DRAW_OFFER 0x15  // 'S' or 'R'
+#define OP_OVER 0x16    // outcome, one byte per cell, reason
+#define OP_GONE 0x17    // name of the opponent that disconnected
+#define OP_GAME 0x18    // to spectators: X name, '\0', O name, then '\0', width, height, k off 3x3x3
+#define OP_TOKN 0x19    // resume token
+#define OP_SNAP 0x1A    // role, role to move, role that offered a draw or '-', width, height, k, one byte per cell, opponent name
+
 #define ROLE_X "X"
 #define ROLE_O "O"
 
@@ -28,15 +81,21 @@ typedef struct {
 
 void write_msg(int sock_fd, char *msg);
 char *receive_msg(int sock_fd);
-char *read_msg(int sock_fd);
-Message *parse_message(const char *msg);
-char *format_message(const char *msg_type, ...);
+void msgbuf_init(msgbuf_t *mb, int framing);
+int msgbuf_fill(msgbuf_t *mb, int sock_fd);
+int msgbuf_put(msgbuf_t *mb, const char *data, int len);
+int msgbuf_next(msgbuf_t *mb, char *msg, int size);
+int read_msg(msgbuf_t *mb, int sock_fd, char *msg, int size);
+int bin_frame(char *frame, int op, const char *payload, int len);
+int connect_to_server(const char *ip, int port);
 int parse_index(char *move);
 
 char *game_state_string();
 void update_board(char *board, const char *move, char *role);
 const char *get_board();
 int validate_move(const char *move);
+int parse_position(const char *move, int width, int height);
+int parse_cell(const char *pos, int len, int width, int height);
 int check_win(const char *board);
 int check_draw(const char *board);
 
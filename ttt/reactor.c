@@ -0,0 +1,360 @@
+#include "reactor.h"
+#include "metrics.h"
+#include "lobby.h"
+#include "pool.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 1024
+
+// one event loop, its listener and the shard of the game table it fills
+typedef struct
+{
+	int epoll_fd;
+	int listen_fd;
+	int shard;
+	wheel_t wheel;
+}
+reactor_t;
+
+static pool_t conn_pool = POOL_INITIALIZER(conn_t);
+
+static int set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0)
+	{
+		return -1;
+	}
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+void conn_init(conn_t *conn, int fd, int shard)
+{
+	conn->loop = NULL;
+	conn->wheel = NULL;
+	conn->shard = shard;
+	conn->fd = fd;
+	conn->state = CONN_NAME;
+	conn->game_id = -1;
+	conn->player.name[0] = '\0';
+	conn->player.sock_fd = fd;
+	conn->player.out = outq_new(fd);
+	msgbuf_init(&conn->in, FRAME_DETECT);
+}
+
+// flush whatever the last event queued and end the session, the socket
+// itself is left to the event loop unless this returns 1: the output queue
+// still has a send in flight and closes the socket once it drained
+int conn_end(conn_t *conn, outbox_t *box)
+{
+	wheel_cancel(conn->wheel, &conn->alarm);
+	if (conn->game_id != -1)
+	{
+		// the OVER of a game that just ended goes out before leaving it
+		// hangs up on the opponent, whose loop drops what is still queued
+		outbox_flush(box);
+		leave_game(conn->game_id, &conn->player, box);
+	}
+	outbox_flush(box);
+	logout(&conn->player);
+	int lingering = outq_close(conn->player.out);
+	outq_put(conn->player.out);
+	return lingering;
+}
+
+// hand the connection its loop's wheel and give it until the handshake
+// deadline to log in
+void conn_start(conn_t *conn, wheel_t *wheel, void (*fire)(alarm_t *alarm), void *ctx)
+{
+	long expires = session_opened(wheel_now());
+
+	conn->wheel = wheel;
+	alarm_init(&conn->alarm, fire, ctx);
+	if (expires > 0)
+	{
+		wheel_arm(wheel, &conn->alarm, expires);
+	}
+}
+
+// check the session's deadlines and rearm its alarm for the next one,
+// returns -1 once the session is over and the loop has to close it
+int conn_alarm(conn_t *conn)
+{
+	long next = session_alarm(conn->game_id, &conn->player, wheel_now());
+
+	if (next > 0)
+	{
+		wheel_arm(conn->wheel, &conn->alarm, next);
+	}
+	return (next < 0) ? -1 : 0;
+}
+
+static void conn_close(conn_t *conn, outbox_t *box)
+{
+	reactor_t *reactor = conn->loop;
+	conn_end(conn, box);
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	pool_put(&conn_pool, conn);
+}
+
+static void conn_watch(conn_t *conn, int events)
+{
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = conn;
+	epoll_ctl(((reactor_t *) conn->loop)->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+// called by whichever loop flushed the queue: wait for room while bytes are
+// left over, stop waiting once the queue drained
+static void conn_writable(outq_t *q, int writable)
+{
+	conn_watch(q->ctx, writable ? EPOLLIN | EPOLLOUT | EPOLLRDHUP : EPOLLIN | EPOLLRDHUP);
+}
+
+static void conn_expired(alarm_t *alarm)
+{
+	conn_t *conn = alarm->ctx;
+	outbox_t box;
+
+	if (conn_alarm(conn) < 0)
+	{
+		outbox_init(&box);
+		conn_close(conn, &box);
+	}
+}
+
+static void conn_output(conn_t *conn)
+{
+	outq_flush(conn->player.out);
+}
+
+static void accept_clients(reactor_t *reactor)
+{
+	while (1)
+	{
+		int client_fd = accept(reactor->listen_fd, NULL, NULL);
+		if (client_fd < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+			{
+				log_warn("accept: %m");
+			}
+			return;
+		}
+
+		int nodelay = 1;
+		metric_add(METRIC_ACCEPTS, 1);
+		set_nonblocking(client_fd);
+		setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+		conn_t *conn = pool_get(&conn_pool);
+		conn_init(conn, client_fd, reactor->shard);
+		conn->loop = reactor;
+		conn->player.out->watch = conn_writable;
+		conn->player.out->ctx = conn;
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.ptr = conn;
+		if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0)
+		{
+			log_warn("epoll_ctl: %m");
+			outq_put(conn->player.out);
+			close(client_fd);
+			pool_put(&conn_pool, conn);
+			continue;
+		}
+		conn_start(conn, &reactor->wheel, conn_expired, conn);
+	}
+}
+
+// feed one complete message through the connection's state machine,
+// returns -1 once the session is over
+static int conn_msg(conn_t *conn, outbox_t *box, char *buf, int len)
+{
+	switch (conn->state)
+	{
+	case CONN_NAME:
+		if (login(&conn->player, box, buf) == 0 || (conn->game_id = join_game(conn->shard, &conn->player, box)) == -1)
+		{
+			return -1;
+		}
+		conn->in.framing = conn->player.framing;
+		conn->state = CONN_LOBBY;
+		if (conn_alarm(conn) < 0)
+		{
+			return -1;
+		}
+		break;
+
+	case CONN_LOBBY:
+	case CONN_GAME:
+		if (play_msg(conn->game_id, &conn->player, box, buf, len))
+		{
+			conn->state = CONN_OVER;
+			return -1;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	if (conn->state == CONN_LOBBY && get_game(conn->game_id)->status == GAME_ACTIVE)
+	{
+		conn->state = CONN_GAME;
+	}
+	return 0;
+}
+
+// run every message the input buffer completed, returns -1 once the
+// session is over or the stream held a bad frame
+int conn_process(conn_t *conn, outbox_t *box)
+{
+	char buf[MAX_MSG_LEN];
+	int len;
+
+	while ((len = msgbuf_next(&conn->in, buf, sizeof(buf))) != 0)
+	{
+		// a negative length is an oversized or malformed frame
+		if (len < 0 || conn_msg(conn, box, buf, len) < 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// pull what the socket has, run every message it completed and send all
+// the replies those messages produced in one flush per connection
+static void conn_input(conn_t *conn)
+{
+	outbox_t box;
+
+	outbox_init(&box);
+	int bytes_read = msgbuf_fill(&conn->in, conn->fd);
+	if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+	{
+		return;
+	}
+	if (bytes_read <= 0)
+	{
+		conn_close(conn, &box);
+		return;
+	}
+	metric_add(METRIC_BYTES_IN, bytes_read);
+
+	if (conn_process(conn, &box) < 0)
+	{
+		conn_close(conn, &box);
+		return;
+	}
+	outbox_flush(&box);
+}
+
+// one event loop: every socket is non-blocking, each connection advances
+// when epoll reports it readable and drains its output queue when epoll
+// reports it writable again, and epoll_wait sleeps no longer than the next
+// alarm of the loop's wheel
+static void *reactor_loop(void *arg)
+{
+	reactor_t *reactor = arg;
+	struct epoll_event events[MAX_EVENTS];
+
+	while (1)
+	{
+		int n = epoll_wait(reactor->epoll_fd, events, MAX_EVENTS, wheel_timeout(&reactor->wheel));
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("epoll_wait");
+			exit(1);
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			if (events[i].data.ptr == NULL)
+			{
+				accept_clients(reactor);
+			}
+			else
+			{
+				if (events[i].events & EPOLLOUT)
+				{
+					conn_output(events[i].data.ptr);
+				}
+				if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+				{
+					conn_input(events[i].data.ptr);
+				}
+			}
+		}
+		wheel_run(&reactor->wheel, wheel_now());
+	}
+	return NULL;
+}
+
+// start one event loop per listener, each filling its own shard of the game
+// table, and run the first one on the calling thread
+void run_reactors(int *listen_fds, int count)
+{
+	reactor_t *reactors = calloc(count, sizeof(reactor_t));
+	pthread_t thread;
+
+	lobby_init(count);
+	for (int i = 0; i < count; i++)
+	{
+		reactors[i].listen_fd = listen_fds[i];
+		reactors[i].shard = i;
+		wheel_init(&reactors[i].wheel);
+		reactors[i].epoll_fd = epoll_create1(0);
+		if (reactors[i].epoll_fd < 0)
+		{
+			perror("epoll_create1");
+			exit(1);
+		}
+
+		if (set_nonblocking(listen_fds[i]) < 0)
+		{
+			perror("fcntl");
+			exit(1);
+		}
+
+		// the listener is the only entry without a connection attached
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if (epoll_ctl(reactors[i].epoll_fd, EPOLL_CTL_ADD, listen_fds[i], &ev) < 0)
+		{
+			perror("epoll_ctl");
+			exit(1);
+		}
+	}
+
+	for (int i = 1; i < count; i++)
+	{
+		if (pthread_create(&thread, NULL, reactor_loop, &reactors[i]) != 0)
+		{
+			perror("pthread_create");
+			exit(1);
+		}
+		pthread_detach(thread);
+	}
+	reactor_loop(&reactors[0]);
+}
@@ -0,0 +1,39 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "protocol.h"
+#include "server.h"
+#include "wheel.h"
+
+// connection states, in the order a session moves through them
+#define CONN_NAME 0
+#define CONN_LOBBY 1
+#define CONN_GAME 2
+#define CONN_OVER 3
+
+// one client as an event loop sees it, the epoll and io_uring loops share
+// the session logic and only differ in how bytes get in and out
+typedef struct
+{
+	void *loop;
+	wheel_t *wheel;
+	alarm_t alarm;
+	int shard;
+	int fd;
+	int state;
+	int game_id;
+	player_t player;
+	msgbuf_t in;
+}
+conn_t;
+
+void conn_init(conn_t *conn, int fd, int shard);
+int conn_process(conn_t *conn, outbox_t *box);
+int conn_end(conn_t *conn, outbox_t *box);
+void conn_start(conn_t *conn, wheel_t *wheel, void (*fire)(alarm_t *alarm), void *ctx);
+int conn_alarm(conn_t *conn);
+
+void run_reactors(int *listen_fds, int count);
+int run_uring(int listen_fd);
+
+#endif // REACTOR_H
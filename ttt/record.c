@@ -0,0 +1,129 @@
+#include "record.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// collect the segments to read, a directory yields all of its segments in
+// the order they were written thanks to the zero-padded sequence numbers
+int record_open(record_reader_t *reader, const char *path)
+{
+	struct stat st;
+
+	memset(reader, 0, sizeof(*reader));
+	if (stat(path, &st) < 0)
+	{
+		perror(path);
+		return -1;
+	}
+
+	if (!S_ISDIR(st.st_mode))
+	{
+		reader->paths = malloc(sizeof(char *));
+		reader->paths[0] = strdup(path);
+		reader->num_paths = 1;
+		return 0;
+	}
+
+	char pattern[4096];
+	glob_t found;
+	snprintf(pattern, sizeof(pattern), "%s/" RECORD_PATTERN, path);
+	if (glob(pattern, 0, NULL, &found) != 0)
+	{
+		return 0;
+	}
+	reader->paths = malloc(found.gl_pathc * sizeof(char *));
+	for (size_t i = 0; i < found.gl_pathc; i++)
+	{
+		reader->paths[i] = strdup(found.gl_pathv[i]);
+	}
+	reader->num_paths = found.gl_pathc;
+	globfree(&found);
+	return 0;
+}
+
+static void record_unmap(record_reader_t *reader)
+{
+	if (reader->data != NULL)
+	{
+		munmap((void *) reader->data, reader->size);
+		reader->data = NULL;
+	}
+}
+
+// map the next segment read-only, the kernel reads ahead since every
+// segment is scanned front to back exactly once
+static int record_map(record_reader_t *reader)
+{
+	struct stat st;
+	const char *path = reader->paths[reader->next_path++];
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		perror(path);
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return -1;
+	}
+
+	reader->size = st.st_size;
+	reader->offset = 0;
+	if (reader->size > 0)
+	{
+		void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (base == MAP_FAILED)
+		{
+			perror(path);
+			close(fd);
+			return -1;
+		}
+		posix_madvise(base, st.st_size, POSIX_MADV_SEQUENTIAL);
+		reader->data = base;
+	}
+	close(fd);
+	return 0;
+}
+
+// the next record in write order, NULL after the last one
+const game_record_t *record_next(record_reader_t *reader)
+{
+	while (1)
+	{
+		if (reader->data != NULL && reader->offset + (long) sizeof(game_record_t) <= reader->size)
+		{
+			const game_record_t *rec = (const game_record_t *) (reader->data + reader->offset);
+			if (rec->magic == RECORD_MAGIC && rec->size >= RECORD_SIZE(rec->num_moves) && reader->offset + rec->size <= reader->size)
+			{
+				reader->offset += rec->size;
+				return rec;
+			}
+		}
+
+		// end of the segment, or the unwritten tail of one
+		record_unmap(reader);
+		if (reader->next_path == reader->num_paths)
+		{
+			return NULL;
+		}
+		record_map(reader);
+	}
+}
+
+void record_close(record_reader_t *reader)
+{
+	record_unmap(reader);
+	for (int i = 0; i < reader->num_paths; i++)
+	{
+		free(reader->paths[i]);
+	}
+	free(reader->paths);
+	reader->paths = NULL;
+	reader->num_paths = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+#include "board.h"
+
+#define RECORD_MAGIC 0x32525454     // "TTR2" read as little endian
+#define RECORD_NAME_LEN 20
+#define RECORD_SIZE(moves) ((sizeof(game_record_t) + (moves) + 7) & ~7UL)
+#define RECORD_MAX_SIZE RECORD_SIZE(BOARD_MAX_CELLS)
+#define RECORD_SEGMENT (64L << 20)  // bytes per segment file
+#define RECORD_PATTERN "games-*.log"
+#define RECORD_FORMAT "games-%06d.log"
+
+// outcomes
+#define RECORD_WIN 1
+#define RECORD_DRAW 2
+#define RECORD_RESIGN 3
+#define RECORD_ABANDONED 4
+#define RECORD_TIMEOUT 5
+
+// one finished game, a fixed header followed by the moves and padded to a
+// multiple of 8 bytes, so a segment is a plain run of records; a zero magic
+// marks where the writer stopped
+typedef struct
+{
+	uint32_t magic;
+	uint16_t size;              // header, moves and padding
+	uint8_t outcome;
+	uint8_t winner;             // 'X', 'O', or 0 for a draw
+	uint8_t width;
+	uint8_t height;
+	uint8_t k;
+	uint8_t num_moves;
+	uint32_t reserved;
+	int64_t started;            // unix time in milliseconds
+	int64_t finished;
+	char names[2][RECORD_NAME_LEN]; // X, then O
+	uint8_t moves[];            // cell indices in the order they were played, X first
+}
+game_record_t;
+
+// walks every record of a directory of segments, or of a single segment
+typedef struct
+{
+	char **paths;
+	int num_paths;
+	int next_path;
+	const char *data;
+	long size;
+	long offset;
+}
+record_reader_t;
+
+int record_open(record_reader_t *reader, const char *path);
+const game_record_t *record_next(record_reader_t *reader);
+void record_close(record_reader_t *reader);
+
+#endif // RECORD_H
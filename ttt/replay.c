@@ -0,0 +1,150 @@
+#include "record.h"
+#include "board.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *outcome_names[] = { "?", "win", "draw", "resign", "abandoned", "timeout" };
+
+static long now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+// play the recorded moves again, returns 0 when they are legal and agree
+// with the recorded outcome
+static int replay_game(const game_record_t *rec, board_t *board)
+{
+	int result = BOARD_CONTINUE;
+
+	// segments rarely mix shapes, only switch when the shape changes
+	if (rec->width != board_width() || rec->height != board_height() || rec->k != board_k())
+	{
+		if (board_configure(rec->width, rec->height, rec->k) < 0)
+		{
+			return -1;
+		}
+	}
+	board_init(board);
+	if (rec->outcome < RECORD_WIN || rec->outcome > RECORD_TIMEOUT || rec->num_moves > board_cells())
+	{
+		return -1;
+	}
+	for (int i = 0; i < rec->num_moves; i++)
+	{
+		if (result != BOARD_CONTINUE || rec->moves[i] >= board_cells() || !board_empty(board, rec->moves[i]))
+		{
+			return -1;
+		}
+		result = board_play(board, i % 2, rec->moves[i]);
+	}
+
+	if (rec->outcome == RECORD_WIN)
+	{
+		return (result == BOARD_WIN && rec->winner == (rec->num_moves % 2 ? 'X' : 'O')) ? 0 : -1;
+	}
+	if (rec->outcome == RECORD_DRAW && result == BOARD_DRAW)
+	{
+		return 0;
+	}
+	return (result == BOARD_CONTINUE) ? 0 : -1;
+}
+
+static void print_game(const game_record_t *rec, const board_t *board)
+{
+	char grid[BOARD_MAX_CELLS + 1];
+	char when[32];
+	struct tm tm;
+	time_t secs = rec->finished / 1000;
+
+	gmtime_r(&secs, &tm);
+	strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+	board_string(board, grid);
+	printf("%s.%03dZ %.*s %.*s %s %c %.3f %dx%dx%d %s",
+		when, (int) (rec->finished % 1000), RECORD_NAME_LEN, rec->names[0], RECORD_NAME_LEN, rec->names[1],
+		outcome_names[rec->outcome <= RECORD_TIMEOUT ? rec->outcome : 0], rec->winner ? rec->winner : '-',
+		(rec->finished - rec->started) / 1e3, rec->width, rec->height, rec->k, grid);
+	for (int i = 0; i < rec->num_moves; i++)
+	{
+		printf(" %d", rec->moves[i]);
+	}
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int print = 0;
+	long limit = -1;
+	long outcomes[RECORD_TIMEOUT + 1] = { 0 };
+	long x_wins = 0;
+	long total_moves = 0;
+	long total_ms = 0;
+	long count = 0;
+	long invalid = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "pn:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'p': print = 1; break;
+		case 'n': limit = atol(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-p] [-n count] record_dir|segment...\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind == argc)
+	{
+		fprintf(stderr, "Usage: %s [-p] [-n count] record_dir|segment...\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	long start = now_us();
+	for (int i = optind; i < argc && count != limit; i++)
+	{
+		record_reader_t reader;
+		const game_record_t *rec;
+		board_t board;
+
+		if (record_open(&reader, argv[i]) < 0)
+		{
+			exit(EXIT_FAILURE);
+		}
+		while (count != limit && (rec = record_next(&reader)) != NULL)
+		{
+			count++;
+			if (replay_game(rec, &board) < 0)
+			{
+				invalid++;
+				continue;
+			}
+			outcomes[rec->outcome]++;
+			x_wins += (rec->winner == 'X');
+			total_moves += rec->num_moves;
+			total_ms += rec->finished - rec->started;
+			if (print)
+			{
+				print_game(rec, &board);
+			}
+		}
+		record_close(&reader);
+	}
+	long elapsed = now_us() - start;
+
+	// the summary goes to stderr so -p output stays a clean stream of games
+	long valid = count - invalid;
+	fprintf(stderr, "%ld records in %.3f s: %.0f records/s\n", count, elapsed / 1e6, elapsed > 0 ? count * 1e6 / elapsed : 0.0);
+	fprintf(stderr, "win %ld draw %ld resign %ld abandoned %ld timeout %ld invalid %ld\n",
+		outcomes[RECORD_WIN], outcomes[RECORD_DRAW], outcomes[RECORD_RESIGN], outcomes[RECORD_ABANDONED], outcomes[RECORD_TIMEOUT], invalid);
+	if (valid > 0)
+	{
+		fprintf(stderr, "X won %.1f%%, %.2f moves and %.3f s per game\n",
+			x_wins * 100.0 / valid, (double) total_moves / valid, total_ms / 1e3 / valid);
+	}
+	return invalid > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
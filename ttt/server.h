@@ -0,0 +1,78 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "board.h"
+#include "mailbox.h"
+#include "outq.h"
+#include "watch.h"
+
+#define PORT 5000
+#define GAME_CHUNK 1024
+#define MAX_GAME_CHUNKS 1024
+#define MAX_GAMES (GAME_CHUNK * MAX_GAME_CHUNKS)
+#define MAX_NAME_LEN 20
+
+// game status
+#define GAME_WAITING 0
+#define GAME_ACTIVE 1
+#define GAME_OVER 2
+#define GAME_FREE 3
+
+typedef struct
+{
+	char name[MAX_NAME_LEN];
+	char role;
+	int sock_fd;
+	int framing;                // FRAME_LINE, FRAME_PIPE or FRAME_BINARY
+	outq_t *out;
+	int resume;                 // game whose seat login claimed back, or -1
+}
+player_t;
+
+// besides status, joined, finished, watch_request, move_deadline and the
+// resume fields, a game is only touched by whichever thread is draining its
+// mailbox, or under its shard's lock before it is shared
+typedef struct
+{
+	player_t players[2];
+	atomic_int status;
+	mailbox_t mailbox;
+	board_t board;
+	unsigned char moves[BOARD_MAX_CELLS];
+	int num_moves;
+	int current_turn;
+	int house;
+	feed_t *feed;               // set while spectators watch
+	_Atomic(feed_t *) watch_request;
+	long started;
+	long waiting_since;
+	atomic_long move_deadline[2]; // wheel_now() ms, 0 while off the move
+	int draw_offer;             // seat with a draw offer standing, or -1
+	unsigned long secret[2];    // the secret half of each seat's resume token
+	// while a seat's connection is gone: its secret, until a reconnect or
+	// the seat's release claims it, and the end of its grace window
+	atomic_ulong resume_secret[2];
+	atomic_long resume_deadline[2];
+	long ticket;
+	atomic_int joined;
+	atomic_int finished;
+	int lobby_prev;
+	int lobby_next;
+}
+game_t;
+
+game_t *get_game(int game_id);
+
+int login(player_t *player, outbox_t *box, char *buf);
+void logout(player_t *player);
+int join_game(int shard, player_t *player, outbox_t *box);
+int play_msg(int game_id, player_t *player, outbox_t *box, char *msg, int len);
+void leave_game(int game_id, player_t *player, outbox_t *box);
+long session_opened(long now);
+void session_timeouts(long handshake, long lobby, long move, long resume);
+void server_setup();
+long session_alarm(int game_id, player_t *player, long now);
+
+#endif // SERVER_H
@@ -0,0 +1,1905 @@
+#include "protocol.h"
+#include "codec.h"
+#include "server.h"
+#include "reactor.h"
+#include "board.h"
+#include "lobby.h"
+#include "names.h"
+#include "house.h"
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define MAX_CLIENTS 256
+#define FD_BASE 1000000             // made-up descriptors, far above any real one
+#define NET_DELAY 200000            // ns, the longest a segment or a send completion takes
+#define THINK 3000000               // ns, how long a client usually takes to act
+#define START_CLOCK 1000000000000L  // ns, clear of 0, which the wheel and the game clocks read as never
+#define MAX_TIME 3600000000000L     // ns of simulated time one seed may take
+
+// session timeouts in milliseconds, short so every seed runs into them
+#define HANDSHAKE_MS 1000
+#define LOBBY_MS 3000
+#define MOVE_MS 2000
+#define RESUME_MS 1000
+
+// client states
+#define C_OFF 0         // not connected
+#define C_NAME 1        // sent its name or its token, nothing back yet
+#define C_WAIT 2        // in the lobby
+#define C_PLAY 3
+#define C_DONE 4        // its game ended, the server hangs up next
+
+// what a playing client still waits to hear about
+#define P_NONE 0
+#define P_MOVE 1        // a move it holds legal, answered by its MOVD or an OVER
+#define P_ANY 2         // a request the server may refuse, or take if the opponent moved meanwhile
+#define P_END 3         // a resignation, answered by an OVER
+
+// one simulated player, and the server's end of its connection
+typedef struct
+{
+	int id;
+	int state;
+	int framing;
+	int open;                   // its end of the socket is open
+	int stalled;                // connected without ever sending a name
+	char name[MAX_NAME_LEN];
+	long wake;                  // when it acts next, 0 for once something arrives
+	long due;                   // the earliest of wake, tx_at and sent_at
+	int slot;                   // its place in the schedule, -1 for nothing due
+
+	// the game as the client has seen it
+	char role;
+	char turn;
+	char peer[MAX_NAME_LEN];
+	char grid[BOARD_MAX_CELLS + 1];
+	board_t board;
+	int pending;
+	int pending_cell;
+	unsigned char seq;
+	int offered;                // the opponent has a draw offer standing
+	char token[RESUME_TOKEN_LEN + 1];
+	int resume;                 // walked away from a live game and may take the seat back
+	char outcome;               // of its last game, until the opponent's OVER is matched with it
+	char outcome_peer[MAX_NAME_LEN];
+
+	// the server's side
+	int connected;
+	conn_t conn;
+	int hangup;                 // the server shut the socket down
+	char tx[MSGBUF_SIZE];       // written by the client, not yet read by the server
+	int tx_len;
+	long tx_at;                 // the server's next read, 0 for none
+	outq_t *sending;            // the queue with a send in flight, and the send
+	const char *sent;
+	int sent_len;
+	long sent_at;
+	msgbuf_t rx;
+
+	// a scenario's clients keep every line they read for the script to check
+	char log[4096];
+	int log_len;
+	int log_pos;
+}
+client_t;
+
+// one finished seed, handed from the child that ran it to the parent
+typedef struct
+{
+	long games;
+	long events;
+	double seconds;
+	uint64_t hash;
+	int failed;
+}
+result_t;
+
+long sim_clock;
+
+static client_t clients[MAX_CLIENTS];
+static client_t *schedule[MAX_CLIENTS];     // min-heap of the clients with something due
+static int num_scheduled;
+static int num_clients = 16;
+static long target_games = 1000;
+static int house_ok = 0;
+static int verbose = 0;
+static int scripted = 0;        // a scenario: no delays and no will of their own
+static wheel_t wheel;
+static uint64_t rng;
+static uint64_t trace_hash;
+static long games;
+static char failure[256];
+
+// every output queue the simulation opened, held so the last reference can be checked
+static outq_t **held;
+static int num_held;
+static int held_size;
+
+// splitmix64, everything a seed decides comes from here
+static uint64_t next_random()
+{
+	uint64_t z = (rng += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static long pick(long n)
+{
+	return (long) (next_random() % (uint64_t) n);
+}
+
+static int chance(int percent)
+{
+	return pick(100) < percent;
+}
+
+// the server's resume secrets
+void sim_random(void *buf, size_t len)
+{
+	unsigned char *p = buf;
+
+	while (len > 0)
+	{
+		uint64_t r = next_random();
+		size_t n = (len < sizeof(r)) ? len : sizeof(r);
+		memcpy(p, &r, n);
+		p += n;
+		len -= n;
+	}
+}
+
+static long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static long net_delay()
+{
+	return scripted ? 0 : 1 + pick(NET_DELAY);
+}
+
+// mostly quick, now and then slow enough to lose on time
+static long think()
+{
+	if (chance(1))
+	{
+		return 1 + pick(3L * MOVE_MS * 1000000);
+	}
+	if (chance(9))
+	{
+		return 1 + pick(MOVE_MS / 2 * 1000000L);
+	}
+	return 1 + pick(THINK);
+}
+
+static void fail(client_t *c, const char *fmt, ...)
+{
+	va_list ap;
+	long t = sim_clock - START_CLOCK;
+
+	if (failure[0] != '\0')
+	{
+		return;
+	}
+	int len = snprintf(failure, sizeof(failure), "%ld.%06ld %s: ", t / 1000000000, t / 1000 % 1000000, c != NULL ? c->name : "sim");
+	va_start(ap, fmt);
+	vsnprintf(failure + len, sizeof(failure) - len, fmt, ap);
+	va_end(ap);
+}
+
+static void hash_bytes(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	// FNV-1a
+	for (size_t i = 0; i < len; i++)
+	{
+		trace_hash ^= p[i];
+		trace_hash *= 0x100000001b3ULL;
+	}
+}
+
+// everything that happens goes into the seed's hash, which a replay must
+// reproduce, and with -v into the transcript
+static void trace(client_t *c, const char *what, const char *data, int len)
+{
+	long t = sim_clock - START_CLOCK;
+
+	hash_bytes(&sim_clock, sizeof(sim_clock));
+	hash_bytes(&c->id, sizeof(c->id));
+	hash_bytes(what, strlen(what));
+	hash_bytes(data, len);
+	if (!verbose)
+	{
+		return;
+	}
+	printf("%ld.%06ld %-6s %s ", t / 1000000000, t / 1000 % 1000000, c->name, what);
+	for (int i = 0; i < len; i++)
+	{
+		unsigned char ch = data[i];
+		if (ch == '\n' && i == len - 1)
+		{
+			break;
+		}
+		if (ch >= 0x20 && ch < 0x7f)
+		{
+			putchar(ch);
+		}
+		else
+		{
+			printf("\\x%02x", ch);
+		}
+	}
+	putchar('\n');
+}
+
+static client_t *find_client(const char *name)
+{
+	for (int i = 0; i < num_clients; i++)
+	{
+		if (strcmp(clients[i].name, name) == 0)
+		{
+			return &clients[i];
+		}
+	}
+	return NULL;
+}
+
+// ---- the schedule ----
+
+// a client goes before another due at the same time if its id is lower, the
+// order a replay depends on
+static int sooner(const client_t *a, const client_t *b)
+{
+	return a->due < b->due || (a->due == b->due && a->id < b->id);
+}
+
+static void place(client_t *c, int i)
+{
+	schedule[i] = c;
+	c->slot = i;
+}
+
+static void sift_up(client_t *c, int i)
+{
+	while (i > 0 && sooner(c, schedule[(i - 1) / 2]))
+	{
+		place(schedule[(i - 1) / 2], i);
+		i = (i - 1) / 2;
+	}
+	place(c, i);
+}
+
+static void sift_down(client_t *c, int i)
+{
+	for (;;)
+	{
+		int child = 2 * i + 1;
+		if (child >= num_scheduled)
+		{
+			break;
+		}
+		if (child + 1 < num_scheduled && sooner(schedule[child + 1], schedule[child]))
+		{
+			child++;
+		}
+		if (!sooner(schedule[child], c))
+		{
+			break;
+		}
+		place(schedule[child], i);
+		i = child;
+	}
+	place(c, i);
+}
+
+// put a client where its times now say it belongs, after any of them changed
+static void reschedule(client_t *c)
+{
+	long times[3] = { c->wake, c->tx_at, c->sent_at };
+
+	c->due = 0;
+	for (int k = 0; k < 3; k++)
+	{
+		if (times[k] != 0 && (c->due == 0 || times[k] < c->due))
+		{
+			c->due = times[k];
+		}
+	}
+
+	int i = c->slot;
+	if (c->due == 0)
+	{
+		if (i != -1)
+		{
+			client_t *last = schedule[--num_scheduled];
+			c->slot = -1;
+			if (last != c)
+			{
+				sift_up(last, i);
+				sift_down(last, last->slot);
+			}
+		}
+		return;
+	}
+	if (i == -1)
+	{
+		sift_up(c, num_scheduled++);
+		return;
+	}
+	sift_up(c, i);
+	sift_down(c, c->slot);
+}
+
+// take a reference of our own on a new session's queue; a queue only that
+// reference still holds after its session closed is done with and let go
+static void hold(outq_t *q)
+{
+	if (num_held == held_size)
+	{
+		int n = 0;
+		for (int i = 0; i < num_held; i++)
+		{
+			if (held[i]->refs == 1 && held[i]->fd == -1)
+			{
+				outq_put(held[i]);
+			}
+			else
+			{
+				held[n++] = held[i];
+			}
+		}
+		num_held = n;
+		if (num_held >= held_size / 2)
+		{
+			held_size = held_size ? held_size * 2 : 1024;
+			held = realloc(held, held_size * sizeof(outq_t *));
+		}
+	}
+	outq_hold(q);
+	held[num_held++] = q;
+}
+
+// ---- the network between the clients and the server ----
+
+static void client_eof(client_t *c);
+static void client_read(client_t *c, const char *data, int len);
+
+// the kernel's half of an asynchronous send: the bytes reach the client a
+// little later, and maybe only some of them
+static void sim_submit(outq_t *q, const char *data, unsigned int len)
+{
+	client_t *c = q->ctx;
+	c->sending = q;
+	c->sent = data;
+	c->sent_len = len;
+	c->sent_at = sim_clock + net_delay();
+	reschedule(c);
+}
+
+// shutdown() on the socket, the server's next read returns 0
+static void sim_hangup(outq_t *q)
+{
+	client_t *c = q->ctx;
+	c->hangup = 1;
+	if (c->tx_at == 0)
+	{
+		c->tx_at = sim_clock + net_delay();
+	}
+	reschedule(c);
+}
+
+// the client learns its connection is gone once the last byte sent on it arrived
+static void sim_eof(client_t *c)
+{
+	if (c->open && !c->connected && c->sending == NULL)
+	{
+		client_eof(c);
+	}
+}
+
+// the event loop ends the session and closes the socket
+static void sim_close(client_t *c, outbox_t *box)
+{
+	conn_end(&c->conn, box);
+	c->connected = 0;
+	c->hangup = 0;
+	c->tx_len = 0;
+	c->tx_at = 0;
+	reschedule(c);
+	trace(c, "closed by the server", NULL, 0);
+	sim_eof(c);
+}
+
+static void sim_expired(alarm_t *alarm)
+{
+	client_t *c = alarm->ctx;
+	outbox_t box;
+
+	if (conn_alarm(&c->conn) < 0)
+	{
+		outbox_init(&box);
+		sim_close(c, &box);
+	}
+}
+
+// one read by the server: some of what the client wrote, or 0 bytes once
+// the client closed its end or the server shut the socket down
+static void server_read(client_t *c)
+{
+	outbox_t box;
+
+	outbox_init(&box);
+	c->tx_at = 0;
+	reschedule(c);
+	if (c->hangup || c->tx_len == 0)
+	{
+		sim_close(c, &box);
+		return;
+	}
+
+	int n = (scripted || chance(70)) ? c->tx_len : 1 + pick(c->tx_len);
+	n = msgbuf_put(&c->conn.in, c->tx, n);
+	memmove(c->tx, c->tx + n, c->tx_len - n);
+	c->tx_len -= n;
+	if (c->tx_len > 0 || !c->open)
+	{
+		c->tx_at = sim_clock + net_delay();
+		reschedule(c);
+	}
+	if (conn_process(&c->conn, &box) < 0)
+	{
+		sim_close(c, &box);
+		return;
+	}
+	outbox_flush(&box);
+}
+
+// a send completes, what went out reaches the client unless it hung up; a
+// short send leaves the rest for the queue to send again, which only a
+// session still open does
+static void send_done(client_t *c)
+{
+	outq_t *q = c->sending;
+	int n = (scripted || chance(80)) ? c->sent_len : 1 + pick(c->sent_len);
+
+	c->sending = NULL;
+	c->sent_at = 0;
+	reschedule(c);
+	if (c->open)
+	{
+		client_read(c, c->sent, n);
+	}
+	outq_sent(q, n);
+	sim_eof(c);
+}
+
+// ---- the clients ----
+
+static void client_write(client_t *c, const char *data, int len)
+{
+	trace(c, ">", data, len);
+	if (!c->connected)
+	{
+		// the server already closed, the bytes go nowhere
+		return;
+	}
+	if (c->tx_len + len > (int) sizeof(c->tx))
+	{
+		fail(c, "the server stopped reading");
+		return;
+	}
+	memcpy(c->tx + c->tx_len, data, len);
+	c->tx_len += len;
+	if (c->tx_at == 0)
+	{
+		c->tx_at = sim_clock + net_delay();
+		reschedule(c);
+	}
+}
+
+static void client_send(client_t *c, const message_t *msg)
+{
+	char frame[CODEC_MAX_FRAME];
+	int len = codec_encode(c->framing, msg, frame, sizeof(frame));
+
+	if (len > 0)
+	{
+		client_write(c, frame, len);
+	}
+}
+
+// a request in all three framings, the text one built from fields and the
+// binary one from the payload
+static void send_request(client_t *c, int op, const char *field, int field_len)
+{
+	message_t msg;
+
+	message_init(&msg, op);
+	if (field_len > 0)
+	{
+		message_field(&msg, field, field_len);
+	}
+	message_payload(&msg, field, field_len);
+	client_send(c, &msg);
+}
+
+static void send_move(client_t *c, char role, int row, int col)
+{
+	message_t msg;
+	char pos[16];
+	char payload[2] = { row * board_width() + col, c->seq++ };
+
+	message_init(&msg, OP_MOVE);
+	message_field(&msg, &role, 1);
+	message_field(&msg, pos, snprintf(pos, sizeof(pos), "%d,%d", row + 1, col + 1));
+	message_payload(&msg, payload, 2);
+	client_send(c, &msg);
+}
+
+// the name, or the resume token, that opens a session
+static void client_hello(client_t *c)
+{
+	char buf[64];
+	int len;
+
+	if (c->resume)
+	{
+		len = (c->framing == FRAME_PIPE) ? snprintf(buf, sizeof(buf), "RSUM|%d|%s|", RESUME_TOKEN_LEN + 1, c->token)
+			: snprintf(buf, sizeof(buf), "%s%s%s\n", RESUME_HANDSHAKE, (c->framing == FRAME_BINARY) ? "BIN " : "", c->token);
+	}
+	else
+	{
+		// an opponent that dropped out of the last game may never read its OVER
+		c->outcome = 0;
+		len = (c->framing == FRAME_PIPE) ? snprintf(buf, sizeof(buf), "PLAY|%d|%s|", (int) strlen(c->name) + 1, c->name)
+			: snprintf(buf, sizeof(buf), "%s%s\n", (c->framing == FRAME_BINARY) ? BIN_HANDSHAKE : "", c->name);
+	}
+	client_write(c, buf, len);
+}
+
+// the server accepts a connection: a session of the reactor's kind, whose
+// sends complete through sim_submit()
+static void client_open(client_t *c)
+{
+	c->open = 1;
+	c->connected = 1;
+	c->hangup = 0;
+	c->stalled = 0;
+	c->tx_len = 0;
+	c->tx_at = 0;
+	reschedule(c);
+	c->state = C_NAME;
+	msgbuf_init(&c->rx, c->framing);
+	conn_init(&c->conn, FD_BASE + c->id, 0);
+	c->conn.player.out->submit = sim_submit;
+	c->conn.player.out->hangup = sim_hangup;
+	c->conn.player.out->ctx = c;
+	hold(c->conn.player.out);
+	conn_start(&c->conn, &wheel, sim_expired, c);
+	trace(c, "connects", NULL, 0);
+}
+
+static void client_close(client_t *c)
+{
+	trace(c, "closes", NULL, 0);
+	c->open = 0;
+	c->resume = (c->state == C_PLAY && c->token[0] != '\0');
+	c->state = C_OFF;
+	if (c->connected && c->tx_at == 0)
+	{
+		c->tx_at = sim_clock + net_delay();
+	}
+	c->wake = scripted ? 0 : sim_clock + think();
+	reschedule(c);
+}
+
+static void client_eof(client_t *c)
+{
+	trace(c, "sees the connection closed", NULL, 0);
+	if (c->state == C_PLAY)
+	{
+		fail(c, "connection closed mid-game without an OVER");
+	}
+	else if (c->state == C_WAIT)
+	{
+		fail(c, "connection closed in the lobby without an INVL");
+	}
+	else if (c->state == C_NAME && !c->stalled)
+	{
+		fail(c, "connection closed before any answer to the handshake");
+	}
+	c->open = 0;
+	c->resume = 0;
+	c->state = C_OFF;
+	c->wake = scripted ? 0 : sim_clock + think();
+	reschedule(c);
+}
+
+static void start_game(client_t *c, char role, const char *peer, int peer_len)
+{
+	c->state = C_PLAY;
+	c->role = role;
+	c->turn = 'X';
+	snprintf(c->peer, sizeof(c->peer), "%.*s", peer_len, peer);
+	board_init(&c->board);
+	memset(c->grid, '.', board_cells());
+	c->grid[board_cells()] = '\0';
+	c->pending = P_NONE;
+	c->offered = 0;
+	c->token[0] = '\0';
+	c->resume = 0;
+}
+
+// a resumed seat takes the game as SNAP tells it
+static void restore_game(client_t *c, char role, char turn, char draw, const char *grid)
+{
+	if (role != c->role)
+	{
+		fail(c, "SNAP gives back role %c instead of %c", role, c->role);
+	}
+	c->state = C_PLAY;
+	c->turn = turn;
+	c->offered = (draw != '-' && draw != c->role);
+	c->pending = P_NONE;
+	c->resume = 0;
+	memcpy(c->grid, grid, board_cells());
+	board_init(&c->board);
+	for (int i = 0; i < board_cells(); i++)
+	{
+		if (grid[i] != '.')
+		{
+			board_play(&c->board, grid[i] == 'O', i);
+		}
+	}
+}
+
+// whichever of the two players reads its OVER second checks it against the
+// first one's: one won and one lost, or both drew
+static void match_outcome(client_t *c, char outcome)
+{
+	client_t *peer = find_client(c->peer);
+
+	if (peer != NULL && peer->outcome != 0 && strcmp(peer->outcome_peer, c->name) == 0)
+	{
+		char want = (outcome == 'W') ? 'L' : (outcome == 'L') ? 'W' : 'D';
+		if (peer->outcome != want)
+		{
+			fail(c, "OVER %c, but %s got OVER %c", outcome, peer->name, peer->outcome);
+		}
+		peer->outcome = 0;
+		return;
+	}
+	c->outcome = outcome;
+	strcpy(c->outcome_peer, c->peer);
+}
+
+// one server message, normalised across the framings
+typedef struct
+{
+	int op;
+	char role;                  // BEGN, MOVD and SNAP
+	char arg;                   // DRAW's kind, OVER's outcome, SNAP's role to move
+	char draw;                  // SNAP's role with a draw offer standing, or '-'
+	int cell;                   // MOVD
+	const char *grid;           // MOVD, SNAP and OVER, NULL when left out
+	const char *text;           // a name, INVL's reason, TOKN's token
+	int text_len;
+}
+reply_t;
+
+static const struct
+{
+	const char *type;
+	int op;
+}
+reply_types[] = {
+	{ "WAIT", OP_WAIT }, { "BEGN", OP_BEGN }, { "MOVD", OP_MOVD }, { "INVL", OP_INVL },
+	{ "DRAW", OP_DRAW_OFFER }, { "OVER", OP_OVER }, { "GONE", OP_GONE }, { "TOKN", OP_TOKN },
+	{ "SNAP", OP_SNAP },
+};
+
+static int is_grid(const char *s, int len)
+{
+	if (len != board_cells())
+	{
+		return 0;
+	}
+	for (int i = 0; i < len; i++)
+	{
+		if (s[i] != 'X' && s[i] != 'O' && s[i] != '.')
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int decode_binary(const message_t *msg, reply_t *r)
+{
+	const char *p = msg->payload;
+	int len = msg->payload_len;
+	int cells = board_cells();
+
+	r->op = msg->op;
+	switch (msg->op)
+	{
+	case OP_WAIT:
+		return (len == 0) ? 0 : -1;
+	case OP_BEGN:
+		r->role = p[0];
+		r->text = p + 1;
+		r->text_len = strnlen(p + 1, len - 1);
+		return (len >= 2) ? 0 : -1;
+	case OP_MOVD:
+		r->role = p[0];
+		r->cell = (unsigned char) p[1];
+		r->grid = p + 3;
+		return (len == 3 + cells && is_grid(r->grid, cells)) ? 0 : -1;
+	case OP_INVL:
+	case OP_GONE:
+	case OP_TOKN:
+		r->text = p;
+		r->text_len = len;
+		return 0;
+	case OP_DRAW_OFFER:
+		r->arg = p[0];
+		return (len == 1) ? 0 : -1;
+	case OP_OVER:
+		r->arg = p[0];
+		r->grid = p + 1;
+		r->text = p + 1 + cells;
+		r->text_len = len - 1 - cells;
+		return (len >= 1 + cells && is_grid(r->grid, cells)) ? 0 : -1;
+	case OP_SNAP:
+		r->role = p[0];
+		r->arg = p[1];
+		r->draw = p[2];
+		r->grid = p + 6;
+		r->text = p + 6 + cells;
+		r->text_len = len - 6 - cells;
+		return (len >= 6 + cells && is_grid(r->grid, cells)) ? 0 : -1;
+	}
+	return -1;
+}
+
+static int decode_text(const message_t *msg, reply_t *r)
+{
+	const char *const *f = msg->fields;
+	const int *lens = msg->lens;
+	int n = msg->num_fields;
+
+	r->op = 0;
+	for (unsigned int i = 0; i < sizeof(reply_types) / sizeof(reply_types[0]); i++)
+	{
+		if (memcmp(msg->type, reply_types[i].type, 4) == 0)
+		{
+			r->op = reply_types[i].op;
+		}
+	}
+	switch (r->op)
+	{
+	case OP_WAIT:
+		return (n == 0) ? 0 : -1;
+	case OP_BEGN:
+		if (n < 2 || lens[0] != 1)
+		{
+			return -1;
+		}
+		r->role = f[0][0];
+		r->text = f[1];
+		r->text_len = lens[1];
+		return 0;
+	case OP_MOVD:
+		if (n != 3 || lens[0] != 1 || !is_grid(f[2], lens[2]))
+		{
+			return -1;
+		}
+		r->role = f[0][0];
+		r->cell = parse_cell(f[1], lens[1], board_width(), board_height());
+		r->grid = f[2];
+		return (r->cell < 0) ? -1 : 0;
+	case OP_INVL:
+		if (n < 1)
+		{
+			return -1;
+		}
+		// a text reason is every field, the pipe framing's only one
+		r->text = f[0];
+		r->text_len = f[n - 1] + lens[n - 1] - f[0];
+		return 0;
+	case OP_DRAW_OFFER:
+		r->arg = f[0][0];
+		return (n == 1 && lens[0] == 1) ? 0 : -1;
+	case OP_OVER:
+		if (n < 2 || lens[0] != 1)
+		{
+			return -1;
+		}
+		r->arg = f[0][0];
+		r->text = f[1];
+		r->text_len = lens[1];
+		if (n >= 3 && is_grid(f[n - 1], lens[n - 1]))
+		{
+			r->grid = f[n - 1];
+		}
+		return 0;
+	case OP_GONE:
+	case OP_TOKN:
+		r->text = f[0];
+		r->text_len = lens[0];
+		return (n == 1) ? 0 : -1;
+	case OP_SNAP:
+		if (n < 5 || lens[0] != 1 || lens[1] != 1 || lens[2] != 1 || !is_grid(f[3], lens[3]))
+		{
+			return -1;
+		}
+		r->role = f[0][0];
+		r->arg = f[1][0];
+		r->draw = f[2][0];
+		r->grid = f[3];
+		r->text = f[4];
+		r->text_len = lens[4];
+		return 0;
+	}
+	return -1;
+}
+
+static int decode_reply(int framing, const char *frame, int len, reply_t *r)
+{
+	message_t msg;
+
+	memset(r, 0, sizeof(*r));
+	if (framing == FRAME_LINE && len > 21 && strncmp(frame, "Player ", 7) == 0 && strcmp(frame + len - 14, " disconnected.") == 0)
+	{
+		// a text GONE is still the sentence it always was
+		r->op = OP_GONE;
+		r->text = frame + 7;
+		r->text_len = len - 21;
+		return 0;
+	}
+	if (codec_decode(framing, frame, len, &msg) < 0)
+	{
+		return -1;
+	}
+	return (framing == FRAME_BINARY) ? decode_binary(&msg, r) : decode_text(&msg, r);
+}
+
+static int same_text(const reply_t *r, const char *s)
+{
+	return r->text_len == (int) strlen(s) && memcmp(r->text, s, r->text_len) == 0;
+}
+
+static const char *state_name(int state)
+{
+	static const char *const names[] = { "off", "name", "lobby", "game", "done" };
+	return names[state];
+}
+
+static void on_movd(client_t *c, const reply_t *r)
+{
+	if (r->role != c->turn)
+	{
+		fail(c, "MOVD for %c on %c's turn", r->role, c->turn);
+		return;
+	}
+	if (r->cell >= board_cells() || !board_empty(&c->board, r->cell))
+	{
+		fail(c, "MOVD onto taken cell %d", r->cell);
+		return;
+	}
+	if (board_play(&c->board, r->role == 'O', r->cell) != BOARD_CONTINUE)
+	{
+		fail(c, "MOVD for a move that ended the game");
+	}
+	c->grid[r->cell] = r->role;
+	if (memcmp(r->grid, c->grid, board_cells()) != 0)
+	{
+		fail(c, "MOVD board %.*s, expected %s", board_cells(), r->grid, c->grid);
+	}
+	if (r->role == c->role)
+	{
+		if (!scripted && ((c->pending != P_MOVE && c->pending != P_ANY) || c->pending_cell != r->cell))
+		{
+			fail(c, "MOVD for a move it never sent");
+		}
+		c->pending = P_NONE;
+	}
+	c->turn = (r->role == 'X') ? 'O' : 'X';
+	c->offered = 0;
+}
+
+static void on_invl(client_t *c, const reply_t *r)
+{
+	switch (c->state)
+	{
+	case C_NAME:
+		// name taken, no seat to resume, or the game it left is over
+		c->state = C_DONE;
+		break;
+	case C_WAIT:
+		if (!same_text(r, "No opponent found"))
+		{
+			fail(c, "INVL %.*s in the lobby", r->text_len, r->text);
+		}
+		c->state = C_DONE;
+		break;
+	case C_PLAY:
+		if (!scripted && c->pending != P_ANY)
+		{
+			fail(c, "INVL %.*s for a legal request", r->text_len, r->text);
+		}
+		c->pending = P_NONE;
+		break;
+	default:
+		if (!same_text(r, "Game is over"))
+		{
+			fail(c, "INVL %.*s after its game ended", r->text_len, r->text);
+		}
+		break;
+	}
+}
+
+static void on_over(client_t *c, const reply_t *r)
+{
+	int cells = board_cells();
+	int changed = -1;
+
+	if (r->arg != 'W' && r->arg != 'L' && r->arg != 'D')
+	{
+		fail(c, "OVER with outcome %c", r->arg);
+		return;
+	}
+	if (r->grid != NULL)
+	{
+		// the final board is the one the client saw, or one move on from
+		// it when that move ended the game
+		for (int i = 0; i < cells; i++)
+		{
+			if (r->grid[i] != c->grid[i] && (c->grid[i] != '.' || changed != -1))
+			{
+				fail(c, "OVER board %.*s does not follow %s", cells, r->grid, c->grid);
+				return;
+			}
+			if (r->grid[i] != c->grid[i])
+			{
+				changed = i;
+			}
+		}
+	}
+	if (changed != -1)
+	{
+		char mover = r->grid[changed];
+		int result = (mover == c->turn) ? board_play(&c->board, mover == 'O', changed) : BOARD_CONTINUE;
+		char want = (result == BOARD_DRAW) ? 'D' : (mover == c->role) ? 'W' : 'L';
+		if (result == BOARD_CONTINUE || r->arg != want)
+		{
+			fail(c, "OVER %c does not follow from the last move %c at %d", r->arg, mover, changed);
+		}
+		c->grid[changed] = mover;
+	}
+	c->state = C_DONE;
+	c->pending = P_NONE;
+	match_outcome(c, r->arg);
+}
+
+// check one message against what the client knows, and move it along
+static void client_msg(client_t *c, char *frame, int len)
+{
+	reply_t r;
+	int expected;
+
+	trace(c, "<", frame, len);
+	if (scripted && c->log_len + len + 1 <= (int) sizeof(c->log))
+	{
+		memcpy(c->log + c->log_len, frame, len);
+		c->log_len += len;
+		c->log[c->log_len++] = '\n';
+	}
+	if (decode_reply(c->framing, frame, len, &r) < 0)
+	{
+		fail(c, "undecodable reply");
+		return;
+	}
+
+	switch (r.op)
+	{
+	case OP_WAIT:
+		expected = (c->state == C_NAME);
+		c->state = C_WAIT;
+		break;
+	case OP_BEGN:
+		expected = (c->state == C_NAME || c->state == C_WAIT) && (r.role == 'X' || r.role == 'O');
+		start_game(c, r.role, r.text, r.text_len);
+		games += (r.role == 'X');
+		break;
+	case OP_TOKN:
+		expected = (c->state == C_PLAY && r.text_len == RESUME_TOKEN_LEN);
+		snprintf(c->token, sizeof(c->token), "%.*s", r.text_len, r.text);
+		break;
+	case OP_SNAP:
+		expected = (c->state == C_NAME && c->resume && (r.arg == 'X' || r.arg == 'O'));
+		restore_game(c, r.role, r.arg, r.draw, r.grid);
+		break;
+	case OP_MOVD:
+		expected = (c->state == C_PLAY);
+		if (expected)
+		{
+			on_movd(c, &r);
+		}
+		break;
+	case OP_INVL:
+		expected = 1;
+		on_invl(c, &r);
+		break;
+	case OP_DRAW_OFFER:
+		expected = (c->state == C_PLAY && (r.arg == 'S' || r.arg == 'R'));
+		c->offered = (r.arg == 'S');
+		break;
+	case OP_OVER:
+		expected = (c->state == C_PLAY);
+		if (expected)
+		{
+			on_over(c, &r);
+		}
+		break;
+	case OP_GONE:
+		expected = (c->state == C_PLAY && same_text(&r, c->peer));
+		c->state = C_DONE;
+		c->pending = P_NONE;
+		break;
+	default:
+		expected = 0;
+		break;
+	}
+	if (!expected)
+	{
+		fail(c, "unexpected %.*s in state %s", len, frame, state_name(c->state));
+	}
+	if (!scripted && c->state != C_OFF)
+	{
+		long wake = sim_clock + think();
+		c->wake = (c->wake == 0 || wake < c->wake) ? wake : c->wake;
+		reschedule(c);
+	}
+}
+
+// bytes arriving on the client's socket, cut into messages as they complete
+static void client_read(client_t *c, const char *data, int len)
+{
+	char frame[MAX_MSG_LEN];
+
+	while (len > 0)
+	{
+		int n = msgbuf_put(&c->rx, data, len);
+		int frame_len;
+		data += n;
+		len -= n;
+		while ((frame_len = msgbuf_next(&c->rx, frame, sizeof(frame))) != 0)
+		{
+			if (frame_len < 0)
+			{
+				fail(c, "malformed frame from the server");
+				return;
+			}
+			client_msg(c, frame, frame_len);
+		}
+	}
+}
+
+static int random_cell(client_t *c, int taken)
+{
+	int count = 0;
+
+	for (int i = 0; i < board_cells(); i++)
+	{
+		count += ((c->grid[i] == '.') != taken);
+	}
+	if (count == 0)
+	{
+		return -1;
+	}
+	int n = pick(count);
+	for (int i = 0; i < board_cells(); i++)
+	{
+		if (((c->grid[i] == '.') != taken) && n-- == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// one of the malformed or out of place requests ttt/testing lists
+static void send_bad(client_t *c)
+{
+	int w = board_width();
+	int cell;
+
+	c->pending = P_ANY;
+	c->pending_cell = -1;
+	switch (pick(6))
+	{
+	case 0:
+		// no request at all, only binary clients hear back about it
+		if (c->framing == FRAME_BINARY)
+		{
+			char frame[BIN_HEADER];
+			client_write(c, frame, bin_frame(frame, 0x7f, "", 0));
+		}
+		else
+		{
+			client_write(c, (c->framing == FRAME_PIPE) ? "ELSI|2|x|" : "ELSIJVBSDRI\n", (c->framing == FRAME_PIPE) ? 9 : 12);
+			c->pending = P_NONE;
+		}
+		break;
+	case 1:
+		send_request(c, OP_MOVE, &c->role, 1);
+		break;
+	case 2:
+		send_move(c, c->role, board_height(), 0);
+		break;
+	case 3:
+		send_request(c, OP_DRAW, "Z", 1);
+		break;
+	case 4:
+		if ((cell = random_cell(c, 1)) != -1)
+		{
+			send_move(c, c->role, cell / w, cell % w);
+			break;
+		}
+		// fall through
+	default:
+		if (c->framing == FRAME_BINARY)
+		{
+			send_move(c, c->role, board_height(), 0);
+		}
+		else
+		{
+			send_move(c, 'P', 1, 1);
+		}
+		break;
+	}
+}
+
+static void client_play(client_t *c)
+{
+	int roll = pick(100);
+	int cell;
+
+	if (c->pending != P_NONE)
+	{
+		if (chance(2))
+		{
+			client_close(c);
+		}
+		return;
+	}
+
+	if (roll < 2)
+	{
+		client_close(c);
+		return;
+	}
+	if (roll < 4)
+	{
+		send_request(c, OP_RSGN, "", 0);
+		c->pending = P_END;
+	}
+	else if (c->offered && roll < 50)
+	{
+		// a move of either player on its way withdraws the offer, and the
+		// accept is refused
+		char answer = chance(50) ? 'A' : 'R';
+		send_request(c, OP_DRAW, &answer, 1);
+		c->pending = (answer == 'A') ? P_ANY : P_NONE;
+		c->offered = 0;
+	}
+	else if (roll < 7)
+	{
+		send_request(c, OP_DRAW, "S", 1);
+	}
+	else if (roll < 11)
+	{
+		send_bad(c);
+	}
+	else if ((cell = random_cell(c, 0)) != -1 && (c->turn == c->role || roll < 14))
+	{
+		// a move out of turn is refused, unless the opponent's move gets in first
+		send_move(c, c->role, cell / board_width(), cell % board_width());
+		c->pending = (c->turn == c->role) ? P_MOVE : P_ANY;
+		c->pending_cell = cell;
+	}
+	else
+	{
+		return;
+	}
+	c->wake = sim_clock + think();
+	reschedule(c);
+}
+
+// a client whose time came: connect, play, or give up
+static void client_wake(client_t *c)
+{
+	c->wake = 0;
+	reschedule(c);
+	switch (c->state)
+	{
+	case C_OFF:
+		if (c->connected || c->sending != NULL)
+		{
+			// its last session is still on its way out
+			c->wake = sim_clock + net_delay();
+			reschedule(c);
+			return;
+		}
+		if (!c->resume && games >= target_games)
+		{
+			return;
+		}
+		if (!c->resume)
+		{
+			c->framing = pick(3);
+		}
+		client_open(c);
+		if (c->resume && chance(20))
+		{
+			// comes back, but not for its seat
+			c->resume = 0;
+		}
+		if (!c->resume && chance(2))
+		{
+			// never says who it is
+			c->stalled = 1;
+		}
+		else
+		{
+			client_hello(c);
+		}
+		if (chance(3))
+		{
+			client_close(c);
+		}
+		break;
+	case C_NAME:
+		if (chance(10))
+		{
+			client_close(c);
+		}
+		break;
+	case C_WAIT:
+		if (chance(3))
+		{
+			client_close(c);
+		}
+		else if (house_ok && chance(10))
+		{
+			send_request(c, OP_HOUS, "", 0);
+		}
+		break;
+	case C_PLAY:
+		client_play(c);
+		break;
+	case C_DONE:
+		if (chance(50))
+		{
+			client_close(c);
+		}
+		break;
+	}
+}
+
+// ---- the event loop ----
+
+// run the earliest thing due by limit: an alarm of the wheel, a client
+// acting, a read by the server or a send completing; returns 0 when nothing is
+static int step(long limit)
+{
+	client_t *next = (num_scheduled > 0) ? schedule[0] : NULL;
+	long at = (next != NULL) ? next->due : LONG_MAX;
+	int kind = 0;
+
+	if (next != NULL)
+	{
+		// of its own times, the one due, the wake before the read before the send
+		kind = (next->wake == at) ? 0 : (next->tx_at == at) ? 1 : 2;
+	}
+
+	int timeout = wheel_timeout(&wheel);
+	if (next == NULL && timeout < 0)
+	{
+		return 0;
+	}
+	long alarm = (timeout < 0) ? LONG_MAX : (wheel_now() + timeout) * 1000000L;
+	if (alarm <= at)
+	{
+		if (alarm > limit)
+		{
+			return 0;
+		}
+		sim_clock = (alarm > sim_clock) ? alarm : sim_clock;
+		wheel_run(&wheel, wheel_now());
+		return 1;
+	}
+	if (at > limit)
+	{
+		return 0;
+	}
+	sim_clock = (at > sim_clock) ? at : sim_clock;
+	switch (kind)
+	{
+	case 0:
+		client_wake(next);
+		break;
+	case 1:
+		server_read(next);
+		break;
+	case 2:
+		send_done(next);
+		break;
+	}
+	return 1;
+}
+
+static void reset(uint64_t seed)
+{
+	rng = seed;
+	sim_clock = START_CLOCK;
+	trace_hash = 0xcbf29ce484222325ULL;
+	games = 0;
+	failure[0] = '\0';
+	wheel_init(&wheel);
+	memset(clients, 0, sizeof(clients));
+	num_scheduled = 0;
+	for (int i = 0; i < MAX_CLIENTS; i++)
+	{
+		clients[i].id = i;
+		clients[i].slot = -1;
+		snprintf(clients[i].name, sizeof(clients[i].name), "p%d", i);
+	}
+}
+
+// once every session is over, nothing of them may be left behind on the server
+static void check_clean()
+{
+	for (int i = 0; i < num_clients; i++)
+	{
+		if (clients[i].open || clients[i].connected)
+		{
+			fail(&clients[i], "stuck in state %s with nothing left to happen", state_name(clients[i].state));
+			return;
+		}
+	}
+	if (wheel_timeout(&wheel) != -1)
+	{
+		fail(NULL, "an alarm is still armed");
+	}
+	if (lobby_waiting(0) != 0)
+	{
+		fail(NULL, "%d games still in the lobby", lobby_waiting(0));
+	}
+	for (int id = 0; game_exists(id); id++)
+	{
+		if (get_game(id)->status != GAME_FREE)
+		{
+			fail(NULL, "game %d still in status %d", id, (int) get_game(id)->status);
+		}
+	}
+	for (int i = 0; i < num_clients; i++)
+	{
+		if (name_reserve(clients[i].name) == 0)
+		{
+			fail(&clients[i], "name still reserved");
+		}
+		else
+		{
+			name_release(clients[i].name);
+		}
+	}
+	for (int i = 0; i < num_held; i++)
+	{
+		if (held[i]->refs != 1)
+		{
+			fail(NULL, "output queue of fd %d still has %d other references", held[i]->fd, held[i]->refs - 1);
+		}
+		outq_put(held[i]);
+	}
+	num_held = 0;
+}
+
+static void run_seed(uint64_t seed, result_t *res)
+{
+	long events = 0;
+	long start;
+
+	reset(seed);
+	for (int i = 0; i < num_clients; i++)
+	{
+		clients[i].wake = sim_clock + think();
+		reschedule(&clients[i]);
+	}
+
+	start = now_ns();
+	while (failure[0] == '\0' && step(LONG_MAX))
+	{
+		events++;
+		if (sim_clock - START_CLOCK > MAX_TIME)
+		{
+			fail(NULL, "still running after an hour");
+		}
+	}
+	res->seconds = (now_ns() - start) / 1e9;
+	if (failure[0] == '\0')
+	{
+		check_clean();
+	}
+	res->games = games;
+	res->events = events;
+	res->hash = trace_hash;
+	res->failed = (failure[0] != '\0');
+}
+
+// ---- scenarios ----
+
+// a scenario is a list of steps for clients a to h, each "<client><op><arg>":
+// "a+alice" connects a as alice ("a+" never sends a name), "a>LINE" sends
+// a line, "a<TEXT" reads a line that must start with TEXT, "a=" finds
+// nothing more to read, "a." finds the connection closed, "a-" closes it,
+// "a^" reconnects with the token a was given; "~MS" lets time pass
+typedef struct
+{
+	const char *name;
+	const char *steps[96];
+}
+scenario_t;
+
+// x waits, o joins and both learn who they face
+#define PAIR(x, xn, o, on) \
+	x "+" xn, x "<WAIT", o "+" on, o "<BEGN O " xn, o "<TOKN", x "<BEGN X " on, x "<TOKN"
+// a move both players see
+#define MOVE(who, x, o, role, pos) \
+	who ">MOVE " role " " pos, x "<MOVD " role " " pos, o "<MOVD " role " " pos
+
+static const scenario_t scenarios[] = {
+	{ "full game - draw", {
+		PAIR("a", "alice", "b", "bob"),
+		MOVE("a", "a", "b", "X", "1,1"), MOVE("b", "a", "b", "O", "1,2"),
+		MOVE("a", "a", "b", "X", "1,3"), MOVE("b", "a", "b", "O", "2,2"),
+		MOVE("a", "a", "b", "X", "2,1"), MOVE("b", "a", "b", "O", "2,3"),
+		MOVE("a", "a", "b", "X", "3,2"), MOVE("b", "a", "b", "O", "3,1"),
+		"a>MOVE X 3,3", "a<OVER D", "b<OVER D", "a.", "b.", NULL } },
+	{ "full game - x wins", {
+		PAIR("a", "alice", "b", "bob"),
+		MOVE("a", "a", "b", "X", "1,1"), MOVE("b", "a", "b", "O", "2,1"),
+		MOVE("a", "a", "b", "X", "1,2"), MOVE("b", "a", "b", "O", "2,2"),
+		"a>MOVE X 1,3", "b<OVER L alice won XXXOO....", "a<OVER W alice won XXXOO....", "a.", "b.", NULL } },
+	{ "full game - o wins", {
+		PAIR("a", "alice", "b", "bob"),
+		MOVE("a", "a", "b", "X", "1,1"), MOVE("b", "a", "b", "O", "2,1"),
+		MOVE("a", "a", "b", "X", "1,2"), MOVE("b", "a", "b", "O", "2,2"),
+		MOVE("a", "a", "b", "X", "3,3"),
+		"b>MOVE O 2,3", "a<OVER L bob won", "b<OVER W bob won", "b.", "a.", NULL } },
+	{ "x resigns", {
+		PAIR("a", "alice", "b", "bob"),
+		"a>RSGN", "b<OVER W bob won alice resigned", "a<OVER L bob won alice resigned", "a.", "b.", NULL } },
+	{ "o resigns", {
+		PAIR("a", "alice", "b", "bob"),
+		MOVE("a", "a", "b", "X", "2,2"),
+		"b>RSGN", "a<OVER W alice won bob resigned", "b<OVER L", "b.", "a.", NULL } },
+	{ "x draw - o rejects - o resigns", {
+		PAIR("a", "alice", "b", "bob"),
+		"a>DRAW S", "b<DRAW S", "b>DRAW R", "a<DRAW R",
+		"b>RSGN", "a<OVER W", "b<OVER L", "b.", "a.", NULL } },
+	{ "o draw - x rejects - finish game", {
+		PAIR("a", "alice", "b", "bob"),
+		MOVE("a", "a", "b", "X", "1,1"),
+		"b>DRAW S", "a<DRAW S", "a>DRAW R", "b<DRAW R",
+		MOVE("b", "a", "b", "O", "2,1"), MOVE("a", "a", "b", "X", "1,2"),
+		MOVE("b", "a", "b", "O", "2,2"),
+		"a>MOVE X 1,3", "b<OVER L alice won", "a<OVER W alice won", "a.", "b.", NULL } },
+	{ "x draw - o accepts", {
+		PAIR("a", "alice", "b", "bob"),
+		"a>DRAW S", "b<DRAW S", "b>DRAW A", "a<OVER D", "b<OVER D", "b.", "a.", NULL } },
+	{ "o draw - x accepts", {
+		PAIR("a", "alice", "b", "bob"),
+		MOVE("a", "a", "b", "X", "1,1"),
+		"b>DRAW S", "a<DRAW S", "a>DRAW A", "a<OVER D", "b<OVER D", "a.", "b.", NULL } },
+	{ "draw accepted without an offer", {
+		PAIR("a", "alice", "b", "bob"),
+		"b>DRAW A", "b<INVL No draw offered",
+		"a>DRAW S", "b<DRAW S", "a>DRAW A", "a<INVL No draw offered",
+		MOVE("a", "a", "b", "X", "1,1"),
+		"b>DRAW A", "b<INVL No draw offered",
+		"b>RSGN", "a<OVER W", "b<OVER L", "b.", "a.", NULL } },
+	{ "o resigns during x's turn", {
+		PAIR("a", "alice", "b", "bob"),
+		MOVE("a", "a", "b", "X", "1,1"), MOVE("b", "a", "b", "O", "2,2"),
+		"b>RSGN", "a<OVER W alice won bob resigned", "b<OVER L", "b.", "a.", NULL } },
+	{ "x suggests draw during o's turn", {
+		PAIR("a", "alice", "b", "bob"),
+		MOVE("a", "a", "b", "X", "1,1"),
+		"a>DRAW S", "b<DRAW S", "b>DRAW R", "a<DRAW R",
+		MOVE("b", "a", "b", "O", "2,2"),
+		"a>RSGN", "b<OVER W", "a<OVER L", "a.", "b.", NULL } },
+	{ "2 games", {
+		PAIR("a", "alice", "b", "bob"), PAIR("c", "carol", "d", "dave"),
+		MOVE("a", "a", "b", "X", "1,1"), MOVE("c", "c", "d", "X", "2,2"),
+		MOVE("b", "a", "b", "O", "3,3"), MOVE("d", "c", "d", "O", "1,1"),
+		"a>RSGN", "b<OVER W", "a<OVER L", "a.", "b.",
+		MOVE("c", "c", "d", "X", "1,2"), MOVE("d", "c", "d", "O", "3,3"),
+		"c>MOVE X 3,2", "c<OVER W", "d<OVER L", "c.", "d.", NULL } },
+	{ "3 games", {
+		PAIR("a", "alice", "b", "bob"), PAIR("c", "carol", "d", "dave"), PAIR("e", "erin", "f", "frank"),
+		MOVE("a", "a", "b", "X", "1,1"), MOVE("c", "c", "d", "X", "1,1"), MOVE("e", "e", "f", "X", "2,2"),
+		MOVE("b", "a", "b", "O", "2,2"), MOVE("d", "c", "d", "O", "2,2"), MOVE("f", "e", "f", "O", "1,1"),
+		"a>DRAW S", "b<DRAW S", "b>DRAW A", "a<OVER D", "b<OVER D", "b.", "a.",
+		MOVE("c", "c", "d", "X", "3,3"), MOVE("e", "e", "f", "X", "1,3"),
+		MOVE("d", "c", "d", "O", "1,3"), MOVE("f", "e", "f", "O", "3,1"),
+		"c>RSGN", "d<OVER W", "c<OVER L", "c.", "d.",
+		MOVE("e", "e", "f", "X", "2,1"), MOVE("f", "e", "f", "O", "2,3"),
+		MOVE("e", "e", "f", "X", "1,2"), MOVE("f", "e", "f", "O", "3,2"),
+		"e>MOVE X 3,3", "e<OVER D", "f<OVER D", "e.", "f.", NULL } },
+	{ "name already taken", {
+		PAIR("a", "alice", "b", "bob"),
+		"c+alice", "c<INVL name already in use", "c.",
+		"a>RSGN", "b<OVER W", "a<OVER L", "a.", "b.",
+		"c+alice", "c<WAIT", "c-", NULL } },
+	{ "move errors", {
+		PAIR("a", "alice", "b", "bob"),
+		"b>MOVE O 2,2", "b<INVL Not your turn",
+		MOVE("a", "a", "b", "X", "2,2"),
+		"b>MOVE O 2,2", "b<INVL Cell already occupied",
+		"a>MOVE X 1,1", "a<INVL Not your turn",
+		"a=", "b=", "b>RSGN", "a<OVER W", "b<OVER L", "b.", "a.", NULL } },
+	{ "malformed messages", {
+		PAIR("a", "alice", "b", "bob"),
+		"a>ELSIJVBSDRI", "a>RSGN EJIRGE", "a=", "b=",
+		"a>DRAW ERHBG", "a<INVL Invalid parameter",
+		"a>MOVE X", "a<INVL Invalid command",
+		"a>MOVE P 2,2", "a<INVL Not your role",
+		"a>MOVE HELLO", "a<INVL Invalid command",
+		"a>MOVE X 4,8", "a<INVL Cell out of bounds",
+		"a>MOVE X -1,-12", "a<INVL Cell out of bounds",
+		"b=", MOVE("a", "a", "b", "X", "2,2"),
+		"a>RSGN", "b<OVER W", "a<OVER L", "a.", "b.", NULL } },
+	{ "disconnect before BEGN", {
+		"a+alice", "a<WAIT", "a-", "a.",
+		"b+bob", "b<WAIT", "c+", "c-", "b=",
+		"d+dave", "d<BEGN O bob", "d<TOKN", "b<BEGN X dave", "b<TOKN",
+		"d-", "~1500", "b<Player dave disconnected.", "b.", NULL } },
+	{ "house", {
+		"a+alice", "a<WAIT", "a>HOUS", "a<BEGN X house",
+		"a>MOVE X 2,2", "a<MOVD X 2,2", "a<MOVD O",
+		"a>DRAW S", "a<OVER D", "a.", NULL } },
+	{ "resume", {
+		PAIR("a", "alice", "b", "bob"),
+		MOVE("a", "a", "b", "X", "1,1"),
+		"a-", "b>MOVE O 2,2", "b<MOVD O 2,2",
+		"a^", "a<SNAP X X - X...O.... bob",
+		MOVE("a", "a", "b", "X", "3,3"),
+		"b>RSGN", "a<OVER W", "b<OVER L", "b.", "a.", NULL } },
+	{ "resume window closes", {
+		PAIR("a", "alice", "b", "bob"),
+		"b=", "a-", "~1500", "b<Player alice disconnected.", "b.",
+		"a^", "a<INVL No game to resume", "a-", NULL } },
+	{ "handshake timeout", {
+		"a+", "~500", "a=", "~1000", "a.", NULL } },
+	{ "lobby timeout", {
+		"a+alice", "a<WAIT", "~2500", "a=", "~1000", "a<INVL No opponent found", "a.", NULL } },
+	{ "move timeout", {
+		PAIR("a", "alice", "b", "bob"),
+		MOVE("a", "a", "b", "X", "1,1"),
+		"~2500", "a<OVER W alice won bob ran out of time", "b<OVER L", "b.", "a.", NULL } },
+};
+
+#define NUM_SCENARIOS ((int) (sizeof(scenarios) / sizeof(scenarios[0])))
+
+// run whatever is due now, scenario clients never wait on each other
+static void settle()
+{
+	while (failure[0] == '\0' && step(sim_clock))
+		;
+}
+
+// the next line the client read, NULL when there is none
+static const char *next_line(client_t *c, int *len)
+{
+	const char *line = c->log + c->log_pos;
+	const char *end = memchr(line, '\n', c->log_len - c->log_pos);
+
+	if (end == NULL)
+	{
+		return NULL;
+	}
+	*len = end - line;
+	c->log_pos += *len + 1;
+	return line;
+}
+
+static void run_step(const char *s)
+{
+	client_t *c;
+	const char *arg = s + 2;
+	const char *line;
+	int len;
+
+	if (s[0] == '~')
+	{
+		long until = sim_clock + atol(s + 1) * 1000000L;
+		while (failure[0] == '\0' && step(until))
+			;
+		sim_clock = until;
+		settle();
+		return;
+	}
+
+	c = &clients[s[0] - 'a'];
+	switch (s[1])
+	{
+	case '+':
+		snprintf(c->name, sizeof(c->name), "%s", arg);
+		c->framing = FRAME_LINE;
+		client_open(c);
+		if (arg[0] == '\0')
+		{
+			c->stalled = 1;
+		}
+		else
+		{
+			client_hello(c);
+		}
+		break;
+	case '^':
+		if (!c->resume)
+		{
+			fail(c, "no seat to resume");
+			return;
+		}
+		client_open(c);
+		client_hello(c);
+		break;
+	case '>':
+	{
+		char buf[MAX_MSG_LEN];
+		client_write(c, buf, snprintf(buf, sizeof(buf), "%s\n", arg));
+		break;
+	}
+	case '-':
+		client_close(c);
+		break;
+	case '<':
+		settle();
+		if ((line = next_line(c, &len)) == NULL)
+		{
+			fail(c, "read nothing, expected %s", arg);
+		}
+		else if (len < (int) strlen(arg) || strncmp(line, arg, strlen(arg)) != 0)
+		{
+			fail(c, "read %.*s, expected %s", len, line, arg);
+		}
+		return;
+	case '=':
+	case '.':
+		settle();
+		if ((line = next_line(c, &len)) != NULL)
+		{
+			fail(c, "read %.*s, expected nothing", len, line);
+		}
+		else if (s[1] == '.' && c->open)
+		{
+			fail(c, "connection still open");
+		}
+		return;
+	}
+	settle();
+}
+
+static int run_scenario(const scenario_t *sc)
+{
+	const char *line;
+	int len;
+
+	reset(0);
+	scripted = 1;
+	num_clients = 8;
+	for (int i = 0; sc->steps[i] != NULL && failure[0] == '\0'; i++)
+	{
+		run_step(sc->steps[i]);
+	}
+	for (int i = 0; i < num_clients && failure[0] == '\0'; i++)
+	{
+		if ((line = next_line(&clients[i], &len)) != NULL)
+		{
+			fail(&clients[i], "read %.*s that the scenario never expected", len, line);
+		}
+	}
+
+	// whoever is still connected leaves, and the server gets to time out
+	// whatever that leaves behind
+	for (int i = 0; i < num_clients; i++)
+	{
+		if (clients[i].open)
+		{
+			client_close(&clients[i]);
+		}
+	}
+	run_step("~10000");
+	if (failure[0] == '\0')
+	{
+		check_clean();
+	}
+	return failure[0] != '\0';
+}
+
+// ---- driver ----
+
+// every seed and scenario runs in a child of its own, so each starts from
+// the same server state, which makes a seed replay exactly, and a crash
+// takes down only the run that caused it
+static int run_child(uint64_t seed, const scenario_t *sc, result_t *res)
+{
+	int fds[2];
+	int status;
+
+	memset(res, 0, sizeof(*res));
+	fflush(stdout);
+	if (pipe(fds) < 0)
+	{
+		perror("pipe");
+		exit(1);
+	}
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0)
+	{
+		close(fds[0]);
+		if (sc != NULL)
+		{
+			res->failed = run_scenario(sc);
+		}
+		else
+		{
+			run_seed(seed, res);
+		}
+		if (res->failed)
+		{
+			printf("%s: %s\n", sc != NULL ? sc->name : "failed", failure);
+		}
+		fflush(stdout);
+		if (write(fds[1], res, sizeof(*res)) != sizeof(*res))
+		{
+			_exit(2);
+		}
+		_exit(0);
+	}
+
+	close(fds[1]);
+	int got = read(fds[0], res, sizeof(*res));
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+	if (got != sizeof(*res) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		if (WIFSIGNALED(status))
+		{
+			printf("crashed with signal %d\n", WTERMSIG(status));
+		}
+		res->failed = 1;
+	}
+	return res->failed;
+}
+
+static int run_scenarios()
+{
+	int failed = 0;
+	result_t res;
+
+	for (int i = 0; i < NUM_SCENARIOS; i++)
+	{
+		if (run_child(0, &scenarios[i], &res) == 0)
+		{
+			printf("ok      %s\n", scenarios[i].name);
+		}
+		else
+		{
+			printf("FAILED  %s\n", scenarios[i].name);
+			failed++;
+		}
+	}
+	printf("%d of %d scenarios passed\n", NUM_SCENARIOS - failed, NUM_SCENARIOS);
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t first = 1;
+	long seeds = 100;
+	int scenario_mode = 0;
+	const char *board = "3x3x3";
+	int width, height, k;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:n:c:g:b:vS")) != -1)
+	{
+		switch (opt)
+		{
+		case 's': first = strtoull(optarg, NULL, 10); seeds = 1; break;
+		case 'n': seeds = atol(optarg); break;
+		case 'c': num_clients = atoi(optarg); break;
+		case 'g': target_games = atol(optarg); break;
+		case 'v': verbose = 1; break;
+		case 'S': scenario_mode = 1; break;
+		case 'b':
+			board = optarg;
+			if (sscanf(optarg, "%dx%dx%d", &width, &height, &k) == 3 && board_configure(width, height, k) == 0)
+			{
+				break;
+			}
+			// fall through
+		default:
+			fprintf(stderr, "Usage: %s [-s seed] [-n seeds] [-c clients] [-g games] [-b WxHxK] [-v] [-S]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	num_clients = (num_clients < 2) ? 2 : (num_clients > MAX_CLIENTS) ? MAX_CLIENTS : num_clients;
+
+	sim_clock = START_CLOCK;
+	lobby_init(1);
+	session_timeouts(HANDSHAKE_MS, LOBBY_MS, MOVE_MS, RESUME_MS);
+	server_setup();
+	house_ok = (board_cells() == 9 && board_k() == 3);
+
+	if (scenario_mode)
+	{
+		if (board_cells() != 9)
+		{
+			fprintf(stderr, "the scenarios are written for the 3x3 board\n");
+			exit(EXIT_FAILURE);
+		}
+		return run_scenarios();
+	}
+
+	long total_games = 0;
+	long total_events = 0;
+	double seconds = 0;
+	int failed = 0;
+	for (uint64_t seed = first; seed < first + seeds; seed++)
+	{
+		result_t res;
+		if (run_child(seed, NULL, &res))
+		{
+			printf("seed %lu failed, replay it with: %s -s %lu -c %d -g %ld -b %s -v\n", (unsigned long) seed, argv[0], (unsigned long) seed, num_clients, target_games, board);
+			failed++;
+			continue;
+		}
+		if (seeds == 1 || verbose)
+		{
+			printf("seed %lu: %ld games, %ld events, hash %016lx\n", (unsigned long) seed, res.games, res.events, (unsigned long) res.hash);
+		}
+		total_games += res.games;
+		total_events += res.events;
+		seconds += res.seconds;
+	}
+
+	printf("%ld seeds, %d failed, %ld games, %ld events in %.2fs", seeds, failed, total_games, total_events, seconds);
+	if (seconds > 0)
+	{
+		printf(": %.0f games/s, %.0f events/s", total_games / seconds, total_events / seconds);
+	}
+	printf("\n");
+	return failed ? 1 : 0;
+}
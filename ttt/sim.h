@@ -0,0 +1,13 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stddef.h>
+
+// make sim builds the server with TTT_SIM defined: its clock only moves when
+// the simulation moves it, and what it draws at random comes from the seed
+#ifdef TTT_SIM
+extern long sim_clock;          // nanoseconds
+void sim_random(void *buf, size_t len);
+#endif
+
+#endif // SIM_H
@@ -0,0 +1,789 @@
+#include "protocol.h"
+#include "codec.h"
+#include "board.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <dirent.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/personality.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#define SERVER_IP "127.0.0.1"
+#define SERVER_PORT 5000
+#define MAX_EVENTS 1024
+#define STALL_SECONDS 30
+#define SETTLE_SECONDS 5
+
+// client states
+#define C_CONNECTING 0
+#define C_LOBBY 1               // name or token sent, no game yet
+#define C_PLAYING 2
+
+// where a client cuts its session short instead of playing it out
+#define DROP_NONE 0
+#define DROP_CONNECT 1          // connected, before the name
+#define DROP_LOBBY 2            // on the first reply to its name
+#define DROP_GAME 3             // after a few moves of its own, and may resume
+
+typedef struct
+{
+	int fd;
+	int id;
+	int state;
+	int drop;
+	int drop_moves;
+	int moves;
+	int joined;
+	char role;
+	int width;                  // board shape announced in BEGN or SNAP
+	int cells;
+	char board[BOARD_MAX_CELLS + 1];
+	char token[RESUME_TOKEN_LEN + 1];
+	long cycle;
+	unsigned int seed;
+	msgbuf_t in;
+}
+client_t;
+
+// what happened since the last report
+typedef struct
+{
+	long sessions;              // connections opened
+	long joins;                 // sessions that reached the lobby or a game
+	long games;                 // games played to an OVER, counted by X
+	long drops;                 // sessions cut short on purpose
+	long resumes;               // dropped seats taken back with a token
+	long refused;               // handshakes answered with INVL
+	long gone;                  // games that ended because the opponent left
+	long lost;                  // sessions the server closed mid-game without a word
+	long failed;                // connects that did not go through
+}
+counters_t;
+
+static const char *server_ip = SERVER_IP;
+static int server_port = SERVER_PORT;
+static int framing = FRAME_LINE;
+static int drop_percent = 30;
+static int epoll_fd;
+static counters_t now_count;
+static counters_t total;
+static long last_msg_us;
+static volatile sig_atomic_t stop = 0;
+
+// the server under test, started by the harness or given with -x
+static pid_t server_pid = 0;
+static int started = 0;
+static int log_fd = -1;
+static char log_line[4096];
+static int log_line_len = 0;
+static long reports = 0;
+
+static long now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void on_signal(int sig)
+{
+	(void) sig;
+	stop = 1;
+}
+
+static int connect_tcp(int *in_progress)
+{
+	struct sockaddr_in addr;
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(server_port);
+	inet_pton(AF_INET, server_ip, &addr.sin_addr);
+	*in_progress = 0;
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+	{
+		if (errno != EINPROGRESS)
+		{
+			close(fd);
+			return -1;
+		}
+		*in_progress = 1;
+	}
+	return fd;
+}
+
+// sanitizer reports in the server's stderr, found one line at a time
+static void scan_line(const char *line)
+{
+	if (strstr(line, "WARNING: ThreadSanitizer:") != NULL || strstr(line, "ERROR: AddressSanitizer:") != NULL ||
+		strstr(line, "ERROR: LeakSanitizer:") != NULL || strstr(line, "runtime error:") != NULL)
+	{
+		if (reports++ < 10)
+		{
+			printf("report   %s\n", line);
+		}
+	}
+}
+
+static void scan_log()
+{
+	char buf[65536];
+	ssize_t n;
+
+	while (log_fd != -1 && (n = read(log_fd, buf, sizeof(buf))) > 0)
+	{
+		for (ssize_t i = 0; i < n; i++)
+		{
+			if (buf[i] == '\n')
+			{
+				log_line[log_line_len] = '\0';
+				scan_line(log_line);
+				log_line_len = 0;
+			}
+			else if (log_line_len < (int) sizeof(log_line) - 1)
+			{
+				log_line[log_line_len++] = buf[i];
+			}
+		}
+	}
+}
+
+static long proc_rss_kb(pid_t pid)
+{
+	char path[64];
+	char line[256];
+	long rss = -1;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", (int) pid);
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+	{
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		if (sscanf(line, "VmRSS: %ld", &rss) == 1)
+		{
+			break;
+		}
+	}
+	fclose(f);
+	return rss;
+}
+
+static int proc_fds(pid_t pid)
+{
+	char path[64];
+	struct dirent *ent;
+	int n = 0;
+
+	snprintf(path, sizeof(path), "/proc/%d/fd", (int) pid);
+	DIR *dir = opendir(path);
+	if (dir == NULL)
+	{
+		return -1;
+	}
+	while ((ent = readdir(dir)) != NULL)
+	{
+		n += (ent->d_name[0] != '.');
+	}
+	closedir(dir);
+	return n;
+}
+
+// run the command with its stderr in log_path; the sanitizers map their
+// shadow memory at fixed addresses, so the server runs without ASLR
+static void start_server(char **argv, const char *log_path)
+{
+	struct timespec pause = { 0, 10000000 };
+
+	int out = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	log_fd = open(log_path, O_RDONLY);
+	if (out < 0 || log_fd < 0)
+	{
+		perror(log_path);
+		exit(EXIT_FAILURE);
+	}
+	if ((server_pid = fork()) == 0)
+	{
+		int null = open("/dev/null", O_WRONLY);
+		personality(ADDR_NO_RANDOMIZE);
+		dup2(null, STDOUT_FILENO);
+		dup2(out, STDERR_FILENO);
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+	close(out);
+	started = 1;
+
+	for (int tries = 0; server_pid > 0 && tries < 1000; tries++)
+	{
+		struct sockaddr_in addr;
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(server_port);
+		inet_pton(AF_INET, server_ip, &addr.sin_addr);
+		int ok = connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+		close(fd);
+		if (ok)
+		{
+			return;
+		}
+		if (waitpid(server_pid, NULL, WNOHANG) == server_pid)
+		{
+			break;
+		}
+		nanosleep(&pause, NULL);
+	}
+	scan_log();
+	fprintf(stderr, "%s did not come up on port %d, see %s\n", argv[0], server_port, log_path);
+	exit(EXIT_FAILURE);
+}
+
+// whether the server is still there, says why not when it is gone
+static int server_alive()
+{
+	int status;
+
+	if (server_pid == 0)
+	{
+		return 1;
+	}
+	if (!started)
+	{
+		return kill(server_pid, 0) == 0 || errno != ESRCH;
+	}
+	if (waitpid(server_pid, &status, WNOHANG) != server_pid)
+	{
+		return 1;
+	}
+	if (WIFSIGNALED(status))
+	{
+		printf("server killed by signal %d\n", WTERMSIG(status));
+	}
+	else
+	{
+		printf("server exited with status %d\n", WEXITSTATUS(status));
+	}
+	server_pid = 0;
+	return 0;
+}
+
+// a write that fails shows up as the connection closing on the read side
+static void client_send(client_t *c, const char *msg, int len)
+{
+	ssize_t sent = write(c->fd, msg, len);
+	(void) sent;
+}
+
+static void client_connect(client_t *c)
+{
+	int in_progress;
+
+	c->cycle++;
+	c->state = C_CONNECTING;
+	c->joined = 0;
+	c->moves = 0;
+	c->drop = DROP_NONE;
+	if ((int) (rand_r(&c->seed) % 100) < drop_percent)
+	{
+		c->drop = DROP_CONNECT + rand_r(&c->seed) % 3;
+		c->drop_moves = rand_r(&c->seed) % 4;
+	}
+
+	c->fd = connect_tcp(&in_progress);
+	if (c->fd < 0)
+	{
+		now_count.failed++;
+		return;
+	}
+	now_count.sessions++;
+
+	int nodelay = 1;
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLOUT;
+	ev.data.ptr = c;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev);
+	msgbuf_init(&c->in, framing);
+}
+
+static void client_close(client_t *c)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+}
+
+// end this session and start the next one straight away
+static void client_next(client_t *c)
+{
+	client_close(c);
+	client_connect(c);
+}
+
+// cut the session short, a seat dropped mid-game may be resumed next time
+static void client_drop(client_t *c)
+{
+	now_count.drops++;
+	if (c->drop != DROP_GAME || rand_r(&c->seed) % 2)
+	{
+		c->token[0] = '\0';
+	}
+	client_next(c);
+}
+
+// the name, or the token of the seat the last session dropped
+static void client_hello(client_t *c)
+{
+	char name[32];
+	char msg[64];
+	int len;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+
+	c->state = C_LOBBY;
+	if (c->drop == DROP_CONNECT)
+	{
+		client_drop(c);
+		return;
+	}
+	if (c->token[0] != '\0')
+	{
+		len = (framing == FRAME_PIPE) ? snprintf(msg, sizeof(msg), "RSUM|%d|%s|", RESUME_TOKEN_LEN + 1, c->token)
+			: snprintf(msg, sizeof(msg), RESUME_HANDSHAKE "%s\n", c->token);
+	}
+	else
+	{
+		// a new name per session, the old one may not have been released yet
+		snprintf(name, sizeof(name), "s%dc%ld", c->id, c->cycle);
+		len = (framing == FRAME_PIPE) ? snprintf(msg, sizeof(msg), "PLAY|%d|%s|", (int) strlen(name) + 1, name)
+			: snprintf(msg, sizeof(msg), "%s\n", name);
+	}
+	client_send(c, msg, len);
+}
+
+// a random empty cell of the client's view of the board
+static void client_move(client_t *c)
+{
+	int empty[BOARD_MAX_CELLS];
+	int num_empty = 0;
+	char msg[32];
+	int len;
+
+	for (int i = 0; i < c->cells; i++)
+	{
+		if (c->board[i] == '.')
+		{
+			empty[num_empty++] = i;
+		}
+	}
+	if (num_empty == 0)
+	{
+		return;
+	}
+	int cell = empty[rand_r(&c->seed) % num_empty];
+	int row = cell / c->width + 1;
+	int col = cell % c->width + 1;
+	if (framing == FRAME_PIPE)
+	{
+		char pos[16];
+		int pos_len = snprintf(pos, sizeof(pos), "%d,%d", row, col);
+		len = snprintf(msg, sizeof(msg), "MOVE|%d|%c|%s|", pos_len + 3, c->role, pos);
+	}
+	else
+	{
+		len = snprintf(msg, sizeof(msg), "MOVE %c %d,%d\n", c->role, row, col);
+	}
+	client_send(c, msg, len);
+}
+
+static void client_joined(client_t *c)
+{
+	if (!c->joined)
+	{
+		c->joined = 1;
+		now_count.joins++;
+	}
+}
+
+// the board as BEGN or SNAP announce it, "WxHxK" when it is not 3x3x3
+static void client_board(client_t *c, const message_t *msg, int shape_field, const char *grid)
+{
+	int width = 3, height = 3;
+
+	if (msg->num_fields > shape_field)
+	{
+		sscanf(msg->fields[shape_field], "%dx%d", &width, &height);
+	}
+	if (width < 1 || height < 1 || width * height > BOARD_MAX_CELLS)
+	{
+		width = height = 3;
+	}
+	c->width = width;
+	c->cells = width * height;
+	memset(c->board, '.', c->cells);
+	if (grid != NULL)
+	{
+		memcpy(c->board, grid, c->cells);
+	}
+	c->board[c->cells] = '\0';
+	c->state = C_PLAYING;
+}
+
+// react to one server message, returns -1 once the session is over
+static int client_handle(client_t *c, const char *frame, int len)
+{
+	message_t msg;
+
+	if (len > 7 && memcmp(frame, "Player ", 7) == 0)
+	{
+		// "Player <name> disconnected." in the text framing
+		now_count.gone++;
+		return -1;
+	}
+	if (codec_decode(framing, frame, len, &msg) < 0)
+	{
+		return 0;
+	}
+
+	if (memcmp(msg.type, "WAIT", 4) == 0)
+	{
+		client_joined(c);
+		if (c->drop == DROP_LOBBY)
+		{
+			client_drop(c);
+			return 1;
+		}
+	}
+	else if (memcmp(msg.type, "BEGN", 4) == 0 && msg.num_fields >= 2)
+	{
+		client_joined(c);
+		if (c->drop == DROP_LOBBY)
+		{
+			client_drop(c);
+			return 1;
+		}
+		c->role = msg.fields[0][0];
+		client_board(c, &msg, 2, NULL);
+		if (c->role == 'X')
+		{
+			client_move(c);
+		}
+	}
+	else if (memcmp(msg.type, "TOKN", 4) == 0 && msg.num_fields == 1 && msg.lens[0] == RESUME_TOKEN_LEN)
+	{
+		memcpy(c->token, msg.fields[0], RESUME_TOKEN_LEN);
+		c->token[RESUME_TOKEN_LEN] = '\0';
+	}
+	else if (memcmp(msg.type, "SNAP", 4) == 0 && msg.num_fields >= 5)
+	{
+		// role, role to move, draw offer, grid, opponent
+		now_count.resumes++;
+		client_joined(c);
+		c->role = msg.fields[0][0];
+		client_board(c, &msg, 5, msg.fields[3]);
+		if (msg.fields[1][0] == c->role)
+		{
+			client_move(c);
+		}
+	}
+	else if (memcmp(msg.type, "MOVD", 4) == 0 && msg.num_fields >= 3 && c->state == C_PLAYING)
+	{
+		memcpy(c->board, msg.fields[2], (msg.lens[2] < c->cells) ? msg.lens[2] : c->cells);
+		if (msg.fields[0][0] != c->role)
+		{
+			client_move(c);
+		}
+		else if (c->drop == DROP_GAME && ++c->moves > c->drop_moves)
+		{
+			client_drop(c);
+			return 1;
+		}
+	}
+	else if (memcmp(msg.type, "OVER", 4) == 0)
+	{
+		if (c->role == 'X')
+		{
+			now_count.games++;
+		}
+		c->token[0] = '\0';
+		return -1;
+	}
+	else if (memcmp(msg.type, "GONE", 4) == 0)
+	{
+		now_count.gone++;
+		c->token[0] = '\0';
+		return -1;
+	}
+	else if (memcmp(msg.type, "INVL", 4) == 0 && c->state == C_LOBBY)
+	{
+		// name taken, no game to resume or the server full
+		now_count.refused++;
+		c->token[0] = '\0';
+		return -1;
+	}
+	return 0;
+}
+
+static void client_input(client_t *c, int events)
+{
+	char msg[MAX_MSG_LEN];
+	int len;
+
+	if (c->state == C_CONNECTING)
+	{
+		int err = 0;
+		socklen_t err_len = sizeof(err);
+		if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0)
+		{
+			now_count.failed++;
+			client_next(c);
+			return;
+		}
+		if (events & EPOLLOUT)
+		{
+			client_hello(c);
+		}
+		return;
+	}
+
+	int bytes_read = msgbuf_fill(&c->in, c->fd);
+	if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR))
+	{
+		return;
+	}
+	if (bytes_read > 0)
+	{
+		last_msg_us = now_us();
+	}
+
+	int over = (bytes_read <= 0);
+	if (over && c->state == C_PLAYING)
+	{
+		now_count.lost++;
+	}
+	while (!over && (len = msgbuf_next(&c->in, msg, sizeof(msg))) != 0)
+	{
+		int result = (len < 0) ? -1 : client_handle(c, msg, len);
+		if (result > 0)
+		{
+			// dropped and already on its next session
+			return;
+		}
+		over = (result < 0);
+	}
+	if (over)
+	{
+		client_next(c);
+	}
+}
+
+static void add_counts(counters_t *to, const counters_t *from)
+{
+	to->sessions += from->sessions;
+	to->joins += from->joins;
+	to->games += from->games;
+	to->drops += from->drops;
+	to->resumes += from->resumes;
+	to->refused += from->refused;
+	to->gone += from->gone;
+	to->lost += from->lost;
+	to->failed += from->failed;
+}
+
+int main(int argc, char *argv[])
+{
+	int num_clients = 1000;
+	long duration = 60;
+	long interval = 10;
+	unsigned int seed = 1;
+	const char *log_path = "stress.log";
+	int opt;
+
+	while ((opt = getopt(argc, argv, "h:p:n:t:i:d:P:s:o:x:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'h': server_ip = optarg; break;
+		case 'p': server_port = atoi(optarg); break;
+		case 'n': num_clients = atoi(optarg); break;
+		case 't': duration = atol(optarg); break;
+		case 'i': interval = atol(optarg); break;
+		case 'd': drop_percent = atoi(optarg); break;
+		case 'P': framing = (strcmp(optarg, "pipe") == 0) ? FRAME_PIPE : FRAME_LINE; break;
+		case 's': seed = strtoul(optarg, NULL, 10); break;
+		case 'o': log_path = optarg; break;
+		case 'x': server_pid = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-h ip] [-p port] [-n clients] [-t seconds] [-i interval] [-d drop_percent] [-P text|pipe] [-s seed] [-o log] [-x server_pid] [-- server command...]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	interval = (interval < 1) ? 1 : interval;
+
+	// the server started below inherits the raised limit too
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	if (optind < argc)
+	{
+		start_server(argv + optind, log_path);
+	}
+
+	long rss_start = server_pid ? proc_rss_kb(server_pid) : -1;
+	long rss_peak = rss_start;
+	int fds_start = server_pid ? proc_fds(server_pid) : -1;
+	int fds_peak = fds_start;
+
+	epoll_fd = epoll_create1(0);
+	if (epoll_fd < 0)
+	{
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+	client_t *clients = calloc(num_clients, sizeof(client_t));
+	for (int i = 0; i < num_clients; i++)
+	{
+		clients[i].id = i;
+		clients[i].seed = seed + i;
+		client_connect(&clients[i]);
+	}
+
+	long start = now_us();
+	long next_report = start + interval * 1000000;
+	int failed = 0;
+	last_msg_us = start;
+	printf("%d clients, %d%% of sessions dropped, %ld s", num_clients, drop_percent, duration);
+	printf(started ? ", server output in %s\n" : "\n", log_path);
+
+	struct epoll_event events[MAX_EVENTS];
+	while (!stop && now_us() - start < duration * 1000000)
+	{
+		long wait_ms = (next_report - now_us()) / 1000;
+		int n = epoll_wait(epoll_fd, events, MAX_EVENTS, wait_ms < 0 ? 0 : wait_ms > 100 ? 100 : wait_ms);
+		if (n < 0 && errno != EINTR)
+		{
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+		for (int i = 0; i < n; i++)
+		{
+			client_input(events[i].data.ptr, events[i].events);
+		}
+		for (int i = 0; i < num_clients && (n == 0 || now_us() >= next_report); i++)
+		{
+			// a connect that failed outright is retried once things are quiet
+			if (clients[i].fd == -1)
+			{
+				client_connect(&clients[i]);
+			}
+		}
+
+		if (!server_alive())
+		{
+			failed = 1;
+			break;
+		}
+		if (now_us() - last_msg_us > STALL_SECONDS * 1000000L)
+		{
+			printf("no message from the server for %d s\n", STALL_SECONDS);
+			failed = 1;
+			break;
+		}
+		if (now_us() < next_report)
+		{
+			continue;
+		}
+
+		long rss = server_pid ? proc_rss_kb(server_pid) : -1;
+		int fds = server_pid ? proc_fds(server_pid) : -1;
+		rss_peak = (rss > rss_peak) ? rss : rss_peak;
+		fds_peak = (fds > fds_peak) ? fds : fds_peak;
+		scan_log();
+		printf("%6lds  sessions %6.0f/s  games %6.0f/s  drops %6ld  resumes %5ld  refused %4ld  gone %5ld  lost %4ld  rss %7ld KB  fds %5d  reports %ld\n",
+			(now_us() - start) / 1000000, now_count.sessions / (double) interval, now_count.games / (double) interval,
+			now_count.drops, now_count.resumes, now_count.refused, now_count.gone, now_count.lost, rss, fds, reports);
+		fflush(stdout);
+		add_counts(&total, &now_count);
+		memset(&now_count, 0, sizeof(now_count));
+		next_report += interval * 1000000;
+	}
+	add_counts(&total, &now_count);
+	long elapsed = now_us() - start;
+
+	// with every client gone the server must be back to the descriptors it started with
+	for (int i = 0; i < num_clients; i++)
+	{
+		if (clients[i].fd != -1)
+		{
+			client_close(&clients[i]);
+		}
+	}
+	int fds_end = server_pid ? proc_fds(server_pid) : -1;
+	for (int tries = 0; server_pid && fds_end > fds_start && tries < SETTLE_SECONDS * 10; tries++)
+	{
+		struct timespec pause = { 0, 100000000 };
+		nanosleep(&pause, NULL);
+		fds_end = proc_fds(server_pid);
+	}
+	long rss_end = server_pid ? proc_rss_kb(server_pid) : -1;
+
+	printf("%ld sessions in %.1f s: %.0f sessions/s, %.0f joins/s, %.0f games/s\n", total.sessions, elapsed / 1e6,
+		total.sessions * 1e6 / elapsed, total.joins * 1e6 / elapsed, total.games * 1e6 / elapsed);
+	printf("drops %ld  resumes %ld  refused %ld  gone %ld  lost %ld  failed connects %ld\n",
+		total.drops, total.resumes, total.refused, total.gone, total.lost, total.failed);
+	if (total.lost > 0)
+	{
+		printf("%ld sessions closed mid-game without an OVER\n", total.lost);
+		failed = 1;
+	}
+	if (server_pid != 0)
+	{
+		printf("rss      start %ld KB  peak %ld KB  end %ld KB\n", rss_start, rss_peak, rss_end);
+		printf("fds      start %d  peak %d  end %d\n", fds_start, fds_peak, fds_end);
+		if (fds_end > fds_start)
+		{
+			printf("server kept %d descriptors after every client left\n", fds_end - fds_start);
+			failed = 1;
+		}
+	}
+	if (started && server_pid != 0)
+	{
+		kill(server_pid, SIGTERM);
+		waitpid(server_pid, NULL, 0);
+	}
+	scan_log();
+	if (started)
+	{
+		printf("reports  %ld in %s\n", reports, log_path);
+	}
+	return (failed || reports > 0) ? 1 : 0;
+}
@@ -12,13 +12,11 @@
 #define SERVER_PORT 5000
 #define MAX_MESSAGE_LENGTH 1024
 
-int connect_to_server(const char *ip, int port);
-
 void handle_user_input(int server_fd)
 {
     char input[250];
     char command[10];
-    char msg[50];
+    char msg[52];
 
     if ((fgets(input, sizeof(input), stdin) == NULL))
     {
@@ -27,10 +25,11 @@ void handle_user_input(int server_fd)
     }
 
     // Sending input
-    if (sscanf(input, "%s %[^\n]", command, msg) == 2)
+    if (sscanf(input, "%9s %50[^\n]", command, msg) == 2)
     {
         if (strcmp(command, "PLAY") == 0)
         {
+            strcat(msg, "\n");
             write_msg(server_fd, msg);
         }
         else if (strcmp(command, "MOVE") == 0)
@@ -47,7 +46,7 @@ void handle_user_input(int server_fd)
             printf("Invalid command.\n");
         }
     }
-    else if (sscanf(input, "%s %[^\n]", command, msg) == 1)
+    else if (sscanf(input, "%9s %50[^\n]", command, msg) == 1)
     {
         if (strcmp(command, "RSGN") == 0)
         {
@@ -60,9 +59,117 @@ void handle_user_input(int server_fd)
     }
 }
 
+// react to one message from the server, returns 1 once the game is over
+int handle_response(int server_fd, char *response)
+{
+	static char role;
+	static char opponent_name[MAX_MESSAGE_LENGTH];
+	char cmd[50];
+	char grid[50];
+	char server_response[MAX_MESSAGE_LENGTH];
+
+	if (sscanf(response, "%49s %[^\n]", cmd, server_response) == 2)
+	{
+		if (strcmp(cmd, "BEGN") == 0)
+		{
+			printf("%s\n", response);
+
+			if (sscanf(response, "BEGN %c %[^\n]", &role, opponent_name) == 2)
+			{
+				printf("Game started. You are %c. Playing against %s.\n", role, opponent_name);
+				if (role == 'X')
+				{
+					printf("Your turn. Enter MOVE <role> <pos> to make a move.\n");
+				}
+				else
+				{
+					printf("Waiting for %s to make a move.\n", opponent_name);
+				}
+			}
+		}
+		else if (strcmp(cmd, "MOVD") == 0)
+		{
+			char moved_role;
+			if (sscanf(response, "MOVD %c %49s %49s", &moved_role, cmd, grid) == 3)
+			{
+				printf("%s\n", response);
+				for(int r = 0; r < 3; r++){
+					for(int c = 0; c < 3; c++){
+						printf("%c ", grid[r*3 + c]);
+					}
+					printf("\n");
+				}
+				if (role == moved_role) // Compare characters directly, without using '&'
+				{
+					printf("Waiting for %s to make a move.\n", opponent_name);
+				}
+				else
+				{
+					printf("Your turn. Enter MOVE <role> <pos> to make a move.\n");
+				}
+			}
+		}
+		else if (strcmp(cmd, "INVL") == 0)
+		{
+			printf("Invalid move or message: %s\n", server_response);
+		}
+		else if (strcmp(cmd, "DRAW") == 0)
+		{
+			char subcmd;
+			if (sscanf(response, "DRAW %c", &subcmd) == 1)
+			{
+				if (subcmd == 'S')
+				{
+					printf("Opponent suggests a draw. Enter DRAW A to accept or DRAW R to reject.\n");
+				}
+				else if (subcmd == 'R')
+				{
+					printf("Opponent rejected the draw.\n");
+				}
+			}
+		}
+		else if (strcmp(cmd, "OVER") == 0)
+		{
+			printf("OVER %s\n", server_response);
+			// the final board is the last word unless the game ended by resignation or draw
+			char *last = strrchr(server_response, ' ');
+			if (server_response[0] != 'D' && !strstr(response, "resigned") && last != NULL && strlen(last + 1) == 9)
+			{
+				for(int r = 0; r < 3; r++){
+					for(int c = 0; c < 3; c++){
+						printf("%c ", last[1 + r*3 + c]);
+					}
+					printf("\n");
+				}
+			}
+			return 1;
+		}
+		else
+		{
+			printf("%s\n", response);
+		}
+	}
+	else
+	{
+		printf("%s\n", response);
+	}
+
+	if (strstr(response, "disconnected") != NULL)
+	{
+		printf("OVER W You win.\n");
+		close(server_fd);
+		exit(EXIT_SUCCESS);
+	}
+	return 0;
+}
+
 void handle_server_messages(int server_fd)
 {
+	msgbuf_t in;
+	char response[MAX_MSG_LEN];
+	int len;
 
+	msgbuf_init(&in, FRAME_LINE);
 	while (1)
 	{
 		// Initialize file descriptor set
@@ -84,125 +191,20 @@ void handle_server_messages(int server_fd)
 		// If data is available on the server
 		if (FD_ISSET(server_fd, &read_fds))
 		{
-			char *response = receive_msg(server_fd);
-			if (response == NULL)
+			if (msgbuf_fill(&in, server_fd) <= 0)
 			{
 				perror("Error receiving message from server");
 				exit(EXIT_FAILURE);
 			}
 
-			// Process the received message
-			char cmd[50];
-            char role;
-            char grid[50];
-            char opponent_name[MAX_MESSAGE_LENGTH];
-            char server_response[50];
-			if (sscanf(response, "%s %[^\n]", cmd, server_response) == 2)
+			// one read can carry several messages, or only part of one
+			while ((len = msgbuf_next(&in, response, sizeof(response))) != 0)
 			{
-				if (strcmp(cmd, "WAIT") == 0)
-				{
-					printf("WAIT\n");
-				}
-				else if (strcmp(cmd, "BEGN") == 0)
-                {
-                    printf("%s\n", response);
-                    
-                    
-                    if (sscanf(response, "BEGN %c %[^\n]", &role, opponent_name) == 2)
-                    {
-                        printf("Game started. You are %c. Playing against %s.\n", role, opponent_name);
-                        if (role == 'X')
-                        {
-                            printf("Your turn. Enter MOVE <role> <pos> to make a move.\n");
-                        }
-                        else
-                        {
-                            printf("Waiting for %s to make a move.\n", opponent_name);
-                        }
-                    }
-                }
-
-				else if (strcmp(cmd, "MOVD") == 0)
-				{
-					char moved_role;
-					if (sscanf(response, "MOVD %c %s %[^\n]", &moved_role, cmd, grid) == 3)
-					{
-                        printf("%s", response);
-						for(int r = 0; r < 3; r++){
-							for(int c = 0; c < 3; c++){
-								printf("%c ", grid[r*3 + c]);
-							}
-							printf("\n");
-						}
-                        if (role == moved_role) // Compare characters directly, without using '&'
-                        {
-                            printf("Waiting for %s to make a move.\n", opponent_name);
-                        }
-                        else
-                        {
-                            printf("Your turn. Enter MOVE <role> <pos> to make a move.\n");
-                        }
-					}
-				}
-				else if (strcmp(cmd, "INVL") == 0)
-				{
-					char reason[MAX_MESSAGE_LENGTH];
-					if (sscanf(response, "INVL %[^\n]", reason) == 1)
-					{
-						printf("Invalid move or message: %s\n", reason);
-                        // Call the function to get another input from the user
-					}
-				}
-				else if (strcmp(cmd, "DRAW") == 0)
-				{
-					char subcmd;
-					if (sscanf(response, "DRAW %c", &subcmd) == 1)
-					{
-						if (subcmd == 'S')
-						{
-							printf("Opponent suggests a draw. Enter DRAW A to accept or DRAW R to reject.\n");
-						}
-						else if (subcmd == 'R')
-						{
-							printf("Opponent rejected the draw.\n");
-						}
-					}
-				}
-				else if (strcmp(cmd, "OVER") == 0)
-				{
-					printf("OVER %s\n", server_response);
-					//check if server response contains resigned else dont print grid
-					//char *resigned = strrchr(server_response, ' ');
-					if(!strstr(response, "resigned")){
-						if(sscanf(response, "OVER %[^\n]%s", cmd, grid) == 2){
-							for(int r = 0; r < 3; r++){
-								for(int c = 0; c < 3; c++){
-									printf("%c ", grid[r*3 + c]);
-								}
-								printf("\n");
-							}
-						}
-					}
-					break;
-				}
-				else
+				if (len > 0 && handle_response(server_fd, response))
 				{
-					printf("%s\n", response);
+					return;
 				}
 			}
-			else
-			{
-				printf("%s\n", response);
-			}
-
-			if (strstr(response, "disconnected") != NULL)
-			{
-				printf("OVER W You win.\n");
-				close(server_fd);
-				exit(EXIT_SUCCESS);
-			}
-
-			free(response);
 		}
 
 		// If data is available on stdin
@@ -223,7 +225,13 @@ int main(int argc, char *argv[])
 	}
 
 	char *ip = (argc == 2) ? argv[1] : SERVER_IP;
+	printf("Attempting to connect to server at %s:%d\n", ip, SERVER_PORT);
 	int client_socket = connect_to_server(ip, SERVER_PORT);
+	if (client_socket == -1)
+	{
+		exit(EXIT_FAILURE);
+	}
+	printf("Connected to server at %s:%d\n", ip, SERVER_PORT);
 
 	handle_server_messages(client_socket);
 
@@ -232,41 +240,6 @@ int main(int argc, char *argv[])
 	return 0;
 }
 
-int connect_to_server(const char *ip, int port)
-{
-	// Create a socket
-	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (sockfd == -1)
-	{
-		perror("Error creating socket");
-		exit(EXIT_FAILURE);
-	}
-
-	// Set server address
-	struct sockaddr_in server_address;
-	memset(&server_address, 0, sizeof(server_address));
-	server_address.sin_family = AF_INET;
-	server_address.sin_port = htons(port);
-	if (inet_pton(AF_INET, ip, &server_address.sin_addr) != 1)
-	{
-		perror("Error parsing server IP address");
-		exit(EXIT_FAILURE);
-	}
-
-	printf("Attempting to connect to server at %s:%d\n", ip, port);
-
-	// Connect to server
-	if (connect(sockfd, (struct sockaddr *) &server_address, sizeof(server_address)) == -1)
-	{
-		perror("Error connecting to server");
-		exit(EXIT_FAILURE);
-	}
-
-	printf("Connected to server at %s:%d\n", ip, port);
-
-	return sockfd;
-}
-
 int read_user_input(char *input)
 {
 	// Read a line of input from the user
@@ -1,434 +1,1498 @@
+// SO_REUSEPORT is a Linux extension outside of _XOPEN_SOURCE
+#define _DEFAULT_SOURCE
+
 #include "protocol.h"
+#include "codec.h"
+#include "server.h"
+#include "reactor.h"
+#include "board.h"
+#include "lobby.h"
+#include "names.h"
+#include "metrics.h"
+#include "pool.h"
+#include "outq.h"
+#include "log.h"
+#include "journal.h"
+#include "house.h"
+#include "wheel.h"
+#include "sim.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/random.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <signal.h>
-#define PORT 5000
-#define MAX_CLIENTS 10
-#define MAX_NAME_LEN 20
-#define BOARD_SIZE 9
 
-typedef struct
+// the board shape as BEGN, GAME and SNAP spell it off 3x3x3, set at startup
+static char shape[16];
+static int shape_len;
+
+// queue the message in whichever framing the player speaks
+static void send_msg(outbox_t *box, player_t *to, const message_t *msg)
+{
+	char frame[CODEC_MAX_FRAME];
+	int len;
+
+	if (to->out == NULL)
+	{
+		// the house, or a seat nobody took
+		return;
+	}
+	if ((len = codec_encode(to->framing, msg, frame, sizeof(frame))) > 0)
+	{
+		queue_bytes(box, to->out, frame, len);
+	}
+}
+
+static void send_invl(outbox_t *box, player_t *to, const char *reason)
+{
+	message_t msg;
+	int len = strlen(reason);
+	message_init(&msg, OP_INVL);
+	message_field(&msg, reason, len);
+	message_payload(&msg, reason, len);
+	send_msg(box, to, &msg);
+}
+
+// the board shape only follows the name when it is not the classic 3x3x3,
+// so clients that predate it keep working
+static void send_begn(outbox_t *box, player_t *to, const char *opponent)
+{
+	message_t msg;
+	char payload[MAX_NAME_LEN + 5];
+	int name_len = strlen(opponent);
+	int len = 1 + name_len;
+
+	message_init(&msg, OP_BEGN);
+	message_field(&msg, &to->role, 1);
+	message_field(&msg, opponent, name_len);
+	payload[0] = to->role;
+	memcpy(payload + 1, opponent, name_len);
+	if (shape_len != 0)
+	{
+		message_field(&msg, shape, shape_len);
+		payload[len++] = '\0';
+		payload[len++] = board_width();
+		payload[len++] = board_height();
+		payload[len++] = board_k();
+	}
+	message_payload(&msg, payload, len);
+	send_msg(box, to, &msg);
+}
+
+// "row,col" counted from 1, neither is ever more than two digits
+static int position_field(char *buf, int cell)
+{
+	int row = cell / board_width() + 1;
+	int col = cell % board_width() + 1;
+	int len = 0;
+
+	if (row >= 10)
+	{
+		buf[len++] = '0' + row / 10;
+	}
+	buf[len++] = '0' + row % 10;
+	buf[len++] = ',';
+	if (col >= 10)
+	{
+		buf[len++] = '0' + col / 10;
+	}
+	buf[len++] = '0' + col % 10;
+	return len;
+}
+
+// formats the move once for both players and the game's spectators
+static void send_movd(outbox_t *box, game_t *game, char role, int cell, int seq, const char *grid)
+{
+	message_t msg;
+	char pos[8];
+	char payload[3 + BOARD_MAX_CELLS] = { role, cell, seq };
+
+	memcpy(payload + 3, grid, board_cells());
+	message_init(&msg, OP_MOVD);
+	message_field(&msg, &role, 1);
+	message_field(&msg, pos, position_field(pos, cell));
+	message_field(&msg, grid, board_cells());
+	message_payload(&msg, payload, 3 + board_cells());
+	if (box != NULL)
+	{
+		send_msg(box, &game->players[0], &msg);
+		send_msg(box, &game->players[1], &msg);
+	}
+	if (game->feed != NULL)
+	{
+		feed_publish(game->feed, &msg);
+	}
+}
+
+// binary OVER payload, the reason is cut short when a large board leaves
+// no room for it
+static int over_payload(char *payload, char outcome, const char *reason, const char *grid)
+{
+	int cells = board_cells();
+	int room = BIN_MAX_PAYLOAD - 1 - cells;
+	int reason_len = strlen(reason);
+	payload[0] = outcome;
+	memcpy(payload + 1, grid, cells);
+	memcpy(payload + 1 + cells, reason, reason_len < room ? reason_len : room);
+	return 1 + cells + (reason_len < room ? reason_len : room);
+}
+
+// text clients only get the board when the game ended on a move
+static void send_over(outbox_t *box, player_t *to, char outcome, const char *reason, const char *grid, int show_grid)
+{
+	message_t msg;
+	char payload[BIN_MAX_PAYLOAD];
+
+	message_init(&msg, OP_OVER);
+	message_field(&msg, &outcome, 1);
+	message_string(&msg, reason);
+	if (show_grid)
+	{
+		message_field(&msg, grid, board_cells());
+	}
+	message_payload(&msg, payload, over_payload(payload, outcome, reason, grid));
+	send_msg(box, to, &msg);
+}
+
+// spectators get one OVER naming the winner's role, or D for a draw, always
+// with the final board, and that ends their feed
+static void watch_over(game_t *game, char winner, const char *reason)
+{
+	message_t msg;
+	char grid[BOARD_MAX_CELLS + 1];
+	char payload[BIN_MAX_PAYLOAD];
+
+	if (game->feed == NULL)
+	{
+		return;
+	}
+	board_string(&game->board, grid);
+	message_init(&msg, OP_OVER);
+	message_field(&msg, &winner, 1);
+	message_string(&msg, reason);
+	message_field(&msg, grid, board_cells());
+	message_payload(&msg, payload, over_payload(payload, winner, reason, grid));
+	feed_publish(game->feed, &msg);
+	feed_end(game->feed);
+	game->feed = NULL;
+}
+
+static void send_draw(outbox_t *box, player_t *to, char kind)
+{
+	message_t msg;
+	message_init(&msg, OP_DRAW_OFFER);
+	message_field(&msg, &kind, 1);
+	message_payload(&msg, &kind, 1);
+	send_msg(box, to, &msg);
+}
+
+static void send_gone(outbox_t *box, player_t *to, const char *name)
+{
+	message_t msg;
+	int len = strlen(name);
+	message_init(&msg, OP_GONE);
+	message_field(&msg, name, len);
+	message_payload(&msg, name, len);
+	send_msg(box, to, &msg);
+}
+
+// the token names the game and the seat in its first 8 hex digits, the
+// other 16 are the seat's secret
+static void send_token(outbox_t *box, game_t *game, int game_id, int seat)
+{
+	message_t msg;
+	char token[RESUME_TOKEN_LEN + 1];
+	snprintf(token, sizeof(token), "%08x%016lx", (unsigned int) (game_id << 1 | seat), game->secret[seat]);
+	message_init(&msg, OP_TOKN);
+	message_field(&msg, token, RESUME_TOKEN_LEN);
+	message_payload(&msg, token, RESUME_TOKEN_LEN);
+	send_msg(box, &game->players[seat], &msg);
+}
+
+// where the game stands for a player who reconnected: its role, whose move
+// it is, who has a draw offer standing, the board and the opponent
+static void send_snap(outbox_t *box, game_t *game, int seat)
+{
+	message_t msg;
+	char grid[BOARD_MAX_CELLS + 1];
+	char payload[BIN_MAX_PAYLOAD];
+	player_t *me = &game->players[seat];
+	const char *opponent = game->players[1 - seat].name;
+	int name_len = strlen(opponent);
+	char turn = game->current_turn ? 'O' : 'X';
+	char draw = (game->draw_offer == -1) ? '-' : game->draw_offer ? 'O' : 'X';
+	int len = 0;
+
+	board_string(&game->board, grid);
+	message_init(&msg, OP_SNAP);
+	message_field(&msg, &me->role, 1);
+	message_field(&msg, &turn, 1);
+	message_field(&msg, &draw, 1);
+	message_field(&msg, grid, board_cells());
+	message_field(&msg, opponent, name_len);
+	if (shape_len != 0)
+	{
+		message_field(&msg, shape, shape_len);
+	}
+	payload[len++] = me->role;
+	payload[len++] = turn;
+	payload[len++] = draw;
+	payload[len++] = board_width();
+	payload[len++] = board_height();
+	payload[len++] = board_k();
+	memcpy(payload + len, grid, board_cells());
+	len += board_cells();
+	memcpy(payload + len, opponent, name_len);
+	len += name_len;
+	message_payload(&msg, payload, len);
+	send_msg(box, me, &msg);
+}
+
+// take a dropped seat back with its token; whoever swaps the seat's secret
+// out first owns the seat, so a reconnect and the seat's release can never
+// both get it
+static int claim_seat(player_t *player, const char *token)
+{
+	unsigned int id;
+	unsigned long secret;
+
+	if (sscanf(token, "%8x%16lx", &id, &secret) != 2 || secret == 0 || !game_exists(id >> 1))
+	{
+		return 0;
+	}
+
+	game_t *game = get_game(id >> 1);
+	int seat = id & 1;
+	if (!atomic_compare_exchange_strong(&game->resume_secret[seat], &secret, 0))
+	{
+		return 0;
+	}
+	strcpy(player->name, game->players[seat].name);
+	player->role = seat ? 'O' : 'X';
+	player->resume = id >> 1;
+	return 1;
+}
+
+// reserve the name the player asked for
+static int login_name(player_t *player, outbox_t *box, const char *name)
+{
+	if (name[0] == '\0')
+	{
+		metric_add(METRIC_NAME_REJECTS, 1);
+		send_invl(box, player, "Invalid name");
+		return 0;
+	}
+	if (name_reserve(name) == 0)
+	{
+		metric_add(METRIC_NAME_REJECTS, 1);
+		send_invl(box, player, "name already in use");
+		return 0;
+	}
+	strcpy(player->name, name);
+	return 1;
+}
+
+// the name comes with the seat
+static int login_resume(player_t *player, outbox_t *box, const char *token)
+{
+	if (!claim_seat(player, token))
+	{
+		send_invl(box, player, "No game to resume");
+		return 0;
+	}
+	metric_add(METRIC_RESUMES, 1);
+	return 1;
+}
+
+// a changed/ client speaks the pipe framing from its first message on,
+// "PLAY|len|name|" or "RSUM|len|token|"
+static int login_pipe(player_t *player, outbox_t *box, const char *buf)
+{
+	message_t msg;
+	char field[MAX_NAME_LEN + RESUME_TOKEN_LEN];
+
+	player->framing = FRAME_PIPE;
+	if (codec_decode(FRAME_PIPE, buf, strlen(buf), &msg) != 1 || msg.lens[0] >= (int) sizeof(field))
+	{
+		return login_name(player, box, "");
+	}
+	memcpy(field, msg.fields[0], msg.lens[0]);
+	field[msg.lens[0]] = '\0';
+	if (strncmp(msg.type, "RSUM", 4) == 0)
+	{
+		return login_resume(player, box, field);
+	}
+	field[MAX_NAME_LEN - 1] = '\0';
+	return login_name(player, box, strncmp(msg.type, MSG_PLAY, 4) == 0 ? field : "");
+}
+
+// read the name out of the first message and reserve it, the caller has
+// already filled in the player's socket and output queue; the first message
+// also settles the framing the player speaks
+int login(player_t *player, outbox_t *box, char *buf)
+{
+	char name[MAX_NAME_LEN];
+
+	player->name[0] = '\0';
+	player->framing = FRAME_LINE;
+	player->resume = -1;
+	if (strlen(buf) > 4 && buf[4] == '|')
+	{
+		return login_pipe(player, box, buf);
+	}
+	if (strncmp(buf, RESUME_HANDSHAKE, strlen(RESUME_HANDSHAKE)) == 0)
+	{
+		buf += strlen(RESUME_HANDSHAKE);
+		if (strncmp(buf, "BIN ", 4) == 0)
+		{
+			player->framing = FRAME_BINARY;
+			buf += 4;
+		}
+		return login_resume(player, box, buf);
+	}
+	if (strncmp(buf, WATCH_HANDSHAKE, strlen(WATCH_HANDSHAKE)) == 0)
+	{
+		// a spectator, its socket moves over to the broadcast thread and
+		// this session ends without a reply
+		int game_id;
+		int binary = (strncmp(buf + strlen(WATCH_HANDSHAKE), "BIN ", 4) == 0);
+		if (sscanf(buf + strlen(WATCH_HANDSHAKE) + (binary ? 4 : 0), "%d", &game_id) == 1)
+		{
+			watch_open(dup(player->sock_fd), binary, game_id);
+		}
+		return 0;
+	}
+	if (strncmp(buf, BIN_HANDSHAKE, strlen(BIN_HANDSHAKE)) == 0)
+	{
+		player->framing = FRAME_BINARY;
+		buf += strlen(BIN_HANDSHAKE);
+	}
+
+	if (sscanf(buf, "%19[^\n]", name) != 1)
+	{
+		name[0] = '\0';
+	}
+	return login_name(player, box, name);
+}
+
+// give the name back once the session is over
+void logout(player_t *player)
+{
+	if (player->name[0] != '\0')
+	{
+		name_release(player->name);
+		player->name[0] = '\0';
+	}
+}
+
+// game commands, posted to the game's mailbox and applied in arrival order
+#define CMD_JOIN 0
+#define CMD_PLAY 1
+#define CMD_LEAVE 2
+#define CMD_TIMEOUT 3
+#define CMD_RESUME 4
+
+typedef struct
+{
+	mail_t mail;
+	int type;
+	int game_id;
+	int index;
+	long received;
+	player_t player;
+	request_t req;
+}
+command_t;
+
+// what one drain of a mailbox produced for the thread running it
+typedef struct
+{
+	outbox_t *box;
+	int dead;
+}
+worker_t;
+
+static pool_t command_pool = POOL_INITIALIZER(command_t);
+
+// the house only knows the 3x3 board
+static int house_ready = 0;
+
+// session timeouts in milliseconds, 0 switches one off
+static long handshake_ms = 10000;
+static long lobby_ms = 300000;
+static long move_ms = 60000;
+static long resume_ms = 30000;
+
+static command_t *command_new(int type, int game_id, player_t *player)
+{
+	command_t *cmd = pool_get(&command_pool);
+	cmd->type = type;
+	cmd->game_id = game_id;
+	cmd->index = (player->role == 'X') ? 0 : 1;
+	cmd->received = metrics_now();
+	memset(&cmd->req, 0, sizeof(cmd->req));
+	return cmd;
+}
+
+// append the finished game to the record log, when one is open
+static void record_game(game_t *game, int outcome, int winner)
+{
+	_Alignas(8) char buf[RECORD_MAX_SIZE];
+	game_record_t *rec = (game_record_t *) buf;
+
+	if (!journal_enabled())
+	{
+		return;
+	}
+	memset(buf, 0, RECORD_SIZE(game->num_moves));
+	rec->size = RECORD_SIZE(game->num_moves);
+	rec->outcome = outcome;
+	rec->winner = winner;
+	rec->width = board_width();
+	rec->height = board_height();
+	rec->k = board_k();
+	rec->num_moves = game->num_moves;
+	memcpy(rec->moves, game->moves, game->num_moves);
+	rec->started = game->started;
+	rec->finished = journal_now();
+	strncpy(rec->names[0], game->players[0].name, RECORD_NAME_LEN);
+	strncpy(rec->names[1], game->players[1].name, RECORD_NAME_LEN);
+	journal_append(rec);
+}
+
+// the player to move starts thinking, the other one's clock stops
+static void start_clock(game_t *game, int player_index)
+{
+	if (move_ms != 0)
+	{
+		atomic_store(&game->move_deadline[1 - player_index], 0);
+		atomic_store(&game->move_deadline[player_index], wheel_now() + move_ms);
+	}
+}
+
+// the second player takes its seat, unless the first one left in the meantime
+static void run_join(game_t *game, command_t *cmd, outbox_t *box)
+{
+	game->players[1] = cmd->player;
+	send_begn(box, &game->players[1], game->players[0].name);
+	if (game->status == GAME_WAITING)
+	{
+		game->status = GAME_ACTIVE;
+		metric_add(METRIC_GAMES_STARTED, 1);
+		metric_time(HIST_LOBBY_WAIT, cmd->received - game->waiting_since);
+		game->started = journal_now();
+		send_begn(box, &game->players[0], game->players[1].name);
+		start_clock(game, 0);
+		if (resume_ms != 0)
+		{
+			// drawn once per game, a seat keeps its token however often
+			// it reconnects
+#ifdef TTT_SIM
+			sim_random(game->secret, sizeof(game->secret));
+#else
+			getrandom(game->secret, sizeof(game->secret), 0);
+#endif
+			game->secret[0] |= 1;
+			game->secret[1] |= 1;
+			send_token(box, game, cmd->game_id, 0);
+			send_token(box, game, cmd->game_id, 1);
+		}
+	}
+	else
+	{
+		send_gone(box, &game->players[1], game->players[0].name);
+	}
+}
+
+// put the mark down and tell both players, returns 1 when it ended the game
+static int play_move(game_t *game, int player_index, int cell, int seq, outbox_t *box)
+{
+	char grid[BOARD_MAX_CELLS + 1];
+	char reason[64];
+	player_t *me = &game->players[player_index];
+	player_t *other = &game->players[1 - player_index];
+
+	int result = board_play(&game->board, player_index, cell);
+	board_string(&game->board, grid);
+	game->moves[game->num_moves++] = cell;
+	game->draw_offer = -1;
+
+	// Check for win condition
+	if (result == BOARD_WIN)
+	{
+		// Announce winner
+		snprintf(reason, sizeof(reason), "%s won", me->name);
+		send_over(box, other, 'L', reason, grid, 1);
+		send_over(box, me, 'W', reason, grid, 1);
+		watch_over(game, me->role, reason);
+		metric_add(METRIC_GAMES_WON, 1);
+		record_game(game, RECORD_WIN, me->role);
+		return 1;
+	}
+	if (result == BOARD_DRAW)
+	{
+		// Announce draw
+		send_over(box, &game->players[0], 'D', "Game has ended in a draw.", grid, 0);
+		send_over(box, &game->players[1], 'D', "Game has ended in a draw.", grid, 0);
+		watch_over(game, 'D', "Game has ended in a draw.");
+		metric_add(METRIC_GAMES_DRAWN, 1);
+		record_game(game, RECORD_DRAW, 0);
+		return 1;
+	}
+
+	// send updated game state back to both clients
+	send_movd(box, game, me->role, cell, seq, grid);
+
+	// Update current turn
+	game->current_turn = 1 - player_index;
+	start_clock(game, game->current_turn);
+	return 0;
+}
+
+// seat the house opposite a player still waiting in the lobby; a player
+// who got paired in the meantime keeps that opponent, since the request
+// races with the pairing it was meant to replace
+static void run_house(game_t *game, command_t *cmd, outbox_t *box)
+{
+	player_t *me = &game->players[cmd->index];
+	player_t *house = &game->players[1];
+	int queued = 0;
+
+	if (!house_ready)
+	{
+		send_invl(box, me, "No house on this board");
+		return;
+	}
+	if (game->status == GAME_WAITING)
+	{
+		pthread_mutex_t *lock = shard_lock(game_shard(cmd->game_id));
+		pthread_mutex_lock(lock);
+		if ((queued = lobby_queued(cmd->game_id)))
+		{
+			lobby_remove(cmd->game_id);
+		}
+		pthread_mutex_unlock(lock);
+	}
+	if (!queued)
+	{
+		return;
+	}
+
+	// the house has no connection, whatever is sent to it is dropped
+	strcpy(house->name, HOUSE_NAME);
+	house->role = 'O';
+	house->sock_fd = -1;
+	house->framing = FRAME_LINE;
+	house->out = NULL;
+	game->house = 1;
+	game->status = GAME_ACTIVE;
+	metric_add(METRIC_GAMES_STARTED, 1);
+	metric_time(HIST_LOBBY_WAIT, cmd->received - game->waiting_since);
+	game->started = journal_now();
+	send_begn(box, me, house->name);
+	start_clock(game, 0);
+}
+
+static void run_play(game_t *game, command_t *cmd, outbox_t *box)
+{
+	char grid[BOARD_MAX_CELLS + 1];
+	char reason[64];
+	int player_index = cmd->index;
+	int other_player_index = 1 - player_index;
+	player_t *me = &game->players[player_index];
+	player_t *other = &game->players[other_player_index];
+	request_t *req = &cmd->req;
+	int over = 0;
+
+	if (req->op == OP_HOUS && req->error == NULL)
+	{
+		run_house(game, cmd, box);
+		return;
+	}
+	if (game->status != GAME_ACTIVE)
+	{
+		send_invl(box, me, game->status == GAME_WAITING ? "Waiting for opponent" : "Game is over");
+		return;
+	}
+
+	board_string(&game->board, grid);
+	if (req->error != NULL)
+	{
+		send_invl(box, me, req->error);
+	}
+	else if (req->op == OP_MOVE)
+	{
+		if (game->current_turn != player_index)
+		{
+			// Check if it's the current player's turn
+			send_invl(box, me, "Not your turn");
+		}
+		else if (!board_empty(&game->board, req->cell))
+		{
+			// Invalid move (cell already occupied) - inform player
+			send_invl(box, me, "Cell already occupied");
+		}
+		else
+		{
+			over = play_move(game, player_index, req->cell, req->seq, box);
+			if (!over && game->house)
+			{
+				// the house answers right away, in the same flush
+				over = play_move(game, 1, house_move(&game->board), 0, box);
+			}
+		}
+	}
+	else if (req->op == OP_DRAW && game->house)
+	{
+		// the house never offers a draw, and takes one unless it is winning
+		if (req->arg != 'S')
+		{
+			send_invl(box, me, "No draw offered");
+		}
+		else if (house_value(&game->board, 1) > 0)
+		{
+			send_draw(box, me, 'R');
+		}
+		else
+		{
+			send_over(box, &game->players[0], 'D', "Game has ended in a draw.", grid, 0);
+			watch_over(game, 'D', "Game has ended in a draw.");
+			metric_add(METRIC_GAMES_DRAWN, 1);
+			record_game(game, RECORD_DRAW, 0);
+			over = 1;
+		}
+	}
+	else if (req->op == OP_DRAW)
+	{
+		// Send other client draw request or process the draw response
+		if (req->arg == 'A' && game->draw_offer != other_player_index)
+		{
+			// only the opponent's offer can be taken, and a move withdraws it
+			send_invl(box, me, "No draw offered");
+		}
+		else if (req->arg == 'A')
+		{
+			// The current player accepted the draw request, inform both players
+			send_over(box, &game->players[0], 'D', "Game has ended in a draw.", grid, 0);
+			send_over(box, &game->players[1], 'D', "Game has ended in a draw.", grid, 0);
+			watch_over(game, 'D', "Game has ended in a draw.");
+			metric_add(METRIC_GAMES_DRAWN, 1);
+			record_game(game, RECORD_DRAW, 0);
+			over = 1;
+		}
+		else
+		{
+			// pass the offer or the refusal on to the other player
+			game->draw_offer = (req->arg == 'S') ? player_index : -1;
+			send_draw(box, other, req->arg);
+		}
+	}
+	else if (req->op == OP_RSGN)
+	{
+		snprintf(reason, sizeof(reason), "%s won %s resigned", other->name, me->name);
+		send_over(box, other, 'W', reason, grid, 0);
+		send_over(box, me, 'L', reason, grid, 0);
+		watch_over(game, other->role, reason);
+		metric_add(METRIC_GAMES_RESIGNED, 1);
+		record_game(game, RECORD_RESIGN, other->role);
+		over = 1;
+	}
+
+	if (over)
+	{
+		game->status = GAME_OVER;
+		game->finished = 1;
+	}
+	if (req->op >= OP_MOVE && req->op <= OP_RSGN)
+	{
+		// MOVE, DRAW and RSGN map onto consecutive histograms
+		metric_time(HIST_MOVE + req->op - OP_MOVE, metrics_now() - cmd->received);
+	}
+}
+
+// the player in seat index walked away from a live game
+static void abandon_game(game_t *game, int index, outbox_t *box)
+{
+	char buf[128];
+	player_t *me = &game->players[index];
+	player_t *other = &game->players[1 - index];
+
+	game->status = GAME_OVER;
+	metric_add(METRIC_GAMES_ABANDONED, 1);
+	record_game(game, RECORD_ABANDONED, other->role);
+	send_gone(box, other, me->name);
+	snprintf(buf, sizeof(buf), "Player %s disconnected.", me->name);
+	watch_over(game, other->role, buf);
+}
+
+// the player in seat index let its clock run out
+static void lose_on_time(game_t *game, int index, outbox_t *box)
+{
+	char grid[BOARD_MAX_CELLS + 1];
+	char reason[64];
+	player_t *me = &game->players[index];
+	player_t *other = &game->players[1 - index];
+
+	board_string(&game->board, grid);
+	snprintf(reason, sizeof(reason), "%s won %s ran out of time", other->name, me->name);
+	send_over(box, other, 'W', reason, grid, 0);
+	send_over(box, me, 'L', reason, grid, 0);
+	watch_over(game, other->role, reason);
+	metric_add(METRIC_GAMES_TIMED_OUT, 1);
+	record_game(game, RECORD_TIMEOUT, other->role);
+	game->status = GAME_OVER;
+	game->finished = 1;
+}
+
+// give a dropped seat up for good, with its name and its hold on the game,
+// unless its player reconnected first; returns 1 when it was released
+static int release_seat(game_t *game, int seat)
+{
+	unsigned long secret = atomic_load(&game->resume_secret[seat]);
+
+	if (secret == 0 || !atomic_compare_exchange_strong(&game->resume_secret[seat], &secret, 0))
+	{
+		return 0;
+	}
+	atomic_store(&game->resume_deadline[seat], 0);
+	name_release(game->players[seat].name);
+	atomic_fetch_sub(&game->joined, 1);
+	return 1;
+}
+
+// returns 1 once the last player has left and the game can be freed
+static int run_leave(game_t *game, command_t *cmd, outbox_t *box)
+{
+	player_t *me = &game->players[cmd->index];
+	player_t *other = &game->players[1 - cmd->index];
+
+	if (game->status == GAME_ACTIVE && resume_ms != 0 && !game->house && other->out != NULL)
+	{
+		// the connection dropped mid-game: the seat keeps its name and its
+		// hold on the game while it waits for its player, and the opponent's
+		// session times the wait
+		outq_put(me->out);
+		me->sock_fd = -1;
+		me->out = NULL;
+		atomic_store(&game->resume_deadline[cmd->index], wheel_now() + resume_ms);
+		atomic_store(&game->resume_secret[cmd->index], game->secret[cmd->index]);
+		metric_add(METRIC_DETACHES, 1);
+		return 0;
+	}
+
+	if (game->status == GAME_WAITING)
+	{
+		// nobody was paired with us yet, unless a join is already on its way
+		pthread_mutex_t *lock = shard_lock(game_shard(cmd->game_id));
+		pthread_mutex_lock(lock);
+		if (lobby_queued(cmd->game_id))
+		{
+			lobby_remove(cmd->game_id);
+		}
+		pthread_mutex_unlock(lock);
+		game->status = GAME_OVER;
+	}
+	else if (game->status == GAME_ACTIVE)
+	{
+		// inform the other player that the game has ended
+		abandon_game(game, cmd->index, box);
+	}
+	else if (other->out != NULL)
+	{
+		// wake the opponent's reader so its session ends too
+		outq_shutdown(other->out);
+	}
+
+	// a dropped opponent has nothing left to come back to
+	release_seat(game, 1 - cmd->index);
+	name_release(me->name);
+	outq_put(me->out);
+	me->sock_fd = -1;
+	me->out = NULL;
+	return atomic_fetch_sub(&game->joined, 1) == 1;
+}
+
+// a reconnected player takes its seat back and learns where the game stands
+static void run_resume(game_t *game, command_t *cmd, outbox_t *box)
+{
+	player_t *me = &game->players[cmd->index];
+
+	me->sock_fd = cmd->player.sock_fd;
+	me->framing = cmd->player.framing;
+	me->out = cmd->player.out;
+	atomic_store(&game->resume_deadline[cmd->index], 0);
+	if (game->status != GAME_ACTIVE)
+	{
+		send_invl(box, me, "Game is over");
+		return;
+	}
+	send_snap(box, game, cmd->index);
+}
+
+// a session's alarm found a clock run out, which the game checks again
+// since a move, a pairing or a reconnect may have beaten the alarm to it:
+// the player waiting in the lobby, the player on the move, or a dropped
+// opponent past its move clock or its grace window
+static void run_timeout(game_t *game, command_t *cmd, outbox_t *box)
+{
+	player_t *me = &game->players[cmd->index];
+	int other = 1 - cmd->index;
+	long now = wheel_now();
+
+	if (game->status == GAME_WAITING && cmd->index == 0)
+	{
+		// nobody came, unless a join is already on its way
+		int queued;
+		pthread_mutex_t *lock = shard_lock(game_shard(cmd->game_id));
+		pthread_mutex_lock(lock);
+		if ((queued = lobby_queued(cmd->game_id)))
+		{
+			lobby_remove(cmd->game_id);
+		}
+		pthread_mutex_unlock(lock);
+		if (queued)
+		{
+			metric_add(METRIC_LOBBY_TIMEOUTS, 1);
+			send_invl(box, me, "No opponent found");
+			game->status = GAME_OVER;
+			game->finished = 1;
+		}
+		return;
+	}
+	if (game->status != GAME_ACTIVE)
+	{
+		return;
+	}
+
+	long deadline = atomic_load(&game->move_deadline[cmd->index]);
+	if (game->current_turn == cmd->index && deadline != 0 && now >= deadline)
+	{
+		lose_on_time(game, cmd->index, box);
+		return;
+	}
+
+	long grace = atomic_load(&game->resume_deadline[other]);
+	deadline = atomic_load(&game->move_deadline[other]);
+	int out_of_time = (game->current_turn == other && deadline != 0 && now >= deadline);
+	if (grace == 0 || (!out_of_time && now < grace) || !release_seat(game, other))
+	{
+		return;
+	}
+	if (out_of_time)
+	{
+		lose_on_time(game, other, box);
+	}
+	else
+	{
+		abandon_game(game, other, box);
+		game->finished = 1;
+	}
+}
+
+// attach a spectator feed to a live game, the spectators get the names now
+// and the board so far as the last move's MOVD
+static void run_watch(game_t *game, feed_t *feed)
 {
-	char name[MAX_NAME_LEN];
-	char role;
-	int sock_fd;
+	message_t msg;
+	char payload[2 * MAX_NAME_LEN + 4];
+	const char *x = game->players[0].name;
+	const char *o = game->players[1].name;
+	int len;
+
+	if (feed == NULL)
+	{
+		// taken back by the broadcast thread
+		return;
+	}
+	if (game->status != GAME_ACTIVE || game->feed != NULL)
+	{
+		feed_refuse(feed);
+		return;
+	}
+
+	game->feed = feed;
+	len = snprintf(payload, sizeof(payload), "%s%c%s", x, '\0', o);
+	message_init(&msg, OP_GAME);
+	message_string(&msg, x);
+	message_string(&msg, o);
+	if (shape_len != 0)
+	{
+		message_field(&msg, shape, shape_len);
+		payload[len++] = '\0';
+		payload[len++] = board_width();
+		payload[len++] = board_height();
+		payload[len++] = board_k();
+	}
+	message_payload(&msg, payload, len);
+	feed_header(feed, &msg);
+
+	if (game->num_moves > 0)
+	{
+		char grid[BOARD_MAX_CELLS + 1];
+		int last = game->num_moves - 1;
+		board_string(&game->board, grid);
+		send_movd(NULL, game, (last % 2) ? 'O' : 'X', game->moves[last], 0, grid);
+	}
 }
 
-player_t;
+static void run_command(mail_t *mail, void *ctx)
+{
+	command_t *cmd = (command_t *) mail;
+	worker_t *worker = ctx;
+	game_t *game = get_game(cmd->game_id);
 
-typedef struct
+	switch (cmd->type)
+	{
+	case CMD_JOIN:
+		run_join(game, cmd, worker->box);
+		break;
+	case CMD_PLAY:
+		run_play(game, cmd, worker->box);
+		break;
+	case CMD_LEAVE:
+		worker->dead = run_leave(game, cmd, worker->box);
+		break;
+	case CMD_TIMEOUT:
+		run_timeout(game, cmd, worker->box);
+		break;
+	case CMD_RESUME:
+		run_resume(game, cmd, worker->box);
+		break;
+	}
+
+	// a spectator asked for the game while it was busy with this command
+	if (atomic_load(&game->watch_request) != NULL)
+	{
+		run_watch(game, atomic_exchange(&game->watch_request, NULL));
+	}
+	pool_put(&command_pool, cmd);
+}
+
+// hand a command to the game, running the game here if no other thread is
+static void game_post(int game_id, command_t *cmd, outbox_t *box)
+{
+	game_t *game = get_game(game_id);
+	worker_t worker = { box, 0 };
+
+	if (mailbox_post(&game->mailbox, &cmd->mail))
+	{
+		mailbox_drain(&game->mailbox, run_command, &worker);
+		if (worker.dead)
+		{
+			// nothing can reach the game any more, both players have left
+			pthread_mutex_t *lock = shard_lock(game_shard(game_id));
+			pthread_mutex_lock(lock);
+			game_free(game_id);
+			pthread_mutex_unlock(lock);
+		}
+	}
+}
+
+// take the seat opposite the longest waiting player of a shard, -1 if it has none
+static int pair_player(int shard, player_t *player, outbox_t *box)
 {
-	player_t players[2];
-	int status;
-	pthread_mutex_t lock;
-	char board[BOARD_SIZE];
-	int current_turn;
+	if (lobby_waiting(shard) == 0)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(shard_lock(shard));
+	int game_id = lobby_pop(shard);
+	if (game_id != -1)
+	{
+		get_game(game_id)->joined++;
+	}
+	pthread_mutex_unlock(shard_lock(shard));
+	if (game_id == -1)
+	{
+		return -1;
+	}
+
+	// the seat is taken by the game's worker
+	player->role = 'O';
+	outq_hold(player->out);
+	command_t *cmd = command_new(CMD_JOIN, game_id, player);
+	cmd->player = *player;
+	game_post(game_id, cmd, box);
+	return game_id;
 }
-game_t;
 
-game_t games[MAX_CLIENTS];
-int num_games = 0;
-pthread_mutex_t game_lock;
-char player_names[MAX_CLIENTS *2][MAX_NAME_LEN];
-int num_player_names = 0;
-pthread_mutex_t player_name_lock;
+// open a game in the shard and wait in its lobby, nobody else can see the
+// game until it is queued
+static int open_game(int shard, player_t *player, outbox_t *box, int announce)
+{
+	pthread_mutex_lock(shard_lock(shard));
+	int game_id = game_alloc(shard);
+	if (game_id == -1)
+	{
+		pthread_mutex_unlock(shard_lock(shard));
+		send_invl(box, player, "Server full");
+		return -1;
+	}
+
+	game_t *game = get_game(game_id);
+	player->role = 'X';
+	outq_hold(player->out);
+	game->players[0] = *player;
+	game->players[1].sock_fd = -1;
+	game->players[1].out = NULL;
+	game->status = GAME_WAITING;
+	game->joined = 1;
+	game->finished = 0;
+	game->current_turn = 0;
+	game->num_moves = 0;
+	game->house = 0;
+	game->move_deadline[0] = 0;
+	game->move_deadline[1] = 0;
+	game->draw_offer = -1;
+	game->resume_secret[0] = 0;
+	game->resume_secret[1] = 0;
+	game->resume_deadline[0] = 0;
+	game->resume_deadline[1] = 0;
+	game->waiting_since = metrics_now();
+	board_init(&game->board);
+	if (announce)
+	{
+		// queued before anyone can pair with us, so WAIT always precedes BEGN
+		message_t msg;
+		message_init(&msg, OP_WAIT);
+		send_msg(box, player, &msg);
+	}
+	lobby_push(game_id);
+	pthread_mutex_unlock(shard_lock(shard));
+	return game_id;
+}
 
-void init_board(char board[BOARD_SIZE])
+// whether a game that entered some other shard's lobby before ours still waits
+static int older_waiting(int shard, long ticket)
 {
-	for (int i = 0; i < BOARD_SIZE; i++)
+	for (int i = 0; i < lobby_shards(); i++)
 	{
-		for (int j = 0; j < BOARD_SIZE; j++)
+		if (i == shard || lobby_waiting(i) == 0)
+		{
+			continue;
+		}
+		pthread_mutex_lock(shard_lock(i));
+		long head = lobby_head_ticket(i);
+		pthread_mutex_unlock(shard_lock(i));
+		if (head != -1 && head < ticket)
 		{
-			board[i] = '.';
+			return 1;
 		}
 	}
+	return 0;
+}
+
+// take our unpaired game back out of the lobby, 0 if an opponent got it first
+static int withdraw_game(int game_id, player_t *player)
+{
+	pthread_mutex_t *lock = shard_lock(game_shard(game_id));
+	pthread_mutex_lock(lock);
+	int queued = lobby_queued(game_id);
+	if (queued)
+	{
+		lobby_remove(game_id);
+		game_free(game_id);
+	}
+	pthread_mutex_unlock(lock);
+
+	if (queued)
+	{
+		outq_put(player->out);
+	}
+	return queued;
 }
 
-int check_name(char *name)
+// pair the player with the longest waiting game, on its own shard first and
+// then on any other, or open a new one, returns the game id
+int join_game(int shard, player_t *player, outbox_t *box)
 {
-	pthread_mutex_lock(&player_name_lock);
-	for (int i = 0; i < num_player_names; i++)
+	int announce = 1;
+
+	if (player->resume != -1)
+	{
+		// login already claimed the seat, the game hands it the connection
+		command_t *cmd = command_new(CMD_RESUME, player->resume, player);
+		outq_hold(player->out);
+		cmd->player = *player;
+		game_post(player->resume, cmd, box);
+		return player->resume;
+	}
+
+	while (1)
 	{
-		if (strcmp(name, player_names[i]) == 0)
+		for (int i = 0; i < lobby_shards(); i++)
 		{
-			pthread_mutex_unlock(&player_name_lock);
-			return 0;
+			int game_id = pair_player((shard + i) % lobby_shards(), player, box);
+			if (game_id != -1)
+			{
+				return game_id;
+			}
 		}
-	}
 
-	pthread_mutex_unlock(&player_name_lock);
-	return 1;
+		int game_id = open_game(shard, player, box, announce);
+		if (game_id == -1)
+		{
+			return -1;
+		}
+		announce = 0;
+
+		// two players opening games on different shards at the same time would
+		// both wait forever, the later of the two moves over to the earlier
+		if (!older_waiting(shard, get_game(game_id)->ticket) || !withdraw_game(game_id, player))
+		{
+			return game_id;
+		}
+	}
 }
 
-void *handle_client(void *arg)
+// apply one client message to the game, returns 1 once the game is over
+int play_msg(int game_id, player_t *player, outbox_t *box, char *msg, int len)
 {
-	int client_fd = *((int*) arg);
-	free(arg);
-	char *buf;
-	char cmd[50];
-	char msg[50];
-	int game_id = -1;
-	player_t player;
+	command_t *cmd = command_new(CMD_PLAY, game_id, player);
+	message_t decoded;
 
-	// read player name
-	buf = receive_msg(client_fd);
-	if (buf == NULL)
+	if (player->framing != FRAME_BINARY)
 	{
-		close(client_fd);
-		return NULL;
+		log_debug("Received message: %s", msg);
 	}
+	if (codec_decode(player->framing, msg, len, &decoded) < 0 || parse_request(&decoded, board_width(), board_height(), player->role, &cmd->req) == 0)
+	{
+		log_debug("Invalid command");
+	}
+
+	game_post(game_id, cmd, box);
+	return get_game(game_id)->finished;
+}
+
+// give up the player's seat, the game is freed once both players are gone;
+// the name stays with the game, which holds on to it while the seat waits
+// for its player to reconnect
+void leave_game(int game_id, player_t *player, outbox_t *box)
+{
+	game_post(game_id, command_new(CMD_LEAVE, game_id, player), box);
+	player->name[0] = '\0';
+}
+
+// session timeouts in milliseconds, the simulation's counterpart of -T and -R
+void session_timeouts(long handshake, long lobby, long move, long resume)
+{
+	handshake_ms = handshake;
+	lobby_ms = lobby;
+	move_ms = move;
+	resume_ms = resume;
+}
 
-	if (check_name(buf) == 0)
+// what every game depends on once the board shape is known
+void server_setup()
+{
+	if (board_cells() == 9 && board_k() == 3)
 	{
-		write_msg(client_fd, "INVL name already in use\n");
-		close(client_fd);
-		free(buf);
-		return NULL;
+		house_init();
+		house_ready = 1;
 	}
 	else
 	{
-		pthread_mutex_lock(&player_name_lock);
-		strcpy(player_names[num_player_names++], buf);
-		pthread_mutex_unlock(&player_name_lock);
+		shape_len = snprintf(shape, sizeof(shape), "%dx%dx%d", board_width(), board_height(), board_k());
+	}
+}
+
+// when a freshly accepted session's alarm should first go off, 0 for never
+long session_opened(long now)
+{
+	return handshake_ms ? now + handshake_ms : 0;
+}
+
+// the earlier of two times, where 0 means never
+static long earliest(long a, long b)
+{
+	return (a == 0 || (b != 0 && b < a)) ? b : a;
+}
+
+// a session's alarm went off, which only ever happens on the thread that
+// owns the session: a player who never logged in, or whose game is over
+// and still hangs on, is closed (-1), and a player out of time in the lobby
+// or on the move, or whose dropped opponent ran out of time or of grace,
+// has the game end it; returns when to check again, 0 for never
+long session_alarm(int game_id, player_t *player, long now)
+{
+	// a clock or a grace window that starts now runs out no sooner than this
+	long next = earliest(move_ms ? now + move_ms : 0, resume_ms ? now + resume_ms : 0);
+	game_t *game;
+	int index = (player->role == 'X') ? 0 : 1;
+	int due = 0;
+
+	if (game_id == -1)
+	{
+		metric_add(METRIC_HANDSHAKE_TIMEOUTS, 1);
+		return -1;
 	}
 
-	pthread_mutex_lock(&game_lock);
-	for (int i = 0; i < num_games; i++)
+	game = get_game(game_id);
+	switch (atomic_load(&game->status))
 	{
-		if (games[i].status == 0 && strcmp(games[i].players[0].name, buf) != 0)
+	case GAME_WAITING:
+		if (index == 0 && lobby_ms != 0)
 		{
-			// join existing game
-			game_id = i;
-			//strcpy(player.name, buf);
-			sscanf(buf, "%[^\n]", player.name);
-			player.sock_fd = client_fd;
-			player.role = 'O';
-			games[i].players[1] = player;
-			games[i].status = 1;
-			pthread_mutex_unlock(&game_lock);
-			sprintf(buf, "BEGN %c %s", games[i].players[1].role, games[i].players[0].name);
-			write_msg(games[i].players[1].sock_fd, buf);
-			sprintf(buf, "BEGN %c %s", games[i].players[0].role, games[i].players[1].name);
-			write_msg(games[i].players[0].sock_fd, buf);
-			break;
+			long deadline = game->waiting_since / 1000000 + lobby_ms;
+			if (now < deadline)
+			{
+				return (next != 0 && next < deadline) ? next : deadline;
+			}
+			due = 1;
+		}
+		break;
+	case GAME_ACTIVE:
+	{
+		// our own clock, and a dropped opponent's clock and grace window
+		long deadline = atomic_load(&game->move_deadline[index]);
+		long grace = atomic_load(&game->resume_deadline[1 - index]);
+		if (grace != 0)
+		{
+			deadline = earliest(earliest(deadline, grace), atomic_load(&game->move_deadline[1 - index]));
+		}
+		if (deadline != 0 && now < deadline)
+		{
+			return earliest(next, deadline);
 		}
+		due = (deadline != 0);
+		break;
+	}
+	default:
+		return -1;
 	}
 
-	if (game_id == -1)
+	if (due)
 	{
-		// create new game
-		game_id = num_games++;
-		//strcpy(player.name, buf);
-		sscanf(buf, "%[^\n]", player.name);
-		player.sock_fd = client_fd;
-		player.role = 'X';
-		games[game_id].players[0] = player;
-		games[game_id].status = 0;
-		pthread_mutex_init(&games[game_id].lock, NULL);
-		init_board(games[game_id].board);
-		pthread_mutex_unlock(&game_lock);
-		write_msg(client_fd, "WAIT");
-		games[game_id].current_turn = 0;
-	}
-
-	// read player moves
-	while (1)
+		// the replies go out before the session can be closed
+		outbox_t box;
+		outbox_init(&box);
+		game_post(game_id, command_new(CMD_TIMEOUT, game_id, player), &box);
+		outbox_flush(&box);
+		if (game->finished)
+		{
+			return -1;
+		}
+	}
+	return next;
+}
+
+// everything from here on is thread mode and the real server's startup,
+// which the simulation replaces with its own
+#ifndef TTT_SIM
+
+// thread mode times every session on one wheel, run by a thread of its own
+// and locked, since each session arms and cancels its alarm from its own
+// thread; an expired session is woken by shutting its socket down
+typedef struct
+{
+	alarm_t alarm;
+	int fd;
+	int game_id;
+	player_t *player;
+}
+session_t;
+
+static wheel_t session_wheel;
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t session_wake;
+
+static void session_expired(alarm_t *alarm)
+{
+	session_t *session = alarm->ctx;
+	long next = session_alarm(session->game_id, session->player, wheel_now());
+
+	if (next < 0)
+	{
+		shutdown(session->fd, SHUT_RD);
+	}
+	else if (next > 0)
+	{
+		wheel_arm(&session_wheel, alarm, next);
+	}
+}
+
+// rearm the alarm once the session joined a game, returns -1 when the
+// session is over already
+static int session_joined(session_t *session, int game_id)
+{
+	pthread_mutex_lock(&session_lock);
+	session->game_id = game_id;
+	long next = session_alarm(game_id, session->player, wheel_now());
+	if (next > 0)
 	{
-		buf = receive_msg(client_fd);
-		printf("Received message: %s", buf);
+		wheel_arm(&session_wheel, &session->alarm, next);
+		pthread_cond_signal(&session_wake);
+	}
+	pthread_mutex_unlock(&session_lock);
+	return (next < 0) ? -1 : 0;
+}
 
-		if (buf == NULL)
+static void session_cancel(session_t *session)
+{
+	pthread_mutex_lock(&session_lock);
+	wheel_cancel(&session_wheel, &session->alarm);
+	pthread_mutex_unlock(&session_lock);
+}
+
+static void *session_timer(void *arg)
+{
+	(void) arg;
+	pthread_mutex_lock(&session_lock);
+	while (1)
+	{
+		int timeout = wheel_timeout(&session_wheel);
+		if (timeout < 0)
 		{
-			printf("Connection dropped by client %d\n", client_fd);
-			close(client_fd);
-			break;
+			pthread_cond_wait(&session_wake, &session_lock);
 		}
-
-		// process player move
-		pthread_mutex_lock(&games[game_id].lock);
-		if (sscanf(buf, "%s %[^\n]", cmd, msg) == 2)
+		else if (timeout > 0)
 		{
-			if (strcmp(cmd, "MOVE") == 0)
+			struct timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			ts.tv_sec += timeout / 1000;
+			ts.tv_nsec += (timeout % 1000) * 1000000L;
+			if (ts.tv_nsec >= 1000000000L)
 			{
-				char pos[50];
-				char role;
-				if (sscanf(msg, "%c %s", &role, pos) == 2)
-				{
-					printf("Received move: %c %s\n", role, pos);
-					if (validate_move(pos) == 0)
-					{
-						write_msg(client_fd, "INVL Cell out of bounds");
-					}
-					else if(role!=player.role){
-						write_msg(client_fd, "INVL Not your role");
-					}
-					else
-					{
-					 	// Check if it's the current player's turn
-						int player_index = (player.role == games[game_id].players[0].role) ? 0 : 1;
-						if (games[game_id].current_turn != player_index)
-						{
-							write_msg(client_fd, "INVL Not your turn");
-						}
-						else
-						{
-						 	// TODO: process and update the game state based on the move
-							// send updated game state back to both clients
-							int row = pos[0] - '1';
-							int col = pos[2] - '1';
-							int index = row *3 + col;
-							if (games[game_id].board[index] == '.')
-							{
-								games[game_id].board[index] = player.role;
-
-								// Check for win condition
-								if (check_win(games[game_id].board))
-								{
-								 	// Announce winner
-                                    if(strcmp(player.name, games[game_id].players[0].name) == 0)
-                                    {
-                                        sprintf(buf, "OVER L %s won\n%s\n", games[game_id].players[0].name, games[game_id].board);
-                                        write_msg(games[game_id].players[1].sock_fd, buf);
-                                        sprintf(buf, "OVER W %s won\n%s\n", games[game_id].players[0].name,  games[game_id].board);
-                                        write_msg(games[game_id].players[0].sock_fd, buf);
-                                        break;
-                                    }
-                                    else if(strcmp(player.name, games[game_id].players[1].name) == 0)
-                                    {
-										//send final board
-                                        sprintf(buf, "OVER W %s won\n%s\n", games[game_id].players[1].name,  games[game_id].board);
-                                        write_msg(games[game_id].players[1].sock_fd, buf);
-                                        sprintf(buf, "OVER L %s won\n%s\n", games[game_id].players[1].name,  games[game_id].board);
-                                        write_msg(games[game_id].players[0].sock_fd, buf);
-                                        break;
-                                    }
-								}
-								else if (check_draw(games[game_id].board))
-								{
-								 	// Announce draw
-									sprintf(buf, "OVER D Game has ended in a draw.\n");
-									write_msg(games[game_id].players[0].sock_fd, buf);
-									write_msg(games[game_id].players[1].sock_fd, buf);
-									break;
-								}
-
-								if (games[game_id].current_turn == player_index)
-								{
-									sprintf(buf, "MOVD %c %s %s\n", role, pos, games[game_id].board);
-									write_msg(games[game_id].players[0].sock_fd, buf);
-									write_msg(games[game_id].players[1].sock_fd, buf);
-								}
-
-								// Update current turn
-								games[game_id].current_turn = 1 - games[game_id].current_turn;
-							}
-							else
-							{
-							 	// Invalid move (cell already occupied) - inform player
-								write_msg(client_fd, "INVL Cell already occupied");
-							}
-
-							// Send updated game state to both players
-
-						}
-					}
-				}
-				else write_msg(client_fd, "INVL Invalid command");
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
 			}
-            else if (strcmp(cmd, "DRAW") == 0)
-            {
-                // Send other client draw request or process the draw response
-                int player_index = (player.role == games[game_id].players[0].role) ? 0 : 1;
-                int other_player_index = 1 - player_index;
-                if (strcmp(msg, "S") == 0)
-                {
-                    // Send draw request to the other player
-                    write_msg(games[game_id].players[other_player_index].sock_fd, "DRAW S");
-                }
-                else if (strcmp(msg, "A") == 0)
-                {
-                    // The current player accepted the draw request, inform both players
-                    sprintf(buf, "OVER D Game has ended in a draw.\n");
-                    write_msg(games[game_id].players[0].sock_fd, buf);
-                    write_msg(games[game_id].players[1].sock_fd, buf);
-                }
-                else if (strcmp(msg, "R") == 0)
-                {
-                    // The current player declined the draw request, inform the other player
-                    write_msg(games[game_id].players[other_player_index].sock_fd, "DRAW R");
-                }
-				else write_msg(client_fd, "INVL Invalid parameter");
-            }
-		}
-        else if(sscanf(buf, "%s %[^\n]", cmd, msg) == 1){
-            if (strcmp(cmd, "RSGN") == 0)
-            {
-                
-                if(strcmp(player.name, games[game_id].players[1].name) == 0)
-                {
-                    sprintf(buf, "OVER W %s won %s resigned\n", games[game_id].players[0].name, games[game_id].players[1].name);
-                    write_msg(games[game_id].players[0].sock_fd, buf);
-                    sprintf(buf, "OVER L %s won %s resigned\n", games[game_id].players[0].name, games[game_id].players[1].name);
-                    write_msg(games[game_id].players[1].sock_fd, buf);
-                    break;
-                }
-                else if(strcmp(player.name, games[game_id].players[0].name) == 0)
-                {
-                    sprintf(buf, "OVER L %s won %s resigned\n", games[game_id].players[1].name, games[game_id].players[0].name);
-                    write_msg(games[game_id].players[0].sock_fd, buf);
-                    sprintf(buf, "OVER W %s won %s resigned\n", games[game_id].players[1].name, games[game_id].players[0].name);
-                    write_msg(games[game_id].players[1].sock_fd, buf);
-                    break;
-                }
-                close(client_fd);
-				pthread_mutex_unlock(&games[game_id].lock);
-                return NULL;
-            }
-        }
-		else
-		{
-			printf("Invalid command.\n");
+			pthread_cond_timedwait(&session_wake, &session_lock, &ts);
 		}
+		wheel_run(&session_wheel, wheel_now());
+	}
+	return NULL;
+}
 
-		pthread_mutex_unlock(&games[game_id].lock);
+static void session_timer_start()
+{
+	pthread_condattr_t attr;
+	pthread_t thread;
+
+	wheel_init(&session_wheel);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&session_wake, &attr);
+	if (pthread_create(&thread, NULL, session_timer, NULL) != 0)
+	{
+		perror("pthread_create");
+		exit(1);
 	}
+	pthread_detach(thread);
+}
 
-	// player disconnected
-	if (game_id != -1)
+void *handle_client(void *arg)
+{
+	int client_fd = (int) (intptr_t) arg;
+	char buf[MAX_MSG_LEN];
+	msgbuf_t in;
+	outbox_t box;
+	int game_id = -1;
+	int len = 0;
+	player_t player;
+	session_t session = { .fd = client_fd, .game_id = -1, .player = &player };
+
+	player.name[0] = '\0';
+	player.sock_fd = client_fd;
+	player.out = outq_new(client_fd);
+	outbox_init(&box);
+
+	// read player name, before the handshake deadline
+	alarm_init(&session.alarm, session_expired, &session);
+	long expires = session_opened(wheel_now());
+	if (expires > 0)
 	{
-		// inform the other player that the game has ended
-		char buf[2500];	// increase buffer size
-		if (client_fd == games[game_id].players[0].sock_fd && games[game_id].players[1].sock_fd != -1)
+		pthread_mutex_lock(&session_lock);
+		wheel_arm(&session_wheel, &session.alarm, expires);
+		pthread_cond_signal(&session_wake);
+		pthread_mutex_unlock(&session_lock);
+	}
+	msgbuf_init(&in, FRAME_DETECT);
+	int named = read_msg(&in, client_fd, buf, sizeof(buf));
+	session_cancel(&session);
+	if (named >= 0)
+	{
+		metric_add(METRIC_BYTES_IN, in.tail);
+		if (login(&player, &box, buf))
 		{
-			snprintf(buf, sizeof(buf), "Player %s disconnected.", games[game_id].players[0].name);
-			write_msg(games[game_id].players[1].sock_fd, buf);
+			in.framing = player.framing;
+			game_id = join_game(0, &player, &box);
 		}
-		else if (client_fd == games[game_id].players[1].sock_fd && games[game_id].players[0].sock_fd != -1)
+		outbox_flush(&box);
+		if (game_id != -1 && session_joined(&session, game_id) < 0)
 		{
-			snprintf(buf, sizeof(buf), "Player %s disconnected.", games[game_id].players[1].name);
-			write_msg(games[game_id].players[0].sock_fd, buf);
+			len = -1;
 		}
+	}
 
-		if (client_fd == games[game_id].players[0].sock_fd)
+	// read player moves, answering everything one read delivered with one flush
+	while (game_id != -1 && len >= 0)
+	{
+		while ((len = msgbuf_next(&in, buf, sizeof(buf))) > 0)
 		{
-			if (games[game_id].status == 0)
-			{
-			 	// player 0 disconnected before game started
-				pthread_mutex_lock(&game_lock);
-				for (int i = 0; i < num_games; i++)
-				{
-					if (i == game_id)
-					{
-						continue;
-					}
-
-					if (games[i].status == 0 && games[i].players[0].sock_fd == -1)
-					{
-					 	// take over empty slot in other game
-						games[i].players[0] = games[game_id].players[1];
-						games[i].status = 1;
-						pthread_mutex_unlock(&game_lock);
-						sprintf(buf, "BEGN %s\n", games[i].players[0].name);
-						write_msg(games[i].players[1].sock_fd, buf);
-						sprintf(buf, "BEGN %s\n", games[i].players[1].name);
-						write_msg(games[i].players[0].sock_fd, buf);
-						break;
-					}
-				}
-
-				if (game_id == num_games - 1)
-				{
-				 	// remove empty game from list
-					num_games--;
-				}
-				else
-				{
-				 	// move last game in list to empty spot
-					games[game_id] = games[num_games - 1];
-					num_games--;
-				}
-
-				pthread_mutex_unlock(&game_lock);
-			}
-			else
+			if (play_msg(game_id, &player, &box, buf, len))
 			{
-			 	// player 0 disconnected during game
-				games[game_id].players[0].sock_fd = -1;
-				pthread_mutex_unlock(&games[game_id].lock);
+				len = -1;
+				break;
 			}
 		}
-		else if (client_fd == games[game_id].players[1].sock_fd)
+		outbox_flush(&box);
+
+		if (len == 0)
 		{
-			// player 1 disconnected
-			if (games[game_id].status == 0)
+			int bytes_read = msgbuf_fill(&in, client_fd);
+			if (bytes_read <= 0)
 			{
-			 	// player 1 disconnected before game started
-				pthread_mutex_lock(&game_lock);
-				for (int i = 0; i < num_games; i++)
-				{
-					if (i == game_id)
-					{
-						continue;
-					}
-
-					if (games[i].status == 0 && games[i].players[0].sock_fd == -1)
-					{
-					 	// take over empty slot in other game
-						games[i].players[0] = games[game_id].players[0];
-						games[i].status = 1;
-						pthread_mutex_unlock(&game_lock);
-						sprintf(buf, "BEGN %s\n", games[i].players[0].name);
-						write_msg(games[i].players[1].sock_fd, buf);
-						sprintf(buf, "BEGN %s\n", games[i].players[1].name);
-						write_msg(games[i].players[0].sock_fd, buf);
-						break;
-					}
-				}
-
-				if (game_id == num_games - 1)
-				{
-				 	// remove empty game from list
-					num_games--;
-				}
-				else{
-				 	//move last game in list to empty spot
-					games[game_id] = games[num_games - 1];
-					num_games--;
-				}
-
-				pthread_mutex_unlock(&game_lock);
+				len = -1;
 			}
-			else{
-			 	// player 1 disconnected during game
-				games[game_id].players[1].sock_fd = -1;
-				pthread_mutex_unlock(&games[game_id].lock);
+			else
+			{
+				metric_add(METRIC_BYTES_IN, bytes_read);
 			}
 		}
-
-		close(client_fd);
 	}
 
-	// cleanup thread resources
-	free(buf);
-	pthread_join(pthread_self(), NULL);
-
+	// player disconnected or game finished
+	session_cancel(&session);
+	if (game_id != -1)
+	{
+		leave_game(game_id, &player, &box);
+		outbox_flush(&box);
+	}
+	logout(&player);
+	outq_close(player.out);
+	outq_put(player.out);
+	close(client_fd);
 	return NULL;
 }
 
-int main(){
-	int server_fd, client_fd;
+// lift the open file limit so one reactor can hold thousands of sockets
+static void raise_fd_limit()
+{
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+// bind a listening socket to port, with SO_REUSEPORT when several event
+// loops each need a listener of their own on the same port
+static int open_listener(int port, int reuseport)
+{
 	struct sockaddr_in address;
-	int addrlen = sizeof(address);
-	pthread_t client_thread;
 
 	// create server socket
-	server_fd = socket(AF_INET, SOCK_STREAM, 0);
+	int server_fd = socket(AF_INET, SOCK_STREAM, 0);
 	if (server_fd < 0){
 		perror("socket");
 		exit(1);
@@ -440,11 +1504,15 @@ int main(){
 		perror("setsockopt");
 		exit(1);
 	}
+	if (reuseport && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &reuseport, sizeof(reuseport)) < 0){
+		perror("setsockopt");
+		exit(1);
+	}
 
 	// set server address
 	address.sin_family = AF_INET;
 	address.sin_addr.s_addr = INADDR_ANY;
-	address.sin_port = htons(PORT);
+	address.sin_port = htons(port);
 
 	// bind server socket to address
 	if (bind(server_fd, (struct sockaddr *) &address, sizeof(address)) < 0){
@@ -453,11 +1521,139 @@ int main(){
 	}
 
 	// start listening for connections
-	if (listen(server_fd, MAX_CLIENTS) < 0){
+	if (listen(server_fd, SOMAXCONN) < 0){
 		perror("listen");
 		exit(1);
 	}
+	return server_fd;
+}
+
+int main(int argc, char *argv[]){
+	int server_fd, client_fd;
+	struct sockaddr_in address;
+	int addrlen = sizeof(address);
+	pthread_t client_thread;
+	int use_epoll = 0;
+	int use_uring = 0;
+	int loops = 1;
+	int port = PORT;
+	int admin_port = 0;
+	int log_level = LOG_INFO;
+	const char *record_dir = NULL;
+	int width, height, k;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:p:a:t:l:r:b:T:R:")) != -1)
+	{
+		if (opt == 'm' && strcmp(optarg, "epoll") == 0)
+		{
+			use_epoll = 1;
+			use_uring = 0;
+		}
+		else if (opt == 'm' && strcmp(optarg, "uring") == 0)
+		{
+			use_epoll = 1;
+			use_uring = 1;
+		}
+		else if (opt == 'm' && strcmp(optarg, "thread") == 0)
+		{
+			use_epoll = 0;
+			use_uring = 0;
+		}
+		else if (opt == 'p')
+		{
+			port = atoi(optarg);
+		}
+		else if (opt == 'a')
+		{
+			admin_port = atoi(optarg);
+		}
+		else if (opt == 't')
+		{
+			loops = atoi(optarg);
+		}
+		else if (opt == 'l' && log_parse_level(optarg) != -1)
+		{
+			log_level = log_parse_level(optarg);
+		}
+		else if (opt == 'r')
+		{
+			record_dir = optarg;
+		}
+		else if (opt == 'b' && sscanf(optarg, "%dx%dx%d", &width, &height, &k) == 3 && board_configure(width, height, k) == 0)
+		{
+			// every game on this server uses the same board
+		}
+		else if (opt == 'T' && sscanf(optarg, "%ld,%ld,%ld", &handshake_ms, &lobby_ms, &move_ms) == 3)
+		{
+			// given in seconds
+			handshake_ms *= 1000;
+			lobby_ms *= 1000;
+			move_ms *= 1000;
+		}
+		else if (opt == 'R' && sscanf(optarg, "%ld", &resume_ms) == 1)
+		{
+			// seconds a dropped player may take to come back, 0 for never
+			resume_ms *= 1000;
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [-m thread|epoll|uring] [-t loops] [-p port] [-a admin_port] [-l debug|info|warn|error|off] [-r record_dir] [-b WxHxK] [-T handshake,lobby,move] [-R resume]\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	// a peer closing mid-write must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+	log_start(log_level);
+	watch_start();
+	server_setup();
+
+	if (admin_port != 0 && metrics_listen(admin_port) < 0)
+	{
+		exit(1);
+	}
+	if (record_dir != NULL && journal_open(record_dir) < 0)
+	{
+		exit(1);
+	}
+
+	if (use_uring)
+	{
+		// a single loop, epoll takes over when the kernel lacks io_uring
+		// or provided buffer rings
+		int listen_fd = open_listener(port, 0);
+		raise_fd_limit();
+		if (run_uring(listen_fd) < 0)
+		{
+			fprintf(stderr, "io_uring unavailable, falling back to epoll\n");
+			run_reactors(&listen_fd, 1);
+		}
+		return 0;
+	}
+
+	if (use_epoll)
+	{
+		// -t 0 runs one event loop per online core
+		if (loops <= 0)
+		{
+			loops = sysconf(_SC_NPROCESSORS_ONLN);
+		}
+		loops = (loops < 1) ? 1 : (loops > MAX_SHARDS) ? MAX_SHARDS : loops;
+
+		int listen_fds[MAX_SHARDS];
+		for (int i = 0; i < loops; i++)
+		{
+			listen_fds[i] = open_listener(port, loops > 1);
+		}
+		raise_fd_limit();
+		run_reactors(listen_fds, loops);
+		return 0;
+	}
 
+	lobby_init(1);
+	session_timer_start();
+	server_fd = open_listener(port, 0);
 	while (1)
 	{
 		// accept client connection
@@ -466,23 +1662,21 @@ int main(){
 			perror("accept");
 			exit(1);
 		}
+		int nodelay = 1;
+		metric_add(METRIC_ACCEPTS, 1);
+		setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
 
-		int *client_fd_ptr = malloc(sizeof(int));
-		*client_fd_ptr = client_fd;
-		// create thread to handle client
-		if (pthread_create(&client_thread, NULL, handle_client, client_fd_ptr) != 0) {
+		// create thread to handle client, the fd travels in the argument itself
+		if (pthread_create(&client_thread, NULL, handle_client, (void *) (intptr_t) client_fd) != 0) {
 			perror("pthread_create");
 			exit(1);
 		}
 
-		if (pthread_mutex_init(&player_name_lock, NULL) != 0) {
-			perror("pthread_mutex_init");
-			exit(1);
-		}
-
 		pthread_detach(client_thread);
 	}
 
 	close(server_fd);
 	return 0;
 }
+
+#endif // TTT_SIM
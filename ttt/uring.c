@@ -0,0 +1,395 @@
+// io_uring, syscall() and MAP_POPULATE are Linux extensions outside of _XOPEN_SOURCE
+#define _DEFAULT_SOURCE
+
+#include "reactor.h"
+#include "metrics.h"
+#include "lobby.h"
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#define URING_ENTRIES 4096
+#define RECV_GROUP 0
+#define RECV_BUFS 4096      // provided receive buffers, a power of two
+#define RECV_BUF_SIZE 512
+
+// what a completion belongs to, kept in the low bits of user_data; the
+// connections and output queues it points at are 16 byte aligned
+#define UD_RECV 0
+#define UD_ACCEPT 1
+#define UD_SEND 2
+#define UD_CANCEL 3
+#define UD_MASK 3
+
+// a connection is only freed once its multishot recv has ended
+typedef struct
+{
+	conn_t conn;
+	int recv_armed;
+	int closing;
+}
+uconn_t;
+
+// the submission and completion rings shared with the kernel, and the ring
+// of buffers the kernel fills with whatever the sockets receive
+typedef struct
+{
+	int fd;
+	int listen_fd;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_array;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int sq_local;
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+	struct io_uring_buf_ring *bufs;
+	char *buf_data;
+	wheel_t wheel;
+}
+uring_t;
+
+static uring_t ring;
+static pool_t uconn_pool = POOL_INITIALIZER(uconn_t);
+
+static int uring_enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags, void *arg, size_t arg_size)
+{
+	return syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+// hand every prepared entry to the kernel, optionally waiting for a completion
+// but no longer than the next alarm of the wheel
+static int uring_submit(int wait)
+{
+	unsigned int pending = ring.sq_local - *ring.sq_tail;
+	atomic_store_explicit((_Atomic unsigned int *) ring.sq_tail, ring.sq_local, memory_order_release);
+
+	int timeout = wait ? wheel_timeout(&ring.wheel) : -1;
+	if (timeout >= 0)
+	{
+		struct __kernel_timespec ts = { timeout / 1000, (timeout % 1000) * 1000000L };
+		struct io_uring_getevents_arg arg;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (uintptr_t) &ts;
+		return uring_enter(pending, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	}
+	return uring_enter(pending, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static struct io_uring_sqe *uring_sqe()
+{
+	unsigned int head = atomic_load_explicit((_Atomic unsigned int *) ring.sq_head, memory_order_acquire);
+	if (ring.sq_local - head == ring.sq_entries)
+	{
+		uring_submit(0);
+	}
+
+	unsigned int index = ring.sq_local & ring.sq_mask;
+	struct io_uring_sqe *sqe = &ring.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring.sq_array[index] = index;
+	ring.sq_local++;
+	return sqe;
+}
+
+// give a receive buffer back to the kernel
+static void recv_buf_return(int bid)
+{
+	unsigned short tail = ring.bufs->tail;
+	struct io_uring_buf *buf = &ring.bufs->bufs[tail & (RECV_BUFS - 1)];
+	buf->addr = (unsigned long) (ring.buf_data + (long) bid * RECV_BUF_SIZE);
+	buf->len = RECV_BUF_SIZE;
+	buf->bid = bid;
+	atomic_store_explicit((_Atomic unsigned short *) &ring.bufs->tail, tail + 1, memory_order_release);
+}
+
+// map the rings and register the receive buffers, -1 when the kernel
+// lacks any of it
+static int uring_setup(int listen_fd)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = URING_ENTRIES * 4;
+	ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (ring.fd < 0)
+	{
+		return -1;
+	}
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_EXT_ARG))
+	{
+		close(ring.fd);
+		return -1;
+	}
+
+	size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	char *rings = mmap(NULL, sq_size > cq_size ? sq_size : cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+	ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	if (rings == MAP_FAILED || ring.sqes == MAP_FAILED)
+	{
+		close(ring.fd);
+		return -1;
+	}
+
+	ring.sq_head = (unsigned int *) (rings + p.sq_off.head);
+	ring.sq_tail = (unsigned int *) (rings + p.sq_off.tail);
+	ring.sq_array = (unsigned int *) (rings + p.sq_off.array);
+	ring.sq_mask = *(unsigned int *) (rings + p.sq_off.ring_mask);
+	ring.sq_entries = *(unsigned int *) (rings + p.sq_off.ring_entries);
+	ring.sq_local = *ring.sq_tail;
+	ring.cq_head = (unsigned int *) (rings + p.cq_off.head);
+	ring.cq_tail = (unsigned int *) (rings + p.cq_off.tail);
+	ring.cq_mask = *(unsigned int *) (rings + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *) (rings + p.cq_off.cqes);
+
+	// the buffer ring has to be page aligned, which mmap guarantees
+	ring.bufs = mmap(NULL, RECV_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ring.buf_data = malloc((size_t) RECV_BUFS * RECV_BUF_SIZE);
+	if (ring.bufs == MAP_FAILED || ring.buf_data == NULL)
+	{
+		close(ring.fd);
+		return -1;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long) ring.bufs;
+	reg.ring_entries = RECV_BUFS;
+	reg.bgid = RECV_GROUP;
+	if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		close(ring.fd);
+		return -1;
+	}
+	ring.bufs->tail = 0;
+	for (int i = 0; i < RECV_BUFS; i++)
+	{
+		recv_buf_return(i);
+	}
+
+	ring.listen_fd = listen_fd;
+	wheel_init(&ring.wheel);
+	return 0;
+}
+
+static void arm_accept()
+{
+	struct io_uring_sqe *sqe = uring_sqe();
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = ring.listen_fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->user_data = UD_ACCEPT;
+}
+
+// one recv keeps delivering into provided buffers until it ends or is cancelled
+static void arm_recv(uconn_t *uc)
+{
+	struct io_uring_sqe *sqe = uring_sqe();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = uc->conn.fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = RECV_GROUP;
+	sqe->user_data = (uintptr_t) uc | UD_RECV;
+	uc->recv_armed = 1;
+}
+
+// output queue hook: every send of a batch of completions goes out with the
+// next io_uring_enter, so both MOVD copies of a move leave in one syscall
+static void uring_send(outq_t *q, const char *data, unsigned int len)
+{
+	struct io_uring_sqe *sqe = uring_sqe();
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = q->fd;
+	sqe->addr = (uintptr_t) data;
+	sqe->len = len;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = (uintptr_t) q | UD_SEND;
+}
+
+static void uconn_close(uconn_t *uc, outbox_t *box)
+{
+	int lingering = conn_end(&uc->conn, box);
+	// the last replies must reach the kernel while the descriptor is open,
+	// the sends keep the socket alive past close() on their own, and a queue
+	// with more behind its send closes the socket once that is out too
+	uring_submit(0);
+	if (!lingering)
+	{
+		close(uc->conn.fd);
+	}
+	uc->closing = 1;
+	if (uc->recv_armed)
+	{
+		// freed once the recv reports that it has ended
+		struct io_uring_sqe *sqe = uring_sqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = (uintptr_t) uc | UD_RECV;
+		sqe->user_data = UD_CANCEL;
+	}
+	else
+	{
+		pool_put(&uconn_pool, uc);
+	}
+}
+
+static void uconn_expired(alarm_t *alarm)
+{
+	uconn_t *uc = alarm->ctx;
+	outbox_t box;
+
+	if (conn_alarm(&uc->conn) < 0)
+	{
+		outbox_init(&box);
+		uconn_close(uc, &box);
+	}
+}
+
+static void on_accept(struct io_uring_cqe *cqe)
+{
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+	{
+		arm_accept();
+	}
+	if (cqe->res < 0)
+	{
+		return;
+	}
+
+	int nodelay = 1;
+	metric_add(METRIC_ACCEPTS, 1);
+	setsockopt(cqe->res, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+	uconn_t *uc = pool_get(&uconn_pool);
+	conn_init(&uc->conn, cqe->res, 0);
+	uc->conn.loop = &ring;
+	uc->conn.player.out->submit = uring_send;
+	uc->closing = 0;
+	conn_start(&uc->conn, &ring.wheel, uconn_expired, uc);
+	arm_recv(uc);
+}
+
+static void on_recv(uconn_t *uc, struct io_uring_cqe *cqe)
+{
+	outbox_t box;
+	int over = 0;
+
+	outbox_init(&box);
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+	{
+		uc->recv_armed = 0;
+	}
+
+	if (cqe->flags & IORING_CQE_F_BUFFER)
+	{
+		int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		const char *data = ring.buf_data + (long) bid * RECV_BUF_SIZE;
+		int len = cqe->res;
+
+		if (!uc->closing && len > 0)
+		{
+			metric_add(METRIC_BYTES_IN, len);
+		}
+		// a buffer can be larger than what the input ring has room for
+		while (!uc->closing && !over && len > 0)
+		{
+			int n = msgbuf_put(&uc->conn.in, data, len);
+			data += n;
+			len -= n;
+			over = (conn_process(&uc->conn, &box) < 0 || n == 0);
+		}
+		recv_buf_return(bid);
+	}
+	else if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS))
+	{
+		// peer closed, or the recv failed or was cancelled
+		over = 1;
+	}
+
+	if (uc->closing)
+	{
+		if (!uc->recv_armed)
+		{
+			pool_put(&uconn_pool, uc);
+		}
+		return;
+	}
+	if (over)
+	{
+		uconn_close(uc, &box);
+		return;
+	}
+	if (!uc->recv_armed)
+	{
+		// ran out of provided buffers or the kernel ended the multishot
+		arm_recv(uc);
+	}
+	outbox_flush(&box);
+}
+
+// single io_uring loop, returns -1 right away when the kernel cannot run it
+// so the caller can fall back to epoll
+int run_uring(int listen_fd)
+{
+	if (uring_setup(listen_fd) < 0)
+	{
+		return -1;
+	}
+
+	lobby_init(1);
+	arm_accept();
+	while (1)
+	{
+		if (uring_submit(1) < 0 && errno != EINTR && errno != EBUSY && errno != ETIME)
+		{
+			perror("io_uring_enter");
+			exit(1);
+		}
+
+		unsigned int head = *ring.cq_head;
+		unsigned int tail = atomic_load_explicit((_Atomic unsigned int *) ring.cq_tail, memory_order_acquire);
+		for (; head != tail; head++)
+		{
+			struct io_uring_cqe *cqe = &ring.cqes[head & ring.cq_mask];
+			void *ptr = (void *) (uintptr_t) (cqe->user_data & ~(uint64_t) UD_MASK);
+
+			switch (cqe->user_data & UD_MASK)
+			{
+			case UD_RECV:
+				on_recv(ptr, cqe);
+				break;
+			case UD_ACCEPT:
+				if (ptr == NULL)
+				{
+					on_accept(cqe);
+				}
+				break;
+			case UD_SEND:
+				outq_sent(ptr, cqe->res);
+				break;
+			default:
+				break;
+			}
+		}
+		atomic_store_explicit((_Atomic unsigned int *) ring.cq_head, head, memory_order_release);
+		wheel_run(&ring.wheel, wheel_now());
+	}
+	return 0;
+}
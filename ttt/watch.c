@@ -0,0 +1,557 @@
+#include "watch.h"
+#include "server.h"
+#include "lobby.h"
+#include "protocol.h"
+#include "mailbox.h"
+#include "metrics.h"
+#include "pool.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define WATCH_BUCKETS 4096      // feeds by game id, a power of two
+#define WATCH_QUEUE 64          // broadcasts a spectator may fall behind by, a power of two
+#define WATCH_IOV 16            // queued broadcasts sent per sendmsg()
+#define WATCH_EVENTS 256
+#define BCAST_SIZE 640          // a text line and a binary frame of the largest message
+
+// what the broadcast thread is told, each kind of mail starts with its kind
+#define POST_OPEN 0
+#define POST_HEADER 1
+#define POST_EVENT 2
+#define POST_END 3
+#define POST_REFUSE 4
+
+typedef struct
+{
+	mail_t mail;
+	int type;
+}
+post_t;
+
+// one message in both encodings, immutable once posted; only the broadcast
+// thread counts references to it, so sharing it needs no atomics
+typedef struct
+{
+	mail_t mail;
+	int type;
+	feed_t *feed;
+	int refs;
+	short text_len;
+	short frame_len;
+	char data[BCAST_SIZE];      // the text line, then the binary frame
+}
+bcast_t;
+
+// one spectator socket and the broadcasts it has yet to send
+typedef struct watcher
+{
+	mail_t mail;
+	int type;
+	int fd;
+	int binary;
+	int game_id;
+	feed_t *feed;
+	struct watcher *prev;
+	struct watcher *next;
+	struct watcher *dirty;      // next watcher with something new to send
+	int queued;                 // on the dirty list
+	int closing;                // close as soon as the queue drained
+	int dropped;                // fell too far behind, close right away
+	int writable;               // waiting for EPOLLOUT
+	unsigned int head;
+	unsigned int tail;
+	int offset;                 // bytes of the oldest broadcast already sent
+	bcast_t *queue[WATCH_QUEUE];
+}
+watcher_t;
+
+// the spectators of one game; the game holds it from the moment it attached
+// it until it posts the feed's end, the broadcast thread frees it once the
+// end arrived and its last spectator is gone
+struct feed
+{
+	mail_t mail;
+	int type;
+	int game_id;
+	int ended;
+	bcast_t *header;
+	bcast_t *last;
+	watcher_t *watchers;
+	struct feed *next;          // bucket chain
+};
+
+static mailbox_t box;
+static int wake_fd = -1;
+static int epoll_fd = -1;
+static feed_t *feeds[WATCH_BUCKETS];
+static watcher_t *dirty = NULL;
+static pool_t bcast_pool = POOL_INITIALIZER(bcast_t);
+static pool_t watcher_pool = POOL_INITIALIZER(watcher_t);
+static pool_t feed_pool = POOL_INITIALIZER(feed_t);
+
+// hand mail to the broadcast thread, waking it when it went idle
+static void post(mail_t *mail)
+{
+	uint64_t one = 1;
+	if (mailbox_post(&box, mail) && write(wake_fd, &one, sizeof(one)) < 0)
+	{
+		log_warn("watch wakeup: %m");
+	}
+}
+
+// both encodings of the message, the binary frame after the text line
+static bcast_t *bcast_new(int type, feed_t *feed, const message_t *m)
+{
+	bcast_t *msg = pool_get(&bcast_pool);
+	int text_len = codec_encode(FRAME_LINE, m, msg->data, BCAST_SIZE - BIN_HEADER - BIN_MAX_PAYLOAD);
+
+	msg->type = type;
+	msg->feed = feed;
+	msg->refs = 1;
+	msg->text_len = (text_len < 0) ? 0 : text_len;
+	msg->frame_len = codec_encode(FRAME_BINARY, m, msg->data + msg->text_len, BIN_HEADER + BIN_MAX_PAYLOAD);
+	return msg;
+}
+
+static void bcast_put(bcast_t *msg)
+{
+	if (msg != NULL && --msg->refs == 0)
+	{
+		pool_put(&bcast_pool, msg);
+	}
+}
+
+static void watcher_arm(watcher_t *w, int writable)
+{
+	struct epoll_event ev;
+
+	if (w->writable == writable)
+	{
+		return;
+	}
+	w->writable = writable;
+	ev.events = writable ? EPOLLIN | EPOLLOUT | EPOLLRDHUP : EPOLLIN | EPOLLRDHUP;
+	ev.data.ptr = w;
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, w->fd, &ev);
+}
+
+static void feed_free(feed_t *feed)
+{
+	bcast_put(feed->header);
+	bcast_put(feed->last);
+	pool_put(&feed_pool, feed);
+}
+
+static void watcher_close(watcher_t *w)
+{
+	feed_t *feed = w->feed;
+
+	if (w->prev != NULL)
+	{
+		w->prev->next = w->next;
+	}
+	else
+	{
+		feed->watchers = w->next;
+	}
+	if (w->next != NULL)
+	{
+		w->next->prev = w->prev;
+	}
+	for (; w->head != w->tail; w->head++)
+	{
+		bcast_put(w->queue[w->head & (WATCH_QUEUE - 1)]);
+	}
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->fd, NULL);
+	close(w->fd);
+	if (w->queued)
+	{
+		// still linked on the dirty list, flush_dirty() frees it
+		w->fd = -1;
+	}
+	else
+	{
+		pool_put(&watcher_pool, w);
+	}
+	if (feed->ended && feed->watchers == NULL)
+	{
+		feed_free(feed);
+	}
+}
+
+// send as much of the queue as the socket takes, straight out of the shared
+// buffers; returns -1 once the spectator is done with
+static int watcher_flush(watcher_t *w)
+{
+	while (w->head != w->tail)
+	{
+		struct iovec iov[WATCH_IOV];
+		struct msghdr mh;
+		int n = 0;
+
+		for (unsigned int i = w->head; i != w->tail && n < WATCH_IOV; i++, n++)
+		{
+			bcast_t *msg = w->queue[i & (WATCH_QUEUE - 1)];
+			int skip = (n == 0) ? w->offset : 0;
+			iov[n].iov_base = msg->data + (w->binary ? msg->text_len : 0) + skip;
+			iov[n].iov_len = (w->binary ? msg->frame_len : msg->text_len) - skip;
+		}
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov = iov;
+		mh.msg_iovlen = n;
+
+		ssize_t sent = sendmsg(w->fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			watcher_arm(w, 1);
+			return 0;
+		}
+		if (sent < 0)
+		{
+			return -1;
+		}
+
+		metric_add(METRIC_BYTES_OUT, sent);
+		for (int i = 0; i < n && sent > 0; i++)
+		{
+			if ((size_t) sent < iov[i].iov_len)
+			{
+				w->offset += sent;
+				break;
+			}
+			sent -= iov[i].iov_len;
+			bcast_put(w->queue[w->head++ & (WATCH_QUEUE - 1)]);
+			w->offset = 0;
+		}
+	}
+	watcher_arm(w, 0);
+	return w->closing ? -1 : 0;
+}
+
+// queue a reference for the spectator, it is sent after the current batch
+static void watcher_push(watcher_t *w, bcast_t *msg)
+{
+	if (w->tail - w->head == WATCH_QUEUE)
+	{
+		// too far behind to ever catch up, the players do not wait for it
+		if (!w->dropped)
+		{
+			metric_add(METRIC_SPECTATOR_DROPS, 1);
+		}
+		w->dropped = 1;
+	}
+	else
+	{
+		msg->refs++;
+		w->queue[w->tail++ & (WATCH_QUEUE - 1)] = msg;
+	}
+	if (!w->queued)
+	{
+		w->queued = 1;
+		w->dirty = dirty;
+		dirty = w;
+	}
+}
+
+// one sendmsg() per spectator for everything a mailbox batch queued
+static void flush_dirty()
+{
+	while (dirty != NULL)
+	{
+		watcher_t *w = dirty;
+		dirty = w->dirty;
+		w->queued = 0;
+		if (w->fd == -1)
+		{
+			pool_put(&watcher_pool, w);
+		}
+		else if (w->dropped || watcher_flush(w) < 0)
+		{
+			watcher_close(w);
+		}
+	}
+}
+
+static feed_t **feed_slot(int game_id)
+{
+	feed_t **slot = &feeds[(unsigned int) game_id & (WATCH_BUCKETS - 1)];
+	while (*slot != NULL && (*slot)->game_id != game_id)
+	{
+		slot = &(*slot)->next;
+	}
+	return slot;
+}
+
+// no spectator can find the feed any more, the ones it has leave once
+// everything queued for them is out
+static void feed_close(feed_t *feed)
+{
+	feed_t **slot = feed_slot(feed->game_id);
+	if (*slot == feed)
+	{
+		*slot = feed->next;
+	}
+	feed->ended = 1;
+	for (watcher_t *w = feed->watchers; w != NULL; w = w->next)
+	{
+		w->closing = 1;
+		if (!w->queued)
+		{
+			w->queued = 1;
+			w->dirty = dirty;
+			dirty = w;
+		}
+	}
+	if (feed->watchers == NULL)
+	{
+		feed_free(feed);
+	}
+}
+
+// ask the game to attach the feed once its current command is done;
+// whichever side takes the request back out answers it
+static int feed_request(feed_t *feed)
+{
+	feed_t *none = NULL;
+
+	if (!game_exists(feed->game_id))
+	{
+		return -1;
+	}
+	game_t *game = get_game(feed->game_id);
+	if (game->status != GAME_ACTIVE || !atomic_compare_exchange_strong(&game->watch_request, &none, feed))
+	{
+		return -1;
+	}
+	if (game->status != GAME_ACTIVE && atomic_exchange(&game->watch_request, NULL) == feed)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+static void refuse(feed_t *feed)
+{
+	message_t invl;
+	message_init(&invl, OP_INVL);
+	message_field(&invl, "No such game", 12);
+	message_payload(&invl, "No such game", 12);
+
+	bcast_t *msg = bcast_new(POST_REFUSE, feed, &invl);
+	for (watcher_t *w = feed->watchers; w != NULL; w = w->next)
+	{
+		watcher_push(w, msg);
+	}
+	bcast_put(msg);
+	feed_close(feed);
+}
+
+static void watch_run(mail_t *mail, void *ctx)
+{
+	post_t *p = (post_t *) mail;
+
+	(void) ctx;
+	if (p->type == POST_OPEN)
+	{
+		watcher_t *w = (watcher_t *) mail;
+		feed_t **slot = feed_slot(w->game_id);
+		feed_t *feed = *slot;
+		int fresh = (feed == NULL);
+		struct epoll_event ev;
+
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.ptr = w;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, w->fd, &ev) < 0)
+		{
+			log_warn("epoll_ctl: %m");
+			close(w->fd);
+			pool_put(&watcher_pool, w);
+			return;
+		}
+		if (fresh)
+		{
+			feed = pool_get(&feed_pool);
+			memset(feed, 0, sizeof(*feed));
+			feed->game_id = w->game_id;
+			*slot = feed;
+		}
+		w->feed = feed;
+		w->next = feed->watchers;
+		if (feed->watchers != NULL)
+		{
+			feed->watchers->prev = w;
+		}
+		feed->watchers = w;
+
+		// a late spectator starts from the names and the board so far
+		if (feed->header != NULL)
+		{
+			watcher_push(w, feed->header);
+		}
+		if (feed->last != NULL)
+		{
+			watcher_push(w, feed->last);
+		}
+		if (fresh && feed_request(feed) < 0)
+		{
+			refuse(feed);
+		}
+	}
+	else if (p->type == POST_HEADER || p->type == POST_EVENT)
+	{
+		bcast_t *msg = (bcast_t *) mail;
+		feed_t *feed = msg->feed;
+		bcast_t **keep = (p->type == POST_HEADER) ? &feed->header : &feed->last;
+
+		for (watcher_t *w = feed->watchers; w != NULL; w = w->next)
+		{
+			watcher_push(w, msg);
+		}
+		bcast_put(*keep);
+		*keep = msg;
+	}
+	else if (p->type == POST_END)
+	{
+		feed_close((feed_t *) mail);
+	}
+	else if (p->type == POST_REFUSE)
+	{
+		refuse((feed_t *) mail);
+	}
+}
+
+// a spectator wrote something or hung up, only the hangup matters
+static void watcher_input(watcher_t *w)
+{
+	char buf[256];
+	ssize_t n;
+
+	while ((n = read(w->fd, buf, sizeof(buf))) > 0)
+		;
+	if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+	{
+		watcher_close(w);
+	}
+}
+
+static void *watch_loop(void *arg)
+{
+	struct epoll_event events[WATCH_EVENTS];
+
+	(void) arg;
+	while (1)
+	{
+		int n = epoll_wait(epoll_fd, events, WATCH_EVENTS, -1);
+		if (n < 0 && errno != EINTR)
+		{
+			perror("epoll_wait");
+			exit(1);
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			watcher_t *w = events[i].data.ptr;
+			if (w == NULL)
+			{
+				uint64_t count;
+				if (read(wake_fd, &count, sizeof(count)) > 0)
+				{
+					mailbox_drain(&box, watch_run, NULL);
+				}
+			}
+			else if ((events[i].events & EPOLLOUT) && watcher_flush(w) < 0)
+			{
+				watcher_close(w);
+			}
+			else if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+			{
+				watcher_input(w);
+			}
+		}
+		flush_dirty();
+	}
+	return NULL;
+}
+
+void watch_start()
+{
+	struct epoll_event ev;
+	pthread_t thread;
+
+	wake_fd = eventfd(0, EFD_NONBLOCK);
+	epoll_fd = epoll_create1(0);
+	if (wake_fd < 0 || epoll_fd < 0)
+	{
+		perror("watch_start");
+		exit(1);
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+	if (pthread_create(&thread, NULL, watch_loop, NULL) != 0)
+	{
+		perror("pthread_create");
+		exit(1);
+	}
+	pthread_detach(thread);
+}
+
+// take over a spectator's socket, the session that read its request closes
+// its own descriptor as usual
+void watch_open(int fd, int binary, int game_id)
+{
+	watcher_t *w;
+
+	if (fd < 0)
+	{
+		return;
+	}
+	w = pool_get(&watcher_pool);
+	memset(w, 0, offsetof(watcher_t, queue));
+	w->type = POST_OPEN;
+	w->fd = fd;
+	w->binary = binary;
+	w->game_id = game_id;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	metric_add(METRIC_SPECTATORS, 1);
+	post(&w->mail);
+}
+
+void feed_header(feed_t *feed, const message_t *msg)
+{
+	post(&bcast_new(POST_HEADER, feed, msg)->mail);
+}
+
+void feed_publish(feed_t *feed, const message_t *msg)
+{
+	post(&bcast_new(POST_EVENT, feed, msg)->mail);
+}
+
+// the game is over, the feed's OVER was its last broadcast
+void feed_end(feed_t *feed)
+{
+	feed->type = POST_END;
+	post(&feed->mail);
+}
+
+// the game could not take the feed, its spectators are turned away
+void feed_refuse(feed_t *feed)
+{
+	feed->type = POST_REFUSE;
+	post(&feed->mail);
+}
@@ -0,0 +1,21 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "codec.h"
+
+// spectators: a watched game serializes each MOVD and OVER once into a
+// shared, immutable buffer and posts it to the broadcast thread, which owns
+// every spectator socket and queues a reference to that one buffer on each
+// of them, so the players never wait on a spectator
+typedef struct feed feed_t;
+
+void watch_start();
+void watch_open(int fd, int binary, int game_id);
+
+// game side, called while draining the game's mailbox
+void feed_header(feed_t *feed, const message_t *msg);
+void feed_publish(feed_t *feed, const message_t *msg);
+void feed_end(feed_t *feed);
+void feed_refuse(feed_t *feed);
+
+#endif // WATCH_H
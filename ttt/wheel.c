@@ -0,0 +1,214 @@
+#include "wheel.h"
+#include "sim.h"
+#include <stddef.h>
+#include <time.h>
+
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+
+long wheel_now()
+{
+#ifdef TTT_SIM
+	return sim_clock / 1000000;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+#endif
+}
+
+void wheel_init(wheel_t *wheel)
+{
+	wheel->now = wheel_now();
+	for (int i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++)
+	{
+		wheel->slots[i].prev = &wheel->slots[i];
+		wheel->slots[i].next = &wheel->slots[i];
+		wheel->slots[i].slot = -1;
+	}
+	for (int level = 0; level < WHEEL_LEVELS; level++)
+	{
+		for (int i = 0; i < WHEEL_SLOTS / 64; i++)
+		{
+			wheel->occupied[level][i] = 0;
+		}
+	}
+}
+
+void alarm_init(alarm_t *alarm, void (*fire)(alarm_t *alarm), void *ctx)
+{
+	alarm->prev = NULL;
+	alarm->next = NULL;
+	alarm->slot = -1;
+	alarm->fire = fire;
+	alarm->ctx = ctx;
+}
+
+// hang the alarm in the slot its distance from now falls into; level 0
+// slots come round every tick, each higher one 256 times more rarely
+static void wheel_place(wheel_t *wheel, alarm_t *alarm)
+{
+	long delta = alarm->expires - wheel->now;
+	int level = 0;
+
+	while (level < WHEEL_LEVELS - 1 && delta >= 1L << (WHEEL_BITS * (level + 1)))
+	{
+		level++;
+	}
+	if (delta >= 1L << (WHEEL_BITS * WHEEL_LEVELS))
+	{
+		alarm->expires = wheel->now + (1L << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+	}
+
+	int slot = (alarm->expires >> (WHEEL_BITS * level)) & SLOT_MASK;
+	alarm_t *head = &wheel->slots[level * WHEEL_SLOTS + slot];
+	alarm->slot = level * WHEEL_SLOTS + slot;
+	alarm->prev = head->prev;
+	alarm->next = head;
+	head->prev->next = alarm;
+	head->prev = alarm;
+	wheel->occupied[level][slot / 64] |= 1UL << (slot % 64);
+}
+
+// an alarm already due goes off on the next tick
+void wheel_arm(wheel_t *wheel, alarm_t *alarm, long expires)
+{
+	wheel_cancel(wheel, alarm);
+	alarm->expires = (expires > wheel->now) ? expires : wheel->now + 1;
+	wheel_place(wheel, alarm);
+}
+
+void wheel_cancel(wheel_t *wheel, alarm_t *alarm)
+{
+	if (alarm->slot < 0)
+	{
+		return;
+	}
+
+	alarm_t *head = &wheel->slots[alarm->slot];
+	alarm->prev->next = alarm->next;
+	alarm->next->prev = alarm->prev;
+	if (head->next == head)
+	{
+		int slot = alarm->slot % WHEEL_SLOTS;
+		wheel->occupied[alarm->slot / WHEEL_SLOTS][slot / 64] &= ~(1UL << (slot % 64));
+	}
+	alarm->slot = -1;
+}
+
+// distance from pos to the next occupied slot of a level, 1 to 256 with
+// pos itself coming last, or 0 when the level is empty
+static int next_slot(const uint64_t *occupied, int pos)
+{
+	int d = 1;
+
+	while (d <= WHEEL_SLOTS)
+	{
+		int slot = (pos + d) & SLOT_MASK;
+		uint64_t bits = occupied[slot / 64] >> (slot % 64);
+		if (bits != 0)
+		{
+			return d + __builtin_ctzl(bits);
+		}
+		d += 64 - slot % 64;
+	}
+	return 0;
+}
+
+// the next tick with anything to do, -1 when no alarm is armed: a level 0
+// slot fires on its tick, a higher slot moves its alarms down on the tick
+// its range starts
+static long wheel_next(wheel_t *wheel)
+{
+	long next = -1;
+
+	for (int level = 0; level < WHEEL_LEVELS; level++)
+	{
+		int shift = WHEEL_BITS * level;
+		int d = next_slot(wheel->occupied[level], (wheel->now >> shift) & SLOT_MASK);
+		if (d != 0)
+		{
+			long when = ((wheel->now >> shift) + d) << shift;
+			if (next == -1 || when < next)
+			{
+				next = when;
+			}
+		}
+	}
+	return next;
+}
+
+// unhook every alarm of a slot, the slot is empty again afterwards
+static void take_slot(wheel_t *wheel, int level, int slot, alarm_t *list)
+{
+	alarm_t *head = &wheel->slots[level * WHEEL_SLOTS + slot];
+
+	list->prev = list;
+	list->next = list;
+	if (head->next != head)
+	{
+		list->next = head->next;
+		list->prev = head->prev;
+		list->next->prev = list;
+		list->prev->next = list;
+		head->next = head;
+		head->prev = head;
+	}
+	wheel->occupied[level][slot / 64] &= ~(1UL << (slot % 64));
+}
+
+// milliseconds until the wheel next needs running, -1 when nothing is armed
+int wheel_timeout(wheel_t *wheel)
+{
+	long next = wheel_next(wheel);
+	long now = wheel_now();
+
+	if (next == -1)
+	{
+		return -1;
+	}
+	return (next > now) ? next - now : 0;
+}
+
+// fire every alarm due by now, skipping straight over ticks with nothing
+// in their slots; an alarm may rearm or cancel any alarm of the wheel,
+// itself included, from its fire callback
+void wheel_run(wheel_t *wheel, long now)
+{
+	alarm_t list;
+	long tick;
+
+	while ((tick = wheel_next(wheel)) != -1 && tick <= now)
+	{
+		wheel->now = tick;
+		for (int level = WHEEL_LEVELS - 1; level > 0; level--)
+		{
+			int shift = WHEEL_BITS * level;
+			if ((tick & ((1L << shift) - 1)) != 0)
+			{
+				continue;
+			}
+			take_slot(wheel, level, (tick >> shift) & SLOT_MASK, &list);
+			while (list.next != &list)
+			{
+				alarm_t *alarm = list.next;
+				list.next = alarm->next;
+				alarm->next->prev = &list;
+				wheel_place(wheel, alarm);
+			}
+		}
+
+		take_slot(wheel, 0, tick & SLOT_MASK, &list);
+		while (list.next != &list)
+		{
+			alarm_t *alarm = list.next;
+			list.next = alarm->next;
+			alarm->next->prev = &list;
+			alarm->slot = -1;
+			alarm->fire(alarm);
+		}
+	}
+	if (now > wheel->now)
+	{
+		wheel->now = now;
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+// one pending timeout, embedded in whatever it belongs to so arming never
+// allocates; fire runs on the thread that runs the wheel, after the alarm
+// has been taken off it
+typedef struct alarm
+{
+	struct alarm *prev;
+	struct alarm *next;
+	long expires;               // milliseconds on the wheel_now() clock
+	int slot;                   // level * WHEEL_SLOTS + slot, -1 while not armed
+	void (*fire)(struct alarm *alarm);
+	void *ctx;
+}
+alarm_t;
+
+// hierarchical timing wheel with 1ms ticks: four levels of 256 slots cover
+// 256ms, 65s, 4.6 hours and 49 days, an alarm sits in the level its distance
+// falls into and moves down a level each time its slot comes round, so
+// arming and cancelling are a list insert and unlink; a wheel belongs to one
+// thread, the event loop whose sessions it times
+typedef struct
+{
+	long now;
+	alarm_t slots[WHEEL_LEVELS * WHEEL_SLOTS];
+	uint64_t occupied[WHEEL_LEVELS][WHEEL_SLOTS / 64];
+}
+wheel_t;
+
+long wheel_now();
+void wheel_init(wheel_t *wheel);
+void alarm_init(alarm_t *alarm, void (*fire)(alarm_t *alarm), void *ctx);
+void wheel_arm(wheel_t *wheel, alarm_t *alarm, long expires);
+void wheel_cancel(wheel_t *wheel, alarm_t *alarm);
+int wheel_timeout(wheel_t *wheel);
+void wheel_run(wheel_t *wheel, long now);
+
+#endif // WHEEL_H